@@ -30,8 +30,12 @@
 #define VGACTL_ADDR     (DEVICE_BASE + 0x0000100)
 #define AUDIO_ADDR      (DEVICE_BASE + 0x0000200)
 #define DISK_ADDR       (DEVICE_BASE + 0x0000300)
+#define GPU_ADDR        (DEVICE_BASE + 0x0000400)
+#define DMA_ADDR        (DEVICE_BASE + 0x0000500)
+#define NET_ADDR        (DEVICE_BASE + 0x0000600)
 #define FB_ADDR         (MMIO_BASE   + 0x1000000)
 #define AUDIO_SBUF_ADDR (MMIO_BASE   + 0x1200000)
+#define CLINT_ADDR      (MMIO_BASE   + 0x2000000)
 
 extern char _pmem_start;
 #define PMEM_SIZE (128 * 1024 * 1024)
@@ -39,7 +43,8 @@ extern char _pmem_start;
 #define NEMU_PADDR_SPACE \
   RANGE(&_pmem_start, PMEM_END), \
   RANGE(FB_ADDR, FB_ADDR + 0x200000), \
-  RANGE(MMIO_BASE, MMIO_BASE + 0x1000) /* serial, rtc, screen, keyboard */
+  RANGE(MMIO_BASE, MMIO_BASE + 0x1000), /* serial, rtc, screen, keyboard, gpu, dma */ \
+  RANGE(CLINT_ADDR, CLINT_ADDR + 0x10000)
 
 typedef uintptr_t PTE;
 
@@ -9,6 +9,9 @@
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 #define AUDIO_FRONT_ADDR     (AUDIO_ADDR + 0x18)
 #define AUDIO_REAR_ADDR      (AUDIO_ADDR + 0x1c)
+#define AUDIO_PUSH_ADDR      (AUDIO_ADDR + 0x20)
+
+bool __am_dma_copy(void *dst, const void *src, size_t len);
 
 static int bufsize;
 
@@ -34,17 +37,20 @@ void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
 }
 
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
-  char *p = (char *)ctl->buf.start;
-  uint32_t count;
-  uint32_t rear;
-  while (p != (char *)ctl->buf.end) {
-    count = inl(AUDIO_COUNT_ADDR);
-    if (count < bufsize) {
-      rear = inl(AUDIO_REAR_ADDR);
-      outb(AUDIO_SBUF_ADDR + rear, *p);
-      outl(AUDIO_COUNT_ADDR, count + 1);
-      outl(AUDIO_REAR_ADDR, (rear + 1) % bufsize);
-      p++;
+  uint8_t *p = ctl->buf.start, *end = ctl->buf.end;
+  while (p < end) {
+    uint32_t count = inl(AUDIO_COUNT_ADDR);
+    if (count == bufsize) continue;
+    uint32_t rear = inl(AUDIO_REAR_ADDR);
+    // as much as fits before the end of sbuf
+    uint32_t n = bufsize - count;
+    if (n > bufsize - rear) n = bufsize - rear;
+    if (n > end - p) n = end - p;
+    if (!__am_dma_copy((void *)(uintptr_t)(AUDIO_SBUF_ADDR + rear), p, n)) {
+      uint32_t i;
+      for (i = 0; i < n; i ++) outb(AUDIO_SBUF_ADDR + rear + i, p[i]);
     }
+    outl(AUDIO_PUSH_ADDR, n);
+    p += n;
   }
 }
@@ -1,12 +1,75 @@
 #include <am.h>
+#include <klib.h>
 #include <nemu.h>
 
+#define DISK_BLKSZ_ADDR     (DISK_ADDR + 0x00)
+#define DISK_BLKCNT_ADDR    (DISK_ADDR + 0x04)
+#define DISK_RING_ADDR      (DISK_ADDR + 0x08)
+#define DISK_RING_SIZE_ADDR (DISK_ADDR + 0x0c)
+#define DISK_AVAIL_ADDR     (DISK_ADDR + 0x10)
+#define DISK_USED_ADDR      (DISK_ADDR + 0x14)
+
+enum { DISK_READ, DISK_WRITE, DISK_FLUSH };
+enum { DISK_PENDING, DISK_OK, DISK_IOERR, DISK_UNSUPP };
+
+typedef struct {
+  uint32_t type;
+  volatile uint32_t status;
+  uint32_t blkno, nblk;
+  uint32_t buf;
+  uint32_t pad[3];
+} DiskDesc;
+
+bool __am_is_phys(const void *p, size_t len);
+
+// requests are served one at a time, so a ring of one descriptor is enough
+static DiskDesc ring[1];
+static uint32_t avail = 0;
+static int blksz, blkcnt;
+static uint8_t bounce[4096]; // for buffers the device can not reach
+
+void __am_disk_init() {
+  blksz = inl(DISK_BLKSZ_ADDR);
+  blkcnt = inl(DISK_BLKCNT_ADDR);
+  outl(DISK_RING_ADDR, (uintptr_t)ring);
+  outl(DISK_RING_SIZE_ADDR, LENGTH(ring));
+  avail = inl(DISK_USED_ADDR);
+}
+
 void __am_disk_config(AM_DISK_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = blkcnt > 0;
+  cfg->blksz = blksz;
+  cfg->blkcnt = blkcnt;
 }
 
 void __am_disk_status(AM_DISK_STATUS_T *stat) {
+  stat->ready = true;
+}
+
+static void request(int type, void *buf, int blkno, int nblk) {
+  DiskDesc *d = &ring[avail % LENGTH(ring)];
+  d->type = type;
+  d->status = DISK_PENDING;
+  d->blkno = blkno;
+  d->nblk = nblk;
+  d->buf = (uintptr_t)buf;
+  outl(DISK_AVAIL_ADDR, ++ avail);
+  while (d->status == DISK_PENDING);
+  panic_on(d->status != DISK_OK, "disk I/O error");
 }
 
 void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
+  int type = (io->write ? DISK_WRITE : DISK_READ);
+  if (__am_is_phys(io->buf, io->blkcnt * blksz)) {
+    request(type, io->buf, io->blkno, io->blkcnt);
+    return;
+  }
+  int n = sizeof(bounce) / blksz, i;
+  for (i = 0; i < io->blkcnt; i += n) {
+    int k = (io->blkcnt - i < n ? io->blkcnt - i : n);
+    uint8_t *p = (uint8_t *)io->buf + i * blksz;
+    if (io->write) memcpy(bounce, p, k * blksz);
+    request(type, bounce, io->blkno + i, k);
+    if (!io->write) memcpy(p, bounce, k * blksz);
+  }
 }
@@ -0,0 +1,37 @@
+#include <am.h>
+#include <nemu.h>
+
+#define DMA_SRC_ADDR    (DMA_ADDR + 0x00)
+#define DMA_DST_ADDR    (DMA_ADDR + 0x04)
+#define DMA_LEN_ADDR    (DMA_ADDR + 0x08)
+#define DMA_CTRL_ADDR   (DMA_ADDR + 0x0c)
+#define DMA_STATUS_ADDR (DMA_ADDR + 0x10)
+#define CAPS_ADDR       (VGACTL_ADDR + 8)
+
+#define CAP_DMA 0x2
+
+#define DMA_START 0x1
+#define DMA_DONE  0x1
+#define DMA_ERROR 0x2
+
+// devices take physical addresses, which are only known for pmem and the devices, as they are identity mapped
+bool __am_is_phys(const void *p, size_t len) {
+  uintptr_t a = (uintptr_t)p;
+  return a + len >= a && ((a >= (uintptr_t)&_pmem_start && a + len <= PMEM_END) || a >= MMIO_BASE);
+}
+
+// return false if the engine can not do the copy, and the caller should do it
+bool __am_dma_copy(void *dst, const void *src, size_t len) {
+  // a NEMU without the engine has no registers to poll
+  static int has_dma = -1;
+  if (has_dma < 0) has_dma = (inl(CAPS_ADDR) & CAP_DMA) != 0;
+  if (!has_dma || len == 0 || len > 0xffffffffu || !__am_is_phys(dst, len) || !__am_is_phys(src, len)) return false;
+  outl(DMA_SRC_ADDR, (uintptr_t)src);
+  outl(DMA_DST_ADDR, (uintptr_t)dst);
+  outl(DMA_LEN_ADDR, len);
+  outl(DMA_CTRL_ADDR, DMA_START);
+  uint32_t status;
+  while (!((status = inl(DMA_STATUS_ADDR)) & DMA_DONE));
+  outl(DMA_STATUS_ADDR, 0);
+  return !(status & DMA_ERROR);
+}
@@ -3,30 +3,90 @@
 #include <nemu.h>
 
 #define SYNC_ADDR (VGACTL_ADDR + 4)
+#define CAPS_ADDR (VGACTL_ADDR + 8)
+
+#define CAP_GPU 0x1
+#define CAP_DMA 0x2
+
+#define GPU_QUEUE_ADDR (GPU_ADDR + 0x00)
+#define GPU_COUNT_ADDR (GPU_ADDR + 0x04)
+#define GPU_START_ADDR (GPU_ADDR + 0x08)
+#define GPU_DONE_ADDR  (GPU_ADDR + 0x0c)
+
+enum { GPU_NOP, GPU_FILL, GPU_BLIT, GPU_BLIT_KEY, GPU_PAL8, GPU_SCALE };
+
+typedef struct {
+  uint32_t op;
+  uint32_t dst, dst_pitch;
+  uint16_t w, h;
+  uint32_t src, src_pitch;
+  uint16_t sw, sh;
+  uint32_t arg;
+} GPUCmd;
+
+bool __am_dma_copy(void *dst, const void *src, size_t len);
 
 static int w, h;
+static uint32_t caps;
+static GPUCmd queue[64];
+static int nr_cmd = 0;
 
 void __am_gpu_init() {
   w = (inl(VGACTL_ADDR) >> 16) & 0xffff;
   h = inl(VGACTL_ADDR) & 0xffff;
+  // the accelerator and the DMA engine are optional
+  caps = inl(CAPS_ADDR);
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
+    .present = true, .has_accel = (caps & CAP_GPU) != 0,
     .width = w, .height = h,
     .vmemsz = w * h
   };
 }
 
+// the accelerator takes physical addresses, which are only known for the identity mapped pmem
+static bool is_phys(const void *p, size_t len) {
+  uintptr_t a = (uintptr_t)p;
+  return a >= (uintptr_t)&_pmem_start && a + len <= PMEM_END;
+}
+
+static void flush() {
+  if (nr_cmd == 0) return;
+  outl(GPU_QUEUE_ADDR, (uintptr_t)queue);
+  outl(GPU_COUNT_ADDR, nr_cmd);
+  outl(GPU_START_ADDR, 1);
+  panic_on(inl(GPU_DONE_ADDR) != nr_cmd, "bad command to the 2D accelerator");
+  nr_cmd = 0;
+}
+
+static GPUCmd *new_cmd(int op) {
+  if (nr_cmd == LENGTH(queue)) flush();
+  GPUCmd *c = &queue[nr_cmd ++];
+  *c = (GPUCmd) { .op = op };
+  return c;
+}
+
 void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
   // get frame buffer
   uint32_t *fb = (uint32_t *)(uintptr_t)FB_ADDR;
   uint32_t *pix = (uint32_t *)ctl->pixels;
-  int i, j;
-  for (j = 0; j < ctl->h; j++) {
-    for (i = 0; i < ctl->w; i++) {
-      fb[(ctl->y + j) * w + (ctl->x + i)] = pix[j * ctl->w + i];
+  if ((caps & CAP_GPU) && ctl->w > 0 && ctl->h > 0 && is_phys(pix, ctl->w * ctl->h * 4)) {
+    GPUCmd *c = new_cmd(GPU_BLIT);
+    c->dst = FB_ADDR + (ctl->y * w + ctl->x) * 4;
+    c->dst_pitch = w * 4;
+    c->w = ctl->w;
+    c->h = ctl->h;
+    c->src = (uintptr_t)pix;
+    c->src_pitch = ctl->w * 4;
+    flush();
+  } else {
+    int i, j;
+    for (j = 0; j < ctl->h; j++) {
+      for (i = 0; i < ctl->w; i++) {
+        fb[(ctl->y + j) * w + (ctl->x + i)] = pix[j * ctl->w + i];
+      }
     }
   }
   if (ctl->sync) {
@@ -35,7 +95,65 @@ void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
 }
 
 void __am_gpu_memcpy(AM_GPU_MEMCPY_T *mcp) {
-  memcpy((uint32_t *)FB_ADDR + mcp->dest, mcp->src, mcp->size);
+  uint32_t *dst = (uint32_t *)FB_ADDR + mcp->dest;
+  if (!((caps & CAP_DMA) && __am_dma_copy(dst, mcp->src, mcp->size))) {
+    memcpy(dst, mcp->src, mcp->size);
+  }
+  outl(SYNC_ADDR, 1);
+}
+
+/* Unlike the GPU of x86-qemu, there is no memory of the GPU besides
+ * the frame buffer, so a gpuptr_t is the physical address of a canvas
+ * or of the pixels of a texture.
+ */
+static uint8_t vbuf[1 << 20], *vbuf_head;
+
+static uint32_t vbuf_alloc(int size) {
+  uint8_t *ret = vbuf_head;
+  vbuf_head += size;
+  panic_on(vbuf_head > vbuf + sizeof(vbuf), "no memory");
+  return (uintptr_t)ret;
+}
+
+static void render(struct gpu_canvas *cv, struct gpu_canvas *parent, uint32_t px) {
+  uint32_t px_local;
+  int W = parent->w, w, h;
+
+  switch (cv->type) {
+    case AM_GPU_TEXTURE: {
+      w = cv->texture.w; h = cv->texture.h;
+      px_local = cv->texture.pixels;
+      break;
+    }
+    case AM_GPU_SUBTREE: {
+      w = cv->w; h = cv->h;
+      px_local = vbuf_alloc(w * h * 4);
+      GPUCmd *c = new_cmd(GPU_FILL);
+      c->dst = px_local; c->dst_pitch = w * 4; c->w = w; c->h = h; c->arg = 0;
+      gpuptr_t p;
+      for (p = cv->child; p != AM_GPU_NULL; p = ((struct gpu_canvas *)(uintptr_t)p)->sibling) {
+        render((struct gpu_canvas *)(uintptr_t)p, cv, px_local);
+      }
+      break;
+    }
+    default:
+      panic("invalid node");
+  }
+
+  // draw local canvas (w * h) -> px (x1, y1) - (x1 + w1, y1 + h1)
+  GPUCmd *c = new_cmd(GPU_SCALE);
+  c->dst = px + (cv->y1 * W + cv->x1) * 4; c->dst_pitch = W * 4;
+  c->w = cv->w1; c->h = cv->h1;
+  c->src = px_local; c->src_pitch = w * 4;
+  c->sw = w; c->sh = h;
+}
+
+void __am_gpu_render(AM_GPU_RENDER_T *ren) {
+  panic_on(!(caps & CAP_GPU), "no 2D accelerator");
+  struct gpu_canvas display = { .w = w, .h = h };
+  vbuf_head = vbuf;
+  render((struct gpu_canvas *)(uintptr_t)ren->root, &display, FB_ADDR);
+  flush();
   outl(SYNC_ADDR, 1);
 }
 
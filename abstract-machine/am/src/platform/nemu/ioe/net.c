@@ -0,0 +1,94 @@
+#include <am.h>
+#include <klib.h>
+#include <nemu.h>
+
+#define NET_LINK_ADDR      (NET_ADDR + 0x08)
+#define NET_RING_SIZE_ADDR (NET_ADDR + 0x0c)
+#define NET_TX_RING_ADDR   (NET_ADDR + 0x10)
+#define NET_TX_AVAIL_ADDR  (NET_ADDR + 0x14)
+#define NET_TX_USED_ADDR   (NET_ADDR + 0x18)
+#define NET_RX_RING_ADDR   (NET_ADDR + 0x1c)
+#define NET_RX_AVAIL_ADDR  (NET_ADDR + 0x20)
+#define NET_RX_USED_ADDR   (NET_ADDR + 0x24)
+
+enum { NET_PENDING, NET_OK, NET_IOERR };
+
+typedef struct {
+  uint32_t buf;
+  volatile uint32_t len;
+  volatile uint32_t status;
+  uint32_t pad;
+} NetDesc;
+
+#define NR_DESC 16
+#define FRAME_SIZE 1536
+
+bool __am_is_phys(const void *p, size_t len);
+
+// every RX descriptor owns a buffer, and is posted again once its frame is read
+static NetDesc tx_ring[NR_DESC], rx_ring[NR_DESC];
+static uint8_t rx_buf[NR_DESC][FRAME_SIZE];
+static uint8_t bounce[FRAME_SIZE]; // for TX frames the device can not reach
+static uint32_t tx_avail = 0, rx_avail = 0, rx_next = 0;
+
+static void post_rx(NetDesc *d) {
+  d->len = FRAME_SIZE;
+  d->status = NET_PENDING;
+  outl(NET_RX_AVAIL_ADDR, ++ rx_avail);
+}
+
+void __am_net_init() {
+  outl(NET_RING_SIZE_ADDR, NR_DESC);
+  outl(NET_TX_RING_ADDR, (uintptr_t)tx_ring);
+  outl(NET_RX_RING_ADDR, (uintptr_t)rx_ring);
+  tx_avail = inl(NET_TX_USED_ADDR);
+  rx_avail = rx_next = inl(NET_RX_USED_ADDR);
+  for (int i = 0; i < NR_DESC; i ++) {
+    NetDesc *d = &rx_ring[rx_avail % NR_DESC];
+    d->buf = (uintptr_t)rx_buf[rx_avail % NR_DESC];
+    post_rx(d);
+  }
+}
+
+void __am_net_config(AM_NET_CONFIG_T *cfg) {
+  cfg->present = true;
+}
+
+// the next frame received, skipping the failed ones
+static NetDesc *rx_frame() {
+  while (rx_next != inl(NET_RX_USED_ADDR)) {
+    NetDesc *d = &rx_ring[rx_next % NR_DESC];
+    if (d->status == NET_OK) return d;
+    rx_next ++;
+    post_rx(d);
+  }
+  return NULL;
+}
+
+void __am_net_status(AM_NET_STATUS_T *stat) {
+  NetDesc *d = rx_frame();
+  stat->rx_len = (d ? d->len : 0);
+  stat->tx_len = (inl(NET_LINK_ADDR) ? FRAME_SIZE : 0);
+}
+
+void __am_net_tx(AM_NET_TX_T *tx) {
+  size_t len = tx->buf.end - tx->buf.start;
+  panic_on(len > FRAME_SIZE, "frame too long");
+  void *p = tx->buf.start;
+  if (!__am_is_phys(p, len)) p = memcpy(bounce, p, len);
+  NetDesc *d = &tx_ring[tx_avail % NR_DESC];
+  d->buf = (uintptr_t)p;
+  d->len = len;
+  d->status = NET_PENDING;
+  outl(NET_TX_AVAIL_ADDR, ++ tx_avail);
+  while (d->status == NET_PENDING);
+}
+
+void __am_net_rx(AM_NET_RX_T *rx) {
+  NetDesc *d = rx_frame();
+  if (d == NULL) return;
+  size_t len = rx->buf.end - rx->buf.start;
+  memcpy(rx->buf.start, (void *)(uintptr_t)d->buf, d->len < len ? d->len : len);
+  rx_next ++;
+  post_rx(d);
+}
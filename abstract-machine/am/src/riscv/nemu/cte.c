@@ -1,14 +1,35 @@
 #include <am.h>
-#include <riscv/riscv.h>
+#include <nemu.h>
 #include <klib.h>
 
+#define CLINT_MTIMECMP (CLINT_ADDR + 0x4000)
+#define CLINT_MTIME    (CLINT_ADDR + 0xbff8)
+#define TIMESLICE      10000 // in mtime ticks
+
 static Context* (*user_handler)(Event, Context*) = NULL;
 
+static void set_next_timer() {
+  uint32_t hi, lo;
+  do {
+    hi = inl(CLINT_MTIME + 4);
+    lo = inl(CLINT_MTIME);
+  } while (hi != inl(CLINT_MTIME + 4));
+  uint64_t next = ((uint64_t)hi << 32 | lo) + TIMESLICE;
+  // keep mtimecmp above mtime while it is written in halves
+  outl(CLINT_MTIMECMP, -1);
+  outl(CLINT_MTIMECMP + 4, next >> 32);
+  outl(CLINT_MTIMECMP, (uint32_t)next);
+}
+
 Context* __am_irq_handle(Context *c) {
   if (user_handler) {
     Event ev = {0};
     switch (c->mcause) {
+      case IRQ_TIMER:
+        set_next_timer();
+        ev.event = EVENT_IRQ_TIMER; break;
       case TRAP_MECALL: 
+        c->mepc += 4;
         if (c->GPR1 == -1) {
           ev.event = EVENT_YIELD; break;
         } else if (c->GPR1 >= 0 && c->GPR1 <= 19) {
@@ -33,6 +54,8 @@ bool cte_init(Context*(*handler)(Event, Context*)) {
   // register event handler
   user_handler = handler;
 
+  set_next_timer();
+
   return true;
 }
 
@@ -45,8 +68,16 @@ void yield() {
 }
 
 bool ienabled() {
-  return false;
+  uintptr_t mstatus;
+  asm volatile("csrr %0, mstatus" : "=r"(mstatus));
+  return mstatus & MSTATUS_MIE;
 }
 
 void iset(bool enable) {
+  if (enable) {
+    asm volatile("csrs mie, %0" : : "r"(MIE_MTIE));
+    asm volatile("csrs mstatus, %0" : : "r"(MSTATUS_MIE));
+  } else {
+    asm volatile("csrc mstatus, %0" : : "r"(MSTATUS_MIE));
+  }
 }
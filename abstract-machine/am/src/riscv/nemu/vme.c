@@ -13,6 +13,17 @@ static Area segments[] = {      // Kernel memory mappings
 
 #define USER_SPACE RANGE(0x40000000, 0x80000000)
 
+// Sv32 on rv32, Sv39 on rv64
+#if __riscv_xlen == 32
+#define PT_LEVELS 2
+#define VPN_BITS  10
+#else
+#define PT_LEVELS 3
+#define VPN_BITS  9
+#endif
+#define VPN(va, level) (((uintptr_t)(va) >> (12 + (level) * VPN_BITS)) & ((1 << VPN_BITS) - 1))
+#define PTE_PPN_SHIFT 10
+
 static inline void set_satp(void *pdir) {
   uintptr_t mode = 1ul << (__riscv_xlen - 1);
   asm volatile("csrw satp, %0" : : "r"(mode | ((uintptr_t)pdir >> 12)));
@@ -67,6 +78,20 @@ void __am_switch(Context *c) {
 }
 
 void map(AddrSpace *as, void *va, void *pa, int prot) {
+  PTE *pt = (PTE *)as->ptr;
+  int level;
+  for (level = PT_LEVELS - 1; level > 0; level --) {
+    PTE *pte = &pt[VPN(va, level)];
+    if (!(*pte & PTE_V)) {
+      void *page = pgalloc_usr(PGSIZE);
+      memset(page, 0, PGSIZE);
+      *pte = ((uintptr_t)page >> 12) << PTE_PPN_SHIFT | PTE_V;
+    }
+    pt = (PTE *)((*pte >> PTE_PPN_SHIFT) << 12);
+  }
+  // A and D are preset, so that the hardware never has to update them
+  pt[VPN(va, 0)] = ((uintptr_t)pa >> 12) << PTE_PPN_SHIFT |
+    PTE_V | PTE_R | PTE_W | PTE_X | PTE_A | PTE_D | (prot ? PTE_U : 0);
 }
 
 Context *ucontext(AddrSpace *as, Area kstack, void *entry) {
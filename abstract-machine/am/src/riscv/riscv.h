@@ -24,6 +24,10 @@ enum { MODE_U, MODE_S, MODE_M = 3 };
 #define MSTATUS_SUM  (1 << 18)
 
 #define TRAP_MECALL 0xb
+#define IRQ_TIMER   ((uintptr_t)1 << (__riscv_xlen - 1) | 7)
+
+#define MSTATUS_MIE  (1 << 3)
+#define MIE_MTIE     (1 << 7)
 
 #if __riscv_xlen == 64
 #define MSTATUS_SXL  (2ull << 34)
@@ -42,12 +42,28 @@ int strncmp(const char *s1, const char *s2, size_t n) {
   return *(unsigned char *)s1 - *(unsigned char *)s2;
 }
 
+#ifdef __riscv_vector
+// strip-mined with the largest register group, v8-v15
+#define VCLOBBER "memory", "vl", "vtype", "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15"
+
+void *memset(void *s, int c, size_t n) {
+  char *p = (char *)s;
+  size_t vl;
+  for (; n > 0; n -= vl, p += vl) {
+    asm volatile ("vsetvli %0, %1, e8, m8, ta, ma\n"
+                  "vmv.v.x v8, %2\n"
+                  "vse8.v v8, (%3)" : "=&r"(vl) : "r"(n), "r"(c), "r"(p) : VCLOBBER);
+  }
+  return s;
+}
+#else
 void *memset(void *s, int c, size_t n) {
   char *pb = (char *)s;
   char *pbend = pb + n;
   while (pb != pbend) *pb++ = c;
   return s;
 }
+#endif
 
 void *memmove(void *dst, const void *src, size_t n) {
   void * ret = dst;
@@ -71,6 +87,19 @@ void *memmove(void *dst, const void *src, size_t n) {
   return ret;
 }
 
+#ifdef __riscv_vector
+void *memcpy(void *out, const void *in, size_t n) {
+  const char *s = (const char *)in;
+  char *d = (char *)out;
+  size_t vl;
+  for (; n > 0; n -= vl, s += vl, d += vl) {
+    asm volatile ("vsetvli %0, %1, e8, m8, ta, ma\n"
+                  "vle8.v v8, (%2)\n"
+                  "vse8.v v8, (%3)" : "=&r"(vl) : "r"(n), "r"(s), "r"(d) : VCLOBBER);
+  }
+  return out;
+}
+#else
 void *memcpy(void *out, const void *in, size_t n) {
   const char *s = (const char *)in;
   const char *end = s + n;
@@ -78,6 +107,7 @@ void *memcpy(void *out, const void *in, size_t n) {
   while (s != end) *d++ = *s++;
   return out;
 }
+#endif
 
 int memcmp(const void *s1, const void *s2, size_t n) {
   if (!n) return 0;
@@ -19,9 +19,15 @@
 #include <common.h>
 
 void cpu_exec(uint64_t n);
+// as cpu_exec(), without printing the instructions of a short run
+void cpu_exec_quiet(uint64_t n);
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
+// abandon the current instruction after the ISA has taken an exception
+void longjmp_exception();
+// make the execution loop poll devices and interrupts at instruction count `at'
+void cpu_schedule_event(uint64_t at);
 
 #define NEMUTRAP(thispc, code) set_nemu_state(NEMU_END, thispc, code)
 #define INV(thispc) invalid_inst(thispc)
@@ -30,4 +36,16 @@ void invalid_inst(vaddr_t thispc);
 void display_backtrace();
 #endif
 
+#ifdef CONFIG_WATCHPOINT
+/* One bit per hashed pc, set for the address of every breakpoint. The
+ * execution loop tests a single bit per instruction and only looks for
+ * the breakpoint itself when the bit is set.
+ */
+#define BP_FILTER_BITS 4096
+#define BP_FILTER_IDX(pc) (((pc) >> 1) & (BP_FILTER_BITS - 1))
+extern uint64_t bp_filter[BP_FILTER_BITS / 64];
+#define bp_filter_test(pc) ((bp_filter[BP_FILTER_IDX(pc) / 64] >> (BP_FILTER_IDX(pc) % 64)) & 1)
+void check_bp(vaddr_t pc);
+#endif
+
 #endif
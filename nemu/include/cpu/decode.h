@@ -17,6 +17,7 @@
 #define __CPU_DECODE_H__
 
 #include <isa.h>
+#include <cpu/perf.h>
 
 typedef struct Decode {
   vaddr_t pc;
@@ -86,11 +87,33 @@ finish:
 }
 
 
+// --- instruction mix counters ---
+#ifdef CONFIG_PERF
+// every INSTPAT gets its counter slot when it matches for the first time
+#define INSTPAT_PERF(name) do { \
+  static int __perf_id = -1; \
+  if (unlikely(__perf_id == -1)) __perf_id = perf_inst_id(name); \
+  perf_inst_cnt[__perf_id] ++; \
+} while (0)
+#else
+#define INSTPAT_PERF(name)
+#endif
+
+#define __INSTPAT_NAME(name, ...) #name
+
 // --- pattern matching wrappers for decode ---
+/* Every INSTPAT carries a label in front of its execute body. An ISA
+ * with a decode cache records `&&label' through INSTPAT_CACHE() when
+ * the pattern matches, and later jumps to it without matching again.
+ * Other ISAs define INSTPAT_CACHE(label) to be empty.
+ */
 #define INSTPAT(pattern, ...) do { \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
   if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+    INSTPAT_CACHE(&&concat(__instpat_, __LINE__)); \
+concat(__instpat_, __LINE__): __attribute__((unused)); \
+    INSTPAT_PERF(__INSTPAT_NAME(__VA_ARGS__)); \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
     goto *(__instpat_end); \
   } \
@@ -0,0 +1,80 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_FPU_H__
+#define __CPU_FPU_H__
+
+#include <common.h>
+
+#ifdef CONFIG_FPU
+/* IEEE 754 binary32/binary64 arithmetic on bit patterns, following the
+ * RISC-V conventions: NaN results are the canonical NaN, conversions to
+ * integers saturate, and exceptions accumulate into `*flags' in the
+ * layout of fflags. `rm' is a rounding mode in the encoding of frm,
+ * already resolved from the dynamic one.
+ */
+enum { FFLAG_NX = 0x01, FFLAG_UF = 0x02, FFLAG_OF = 0x04, FFLAG_DZ = 0x08, FFLAG_NV = 0x10 };
+enum { FRM_RNE, FRM_RTZ, FRM_RDN, FRM_RUP, FRM_RMM, FRM_DYN = 7 };
+
+#define F32_SIGN 0x80000000u
+#define F64_SIGN 0x8000000000000000ull
+#define F32_NAN  0x7fc00000u
+#define F64_NAN  0x7ff8000000000000ull
+
+uint32_t f32_add(uint32_t a, uint32_t b, int rm, uint32_t *flags);
+uint32_t f32_sub(uint32_t a, uint32_t b, int rm, uint32_t *flags);
+uint32_t f32_mul(uint32_t a, uint32_t b, int rm, uint32_t *flags);
+uint32_t f32_div(uint32_t a, uint32_t b, int rm, uint32_t *flags);
+uint32_t f32_sqrt(uint32_t a, int rm, uint32_t *flags);
+uint32_t f32_fma(uint32_t a, uint32_t b, uint32_t c, int rm, uint32_t *flags); // a * b + c
+uint32_t f32_min(uint32_t a, uint32_t b, uint32_t *flags);
+uint32_t f32_max(uint32_t a, uint32_t b, uint32_t *flags);
+bool f32_eq(uint32_t a, uint32_t b, uint32_t *flags);
+bool f32_lt(uint32_t a, uint32_t b, uint32_t *flags);
+bool f32_le(uint32_t a, uint32_t b, uint32_t *flags);
+uint32_t f32_class(uint32_t a);
+
+uint64_t f64_add(uint64_t a, uint64_t b, int rm, uint32_t *flags);
+uint64_t f64_sub(uint64_t a, uint64_t b, int rm, uint32_t *flags);
+uint64_t f64_mul(uint64_t a, uint64_t b, int rm, uint32_t *flags);
+uint64_t f64_div(uint64_t a, uint64_t b, int rm, uint32_t *flags);
+uint64_t f64_sqrt(uint64_t a, int rm, uint32_t *flags);
+uint64_t f64_fma(uint64_t a, uint64_t b, uint64_t c, int rm, uint32_t *flags);
+uint64_t f64_min(uint64_t a, uint64_t b, uint32_t *flags);
+uint64_t f64_max(uint64_t a, uint64_t b, uint32_t *flags);
+bool f64_eq(uint64_t a, uint64_t b, uint32_t *flags);
+bool f64_lt(uint64_t a, uint64_t b, uint32_t *flags);
+bool f64_le(uint64_t a, uint64_t b, uint32_t *flags);
+uint32_t f64_class(uint64_t a);
+
+uint64_t f32_to_f64(uint32_t a, uint32_t *flags);
+uint32_t f64_to_f32(uint64_t a, int rm, uint32_t *flags);
+
+int32_t  f32_to_i32(uint32_t a, int rm, uint32_t *flags);
+uint32_t f32_to_u32(uint32_t a, int rm, uint32_t *flags);
+int64_t  f32_to_i64(uint32_t a, int rm, uint32_t *flags);
+uint64_t f32_to_u64(uint32_t a, int rm, uint32_t *flags);
+int32_t  f64_to_i32(uint64_t a, int rm, uint32_t *flags);
+uint32_t f64_to_u32(uint64_t a, int rm, uint32_t *flags);
+int64_t  f64_to_i64(uint64_t a, int rm, uint32_t *flags);
+uint64_t f64_to_u64(uint64_t a, int rm, uint32_t *flags);
+
+uint32_t i64_to_f32(int64_t a, int rm, uint32_t *flags);
+uint32_t u64_to_f32(uint64_t a, int rm, uint32_t *flags);
+uint64_t i64_to_f64(int64_t a, int rm, uint32_t *flags);
+uint64_t u64_to_f64(uint64_t a, int rm, uint32_t *flags);
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_PERF_H__
+#define __CPU_PERF_H__
+
+#include <common.h>
+
+#ifdef CONFIG_PERF
+#define PERF_NR_INST 256
+
+// counters bumped directly by the hot paths
+extern uint64_t perf_inst_cnt[PERF_NR_INST];
+extern uint64_t perf_load[9], perf_store[9]; // indexed by the access size
+extern uint64_t perf_branch[2];              // not taken, taken
+extern uint64_t perf_device_update_time;     // unit: ns
+
+// the counter slot of the instruction named `name'
+int perf_inst_id(const char *name);
+void perf_trap(word_t cause);
+uint64_t perf_time_ns();
+
+void perf_display();
+void perf_dump();
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_TIMING_H__
+#define __CPU_TIMING_H__
+
+#include <common.h>
+
+#ifdef CONFIG_TIMING
+// instruction classes with their own latencies, reported by isa_inst_class()
+enum {
+  INST_ALU, INST_MUL, INST_DIV, INST_LOAD, INST_STORE,
+  INST_BRANCH, INST_JUMP, INST_IJUMP, // conditional, direct and indirect control transfers
+  INST_SYSTEM, NR_INST_CLASS
+};
+
+// --- set-associative cache with LRU replacement ---
+typedef struct {
+  const char *name;
+  int nr_set, nr_way, line_shift;
+  uint64_t *tag;   // nr_set * nr_way entries, 0 for an invalid line
+  uint64_t *stamp; // last access of every line, the smallest one is replaced
+  uint64_t clock;
+  uint64_t hit, miss;
+} Cache;
+
+void cache_init(Cache *c, const char *name, int size, int nr_way, int line_size);
+// return true on a hit, a miss fills the line
+bool cache_access(Cache *c, paddr_t addr);
+void cache_report(Cache *c);
+
+extern uint64_t g_nr_guest_cycle;
+
+void init_timing();
+struct Decode;
+void timing_exec(struct Decode *s);
+void timing_mem(paddr_t addr, int len, bool is_write);
+void timing_report();
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_VECTOR_H__
+#define __CPU_VECTOR_H__
+
+#include <common.h>
+
+#ifdef CONFIG_RVV
+/* A subset of the V extension shared by riscv32 and riscv64: unit-stride
+ * loads and stores, and integer add, sub, logic and multiply, at SEW of
+ * 8, 16 and 32 (ELEN = 32) and any legal LMUL. The registers of a group
+ * are adjacent in `vreg', so every instruction works on a single run of
+ * bytes, which the host handles with SIMD instructions.
+ */
+#define VLENB (CONFIG_RVV_VLEN / 8)
+static_assert((VLENB & (VLENB - 1)) == 0, "VLEN must be a power of 2");
+
+typedef struct {
+  uint8_t vreg[32 * VLENB] __attribute__((aligned(32)));
+  word_t vstart;
+  word_t vl;
+  word_t vtype; // vill in the most significant bit
+  uint32_t vcsr; // vxrm in [2:1], vxsat in [0]
+} VecState;
+
+#define VREG(v, i) ((v)->vreg + (i) * VLENB)
+#define VTYPE_VILL ((word_t)1 << (sizeof(word_t) * 8 - 1))
+
+// operations on elements, the result is vs2 op vs1 (or the scalar)
+enum { VOP_ADD, VOP_SUB, VOP_RSUB, VOP_AND, VOP_OR, VOP_XOR, VOP_MUL, VOP_MV, NR_VOP };
+
+void init_vector();
+// return the new vl
+word_t vec_setvl(VecState *v, word_t avl, word_t vtype);
+/* The following return false if the instruction is illegal under the
+ * current vtype. `eew' and SEW are log2 of the element size in bytes.
+ */
+bool vec_load(VecState *v, int vd, vaddr_t addr, int eew, bool masked);
+bool vec_store(VecState *v, int vs3, vaddr_t addr, int eew, bool masked);
+bool vec_op_vv(VecState *v, int op, int vd, int vs2, int vs1, bool masked);
+bool vec_op_vx(VecState *v, int op, int vd, int vs2, word_t x, bool masked);
+#endif
+
+#endif
@@ -13,12 +13,20 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#ifndef __DEVICE_ALARM_H__
-#define __DEVICE_ALARM_H__
+#ifndef __DEVICE_INTR_H__
+#define __DEVICE_INTR_H__
 
-#define TIMER_HZ 60
+#include <common.h>
 
-typedef void (*alarm_handler_t) ();
-void add_alarm_handle(alarm_handler_t h);
+// bits in mip
+#define IRQ_MSI 3
+#define IRQ_MTI 7
+#define IRQ_MEI 11
+
+// the external interrupt is shared, and pending while any of its sources is
+enum { EXT_IRQ_DMA, EXT_IRQ_AUDIO, EXT_IRQ_DISK, EXT_IRQ_SERIAL, EXT_IRQ_NET, NR_EXT_IRQ };
+
+void dev_set_irq(int irq, bool level);
+void dev_set_ext_irq(int source, bool level);
 
 #endif
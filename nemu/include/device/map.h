@@ -21,6 +21,22 @@
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
 
+/* A device may describe its registers instead of giving one callback
+ * for every access. The hook of a register runs only for the kinds of
+ * access with side effects, before a read or after a write, and gets
+ * the part of the access inside the register, with the offset in the
+ * map. Registers without side effects, and bytes not in any register,
+ * such as buffers or a frame buffer, are plain memory.
+ */
+#define IO_HOOK_R 1
+#define IO_HOOK_W 2
+
+typedef struct {
+  uint32_t offset, size; // in bytes
+  int flags;
+  io_callback_t hook;
+} IOReg;
+
 typedef struct {
   const char *name;
   // we treat ioaddr_t as paddr_t here
@@ -28,6 +44,13 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  const IOReg *regs;  // sorted by offset, instead of the callback
+  int nr_reg;
+  int hook_flags;     // union of the flags of the registers
+#ifdef CONFIG_PERF
+  uint64_t nr_read, nr_write;
+  uint64_t callback_time; // unit: ns
+#endif
 } IOMap;
 
 static inline bool map_inside(IOMap *map, paddr_t addr) {
@@ -49,8 +72,18 @@ void add_pio_map(const char *name, ioaddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 void add_mmio_map(const char *name, paddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
+void add_pio_bank(const char *name, ioaddr_t addr,
+        void *space, uint32_t len, const IOReg *regs, int nr_reg);
+void add_mmio_bank(const char *name, paddr_t addr,
+        void *space, uint32_t len, const IOReg *regs, int nr_reg);
+void map_set_regs(IOMap *map, const IOReg *regs, int nr_reg);
+void map_invoke(IOMap *map, paddr_t offset, int len, bool is_write);
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
 
+#ifdef CONFIG_PERF
+void perf_add_map(IOMap *map, bool is_pio);
+#endif
+
 #endif
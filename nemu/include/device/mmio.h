@@ -20,5 +20,6 @@
 
 word_t mmio_read(paddr_t addr, int len);
 void mmio_write(paddr_t addr, int len, word_t data);
+uint8_t* mmio_dma_ptr(paddr_t addr, uint32_t len, bool is_write);
 
 #endif
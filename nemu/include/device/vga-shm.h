@@ -0,0 +1,39 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_VGA_SHM_H__
+#define __DEVICE_VGA_SHM_H__
+
+#include <stdint.h>
+
+/* With CONFIG_VGA_SHM, the registers of vgactl and vmem live in a POSIX
+ * shared memory object named CONFIG_VGA_SHM_NAME, so that another
+ * process can map it and read frames in place. The object starts with
+ * this header, and the pixels (ARGB8888, `width' per row) follow at
+ * VGA_SHM_FB_OFFSET. `seq' is bumped with release semantics after each
+ * sync of the guest; the guest may write vmem at any time, so a frame
+ * read between two syncs may be torn, as on real hardware.
+ */
+#define VGA_SHM_MAGIC 0x5647454e // "NEGV"
+#define VGA_SHM_FB_OFFSET 4096
+
+typedef struct {
+  uint32_t magic;
+  uint32_t width, height;
+  uint32_t vgactl[3]; // the registers seen by the guest
+  uint64_t seq;       // syncs so far
+} VGAShm;
+
+#endif
@@ -32,10 +32,18 @@ void init_isa();
 extern CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
+// index of register `name' as accepted by isa_reg_ptr(), -1 if there is no such register
+int isa_reg_str2idx(const char *name);
+// registers in the order of the gdb `g' packet, NULL if `idx' is out of range
+word_t *isa_reg_ptr(int idx);
 
 // exec
 struct Decode;
 int isa_exec_once(struct Decode *s);
+#ifdef CONFIG_TIMING
+// the class of the instruction just executed, see cpu/timing.h
+int isa_inst_class(struct Decode *s);
+#endif
 
 // memory
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
@@ -45,11 +53,15 @@ enum { MEM_RET_OK, MEM_RET_FAIL, MEM_RET_CROSS_PAGE };
 int isa_mmu_check(vaddr_t vaddr, int len, int type);
 #endif
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type);
+// for the debugger: the same as isa_mmu_translate(), but changes neither memory nor the TLB
+paddr_t isa_mmu_debug_translate(vaddr_t vaddr, int type);
+void isa_mmu_fault(vaddr_t vaddr, int type);
 
 // interrupt/exception
 vaddr_t isa_raise_intr(word_t NO, vaddr_t epc);
 #define INTR_EMPTY ((word_t)-1)
 word_t isa_query_intr();
+void isa_set_irq(int irq, bool level);
 
 // difftest
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc);
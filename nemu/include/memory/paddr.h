@@ -34,4 +34,16 @@ static inline bool in_pmem(paddr_t addr) {
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+/* For devices moving blocks of data on their own: the host memory
+ * behind [addr, addr + len), or NULL unless the range lies entirely in
+ * pmem or in a single device.
+ */
+uint8_t* paddr_dma_ptr(paddr_t addr, uint32_t len, bool is_write);
+
+/* Call after writing through paddr_dma_ptr(), from the CPU thread. The
+ * REF of DiffTest does not see device writes, so the range written in
+ * pmem is copied to it here.
+ */
+void paddr_dma_sync(paddr_t addr, uint32_t len);
+
 #endif
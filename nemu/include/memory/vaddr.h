@@ -22,6 +22,17 @@ word_t vaddr_ifetch(vaddr_t addr, int len);
 word_t vaddr_read(vaddr_t addr, int len);
 void vaddr_write(vaddr_t addr, int len, word_t data);
 
+// `n' consecutive elements of `esz' bytes, moved as one access
+void vaddr_read_burst(vaddr_t addr, void *buf, int esz, int n);
+void vaddr_write_burst(vaddr_t addr, const void *buf, int esz, int n);
+
+/* For the debugger: translate without raising a page fault, running
+ * the hooks of guest accesses, setting the A/D bits or filling the TLB.
+ * A read fails outside pmem, so that no device sees it.
+ */
+bool vaddr_debug_translate(vaddr_t addr, paddr_t *paddr);
+word_t vaddr_debug_read(vaddr_t addr, int len, bool *success);
+
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
 #define PAGE_MASK         (PAGE_SIZE - 1)
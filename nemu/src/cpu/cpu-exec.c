@@ -16,7 +16,9 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/timing.h>
 #include <locale.h>
+#include <setjmp.h>
 
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
@@ -31,6 +33,7 @@ static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
 void device_update();
+IFDEF(CONFIG_HAS_SERIAL, void serial_flush();)
 
 #ifdef CONFIG_WATCHPOINT
 void update_wp();
@@ -73,12 +76,13 @@ static void exec_once(Decode *s, vaddr_t pc) {
   s->snpc = pc;
   isa_exec_once(s);
   cpu.pc = s->dnpc;
+  IFDEF(CONFIG_TIMING, timing_exec(s));
 #ifdef CONFIG_ITRACE
   char *p = s->logbuf;
   p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
   int ilen = s->snpc - s->pc;
   int i;
-  uint8_t *inst = (uint8_t *)&s->isa.inst.val;
+  uint8_t *inst = (uint8_t *)&MUXDEF(CONFIG_ISA_riscv32, s->isa.raw, s->isa.inst.val);
   for (i = ilen - 1; i >= 0; i --) {
     p += snprintf(p, 4, " %02x", inst[i]);
   }
@@ -91,18 +95,61 @@ static void exec_once(Decode *s, vaddr_t pc) {
 
   void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
   disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-      MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst.val, ilen);
+      MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), inst, ilen);
 #endif
 }
 
+/* Devices and interrupts are only looked at when the instruction count
+ * reaches g_next_event, so the loop pays a single compare for them.
+ * Besides a periodic poll of the host side of the devices, an event is
+ * scheduled for a timer deadline or an interrupt that may have become
+ * pending or enabled.
+ */
+#define DEVICE_POLL_INSTS 16384
+static uint64_t g_next_event = 0;
+
+void cpu_schedule_event(uint64_t at) {
+  if (at < g_next_event) g_next_event = at;
+}
+
+static void handle_event() {
+  g_next_event = g_nr_guest_inst + DEVICE_POLL_INSTS;
+  IFDEF(CONFIG_DEVICE, device_update());
+  word_t intr = isa_query_intr();
+  if (intr != INTR_EMPTY) {
+    IFDEF(CONFIG_DIFFTEST, ref_difftest_raise_intr(intr));
+    cpu.pc = isa_raise_intr(intr, cpu.pc);
+  }
+}
+
+static jmp_buf exec_jbuf;
+
+void longjmp_exception() {
+  longjmp(exec_jbuf, 1);
+}
+
+/* A breakpoint is checked at the pc an instruction leads to, which
+ * reports it before that pc runs. The pc a run starts from is not
+ * checked, so that `c' or `si' steps off the breakpoint just reported.
+ */
 static void execute(uint64_t n) {
-  Decode s;
-  for (;n > 0; n --) {
+  // static and volatile so that both survive a longjmp_exception()
+  static Decode s;
+  volatile uint64_t remain = n;
+  if (setjmp(exec_jbuf) != 0) {
+    // the faulting instruction is not retired, but still uses up a step
+    // and the REF has to take the same trap
+    IFDEF(CONFIG_DIFFTEST, difftest_step(s.pc, cpu.pc));
+    IFDEF(CONFIG_WATCHPOINT, if (unlikely(bp_filter_test(cpu.pc))) check_bp(cpu.pc));
+    if (nemu_state.state != NEMU_RUNNING || -- remain == 0) return;
+  }
+  for (; remain > 0; remain --) {
     exec_once(&s, cpu.pc);
     g_nr_guest_inst ++;
     trace_and_difftest(&s, cpu.pc);
+    IFDEF(CONFIG_WATCHPOINT, if (unlikely(bp_filter_test(cpu.pc))) check_bp(cpu.pc));
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    if (unlikely(g_nr_guest_inst >= g_next_event)) handle_event();
   }
 }
 
@@ -113,21 +160,23 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_TIMING, timing_report());
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush()); // abort() skips atexit()
   isa_reg_display();
   statistic();
 }
 
-/* Simulate how the CPU works. */
-void cpu_exec(uint64_t n) {
-  g_print_step = (n < MAX_INST_TO_PRINT);
+static void run(uint64_t n, bool print_step) {
+  g_print_step = print_step;
   switch (nemu_state.state) {
     case NEMU_END: case NEMU_ABORT:
       printf("Program execution has ended. To restart the program, exit NEMU and run again.\n");
       return;
-    default: nemu_state.state = NEMU_RUNNING;
+    // the display thread reads the state in send_key()
+    default: __atomic_store_n(&nemu_state.state, NEMU_RUNNING, __ATOMIC_RELEASE);
   }
 
   uint64_t timer_start = get_time();
@@ -138,7 +187,7 @@ void cpu_exec(uint64_t n) {
   g_timer += timer_end - timer_start;
 
   switch (nemu_state.state) {
-    case NEMU_RUNNING: nemu_state.state = NEMU_STOP; break;
+    case NEMU_RUNNING: __atomic_store_n(&nemu_state.state, NEMU_STOP, __ATOMIC_RELEASE); break;
     case NEMU_ABORT:
       nemu_state.halt_ret = 1;
     case NEMU_END:
@@ -163,4 +212,13 @@ void cpu_exec(uint64_t n) {
   }
 }
 
+/* Simulate how the CPU works. */
+void cpu_exec(uint64_t n) {
+  run(n, n < MAX_INST_TO_PRINT);
+}
+
+void cpu_exec_quiet(uint64_t n) {
+  run(n, false);
+}
+
 
@@ -0,0 +1,402 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/fpu.h>
+
+#ifdef CONFIG_FPU
+#include <fenv.h>
+#include <math.h>
+
+/* Operations run on the host FPU. The fast path is taken when the
+ * rounding mode is RNE, which the host always runs in, and inexact has
+ * already been raised, which is the usual state of a program doing
+ * floating point. If then the operands are zeros or normal numbers and
+ * the result is a normal number, no other exception can have happened
+ * and the host result is the answer.
+ *
+ * Everything else goes through the slow path, which sets the host
+ * rounding mode, reads back the host exception flags and handles what
+ * the host does differently: NaN results, RISC-V specific invalid
+ * cases and rounding to nearest with ties to max magnitude (RMM), which
+ * the host does not have. An RMM result is the RNE result moved away
+ * from zero when the exact result is a tie.
+ */
+
+static inline float to_f32(uint32_t a) { union { uint32_t u; float f; } x = { .u = a }; return x.f; }
+static inline double to_f64(uint64_t a) { union { uint64_t u; double f; } x = { .u = a }; return x.f; }
+static inline uint32_t from_f32(float a) { union { float f; uint32_t u; } x = { .f = a }; return x.u; }
+static inline uint64_t from_f64(double a) { union { double f; uint64_t u; } x = { .f = a }; return x.u; }
+
+// --- classification on bit patterns, `n' is the width ---
+#define FRAC_BITS(n) ((n) == 32 ? 23 : 52)
+#define EXP_MAX(n)   ((n) == 32 ? 0xffull : 0x7ffull)
+
+static inline uint64_t fp_exp(uint64_t a, int n) { return (a >> FRAC_BITS(n)) & EXP_MAX(n); }
+static inline uint64_t fp_frac(uint64_t a, int n) { return a & BITMASK(FRAC_BITS(n)); }
+static inline bool fp_sign(uint64_t a, int n) { return (a >> (n - 1)) & 1; }
+static inline bool fp_isnan(uint64_t a, int n) { return fp_exp(a, n) == EXP_MAX(n) && fp_frac(a, n) != 0; }
+static inline bool fp_issnan(uint64_t a, int n) { return fp_isnan(a, n) && !((a >> (FRAC_BITS(n) - 1)) & 1); }
+static inline bool fp_normal(uint64_t a, int n) { uint64_t e = fp_exp(a, n); return e != 0 && e != EXP_MAX(n); }
+static inline bool fp_zero(uint64_t a, int n) { return (a & BITMASK(n - 1)) == 0; }
+// operands the fast path takes
+static inline bool fp_zn(uint64_t a, int n) { return fp_normal(a, n) || fp_zero(a, n); }
+// the value, exactly, for comparisons
+static inline double fp_val(uint64_t a, int n) { return n == 32 ? to_f32(a) : to_f64(a); }
+
+#define FAST(rm, flags) ((rm) == FRM_RNE && (*(flags) & FFLAG_NX))
+
+// --- the slow path ---
+static const int host_rm[] = {
+  [FRM_RNE] = FE_TONEAREST, [FRM_RTZ] = FE_TOWARDZERO,
+  [FRM_RDN] = FE_DOWNWARD, [FRM_RUP] = FE_UPWARD,
+  [FRM_RMM] = FE_TONEAREST, // then fixed up on ties
+};
+
+static inline void slow_begin(int rm) {
+  if (host_rm[rm] != FE_TONEAREST) fesetround(host_rm[rm]);
+  feclearexcept(FE_ALL_EXCEPT);
+}
+
+static inline void slow_end(int rm, uint32_t *flags) {
+  int e = fetestexcept(FE_ALL_EXCEPT);
+  *flags |= (e & FE_INEXACT   ? FFLAG_NX : 0) | (e & FE_UNDERFLOW ? FFLAG_UF : 0) |
+            (e & FE_OVERFLOW  ? FFLAG_OF : 0) | (e & FE_DIVBYZERO ? FFLAG_DZ : 0) |
+            (e & FE_INVALID   ? FFLAG_NV : 0);
+  if (host_rm[rm] != FE_TONEAREST) fesetround(FE_TONEAREST);
+}
+
+/* `e' is the exact result minus the RNE result `r'. It is a tie when
+ * e points away from zero and is half the distance to the next value.
+ */
+static float rmm_fix32(float r, double e, uint32_t *flags) {
+  if (e == 0 || isnan(r) || isinf(r) || signbit(e) != signbit(r)) return r;
+  float next = nextafterf(r, copysignf(INFINITY, r));
+  if (fabs(e) != ((double)next - r) / 2) return r;
+  if (isinf(next)) *flags |= FFLAG_OF | FFLAG_NX;
+  return next;
+}
+
+static double rmm_fix64(double r, double e, uint32_t *flags) {
+  if (e == 0 || isnan(r) || isinf(r) || signbit(e) != signbit(r)) return r;
+  double next = nextafter(r, copysign(INFINITY, r));
+  if (fabs(e) != (next - r) / 2) return r;
+  if (isinf(next)) *flags |= FFLAG_OF | FFLAG_NX;
+  return next;
+}
+
+/* The error of a double precision result is not always a double, e.g.
+ * for a subnormal product or an fma, so ties of these are found on
+ * exact values instead: +-m * 2^e with an odd m, or m = 0. A tie is the
+ * midpoint of r and the next value away from zero, whose m has at most
+ * 54 bits, so a sum that would be wider than 126 bits is never one.
+ */
+typedef struct { unsigned __int128 m; int e; bool neg; } Exact;
+
+static inline int ctz128(unsigned __int128 m) {
+  uint64_t lo = m;
+  return lo ? __builtin_ctzll(lo) : 64 + __builtin_ctzll((uint64_t)(m >> 64));
+}
+
+static inline int bits128(unsigned __int128 m) {
+  uint64_t hi = m >> 64, lo = m;
+  return hi ? 128 - __builtin_clzll(hi) : lo ? 64 - __builtin_clzll(lo) : 0;
+}
+
+static Exact exact_norm(Exact v) {
+  if (v.m != 0) { int tz = ctz128(v.m); v.m >>= tz; v.e += tz; }
+  return v;
+}
+
+// `x' is finite
+static Exact exact_f64(double x) {
+  int e;
+  double f = frexp(x, &e);
+  return exact_norm((Exact){ .m = (uint64_t)ldexp(fabs(f), 53), .e = e - 53, .neg = signbit(x) });
+}
+
+// both have at most 55 bits
+static Exact exact_mul(Exact a, Exact b) {
+  return (Exact){ .m = a.m * b.m, .e = a.e + b.e, .neg = a.neg != b.neg };
+}
+
+// both have at most 110 bits; false if the sum is too wide to be a tie
+static bool exact_add(Exact a, Exact b, Exact *v) {
+  if (a.m == 0 || b.m == 0) { *v = (a.m == 0 ? b : a); return true; }
+  if (a.e < b.e) { Exact t = a; a = b; b = t; }
+  int d = a.e - b.e;
+  // then d > 0, and the sum is odd and at least 2^125
+  if (bits128(a.m) + d > 126) return false;
+  a.m <<= d;
+  if (a.neg == b.neg) *v = (Exact){ .m = a.m + b.m, .neg = a.neg };
+  else if (a.m >= b.m) *v = (Exact){ .m = a.m - b.m, .neg = a.neg };
+  else *v = (Exact){ .m = b.m - a.m, .neg = b.neg };
+  v->e = b.e;
+  *v = exact_norm(*v);
+  return true;
+}
+
+static bool exact_eq(Exact a, Exact b) {
+  return a.m == b.m && (a.m == 0 || (a.e == b.e && a.neg == b.neg));
+}
+
+// the midpoint between `r' and the next value away from zero
+static bool rmm_mid64(double r, Exact *mid) {
+  if (isnan(r) || isinf(r)) return false;
+  double next = nextafter(r, copysign(INFINITY, r));
+  // past the largest double, the gap is the one below it
+  double gap = (isinf(next) ? r - nextafter(r, 0) : next - r);
+  Exact half = { .m = 1, .e = ilogb(gap) - 1, .neg = signbit(r) };
+  exact_add(exact_f64(r), half, mid);
+  return true;
+}
+
+static double rmm_away64(double r, uint32_t *flags) {
+  double next = nextafter(r, copysign(INFINITY, r));
+  if (isinf(next)) *flags |= FFLAG_OF | FFLAG_NX;
+  return next;
+}
+
+static inline uint32_t canon32(float r) { return isnan(r) ? F32_NAN : from_f32(r); }
+static inline uint64_t canon64(double r) { return isnan(r) ? F64_NAN : from_f64(r); }
+
+/* The error of a single precision RNE result, computed in double
+ * precision, which is exact for sums and products, and can not land on
+ * a tie unless the exact result is one for quotients.
+ */
+#define ERR32_add(x, y, r) ((double)(x) + (double)(y) - (r))
+#define ERR32_sub(x, y, r) ((double)(x) - (double)(y) - (r))
+#define ERR32_mul(x, y, r) ((double)(x) * (double)(y) - (r))
+#define ERR32_div(x, y, r) ((double)(x) / (double)(y) - (r))
+/* The product of two single precision values is exact, so the result
+ * of a single precision fma can only be a tie if the sum with the addend
+ * is exact as well (TwoSum). Otherwise 0 is returned, as RNE and RMM agree.
+ */
+#define ERR32_fma(x, y, z, r) ({ double __p = (double)(x) * (double)(y), __s = __p + (z); \
+    double __b = __s - __p; (__p - (__s - __b)) + ((z) - __b) == 0 ? __s - (r) : 0; })
+
+// whether the exact double precision result is the midpoint `mid'
+#define TIE64_add(x, y, mid) ({ Exact __v; exact_add(exact_f64(x), exact_f64(y), &__v) && exact_eq(__v, mid); })
+#define TIE64_sub(x, y, mid) TIE64_add(x, -(y), mid)
+#define TIE64_mul(x, y, mid) exact_eq(exact_mul(exact_f64(x), exact_f64(y)), mid)
+// x / inf is an exact zero
+#define TIE64_div(x, y, mid) (!isinf(y) && exact_eq(exact_f64(x), exact_mul(mid, exact_f64(y))))
+#define TIE64_fma(x, y, z, mid) ({ Exact __v; \
+    exact_add(exact_mul(exact_f64(x), exact_f64(y)), exact_f64(z), &__v) && exact_eq(__v, mid); })
+
+#define RMM32(name, r, flags, ...) rmm_fix32(r, ERR32_##name(__VA_ARGS__, r), flags)
+#define RMM64(name, r, flags, ...) ({ Exact __mid; \
+    rmm_mid64(r, &__mid) && TIE64_##name(__VA_ARGS__, __mid) ? rmm_away64(r, flags) : (r); })
+
+#define F32_TYPE float
+#define F64_TYPE double
+#define U32_TYPE uint32_t
+#define U64_TYPE uint64_t
+
+#define DEF_BINOP(n, name, op) \
+concat(U, n##_TYPE) f##n##_##name(concat(U, n##_TYPE) a, concat(U, n##_TYPE) b, int rm, uint32_t *flags) { \
+  if (likely(FAST(rm, flags) && fp_zn(a, n) && fp_zn(b, n))) { \
+    concat(U, n##_TYPE) r = from_f##n(to_f##n(a) op to_f##n(b)); \
+    if (likely(fp_normal(r, n))) return r; \
+  } \
+  volatile concat(F, n##_TYPE) x = to_f##n(a), y = to_f##n(b); \
+  slow_begin(rm); \
+  volatile concat(F, n##_TYPE) r = x op y; \
+  slow_end(rm, flags); \
+  if (unlikely(rm == FRM_RMM)) r = RMM##n(name, r, flags, x, y); \
+  return canon##n(r); \
+}
+
+DEF_BINOP(32, add, +)
+DEF_BINOP(32, sub, -)
+DEF_BINOP(32, mul, *)
+DEF_BINOP(32, div, /)
+DEF_BINOP(64, add, +)
+DEF_BINOP(64, sub, -)
+DEF_BINOP(64, mul, *)
+DEF_BINOP(64, div, /)
+
+// the square root of a non-tie is never a tie, so RMM needs no fixing
+uint32_t f32_sqrt(uint32_t a, int rm, uint32_t *flags) {
+  if (likely(FAST(rm, flags) && fp_normal(a, 32) && !fp_sign(a, 32))) return from_f32(sqrtf(to_f32(a)));
+  volatile float x = to_f32(a);
+  slow_begin(rm);
+  volatile float r = sqrtf(x);
+  slow_end(rm, flags);
+  return canon32(r);
+}
+
+uint64_t f64_sqrt(uint64_t a, int rm, uint32_t *flags) {
+  if (likely(FAST(rm, flags) && fp_normal(a, 64) && !fp_sign(a, 64))) return from_f64(sqrt(to_f64(a)));
+  volatile double x = to_f64(a);
+  slow_begin(rm);
+  volatile double r = sqrt(x);
+  slow_end(rm, flags);
+  return canon64(r);
+}
+
+// RISC-V raises NV for inf * 0 even if the addend is a quiet NaN
+uint32_t f32_fma(uint32_t a, uint32_t b, uint32_t c, int rm, uint32_t *flags) {
+  if (likely(FAST(rm, flags) && fp_zn(a, 32) && fp_zn(b, 32) && fp_zn(c, 32))) {
+    uint32_t r = from_f32(fmaf(to_f32(a), to_f32(b), to_f32(c)));
+    if (likely(fp_normal(r, 32))) return r;
+  }
+  volatile float x = to_f32(a), y = to_f32(b), z = to_f32(c);
+  if ((isinf(x) && y == 0) || (x == 0 && isinf(y))) { *flags |= FFLAG_NV; return F32_NAN; }
+  slow_begin(rm);
+  volatile float r = fmaf(x, y, z);
+  slow_end(rm, flags);
+  if (unlikely(rm == FRM_RMM)) r = RMM32(fma, r, flags, x, y, z);
+  return canon32(r);
+}
+
+uint64_t f64_fma(uint64_t a, uint64_t b, uint64_t c, int rm, uint32_t *flags) {
+  if (likely(FAST(rm, flags) && fp_zn(a, 64) && fp_zn(b, 64) && fp_zn(c, 64))) {
+    uint64_t r = from_f64(fma(to_f64(a), to_f64(b), to_f64(c)));
+    if (likely(fp_normal(r, 64))) return r;
+  }
+  volatile double x = to_f64(a), y = to_f64(b), z = to_f64(c);
+  if ((isinf(x) && y == 0) || (x == 0 && isinf(y))) { *flags |= FFLAG_NV; return F64_NAN; }
+  slow_begin(rm);
+  volatile double r = fma(x, y, z);
+  slow_end(rm, flags);
+  if (unlikely(rm == FRM_RMM)) r = RMM64(fma, r, flags, x, y, z);
+  return canon64(r);
+}
+
+// --- operations without rounding ---
+/* A NaN operand is ignored unless both are, and -0 is less than +0,
+ * which is where the two zeros differ only in the sign bit.
+ */
+static uint64_t fp_minmax(uint64_t a, uint64_t b, int n, bool is_max, uint32_t *flags) {
+  if (fp_issnan(a, n) || fp_issnan(b, n)) *flags |= FFLAG_NV;
+  if (fp_isnan(a, n)) return fp_isnan(b, n) ? (n == 32 ? F32_NAN : F64_NAN) : b;
+  if (fp_isnan(b, n)) return a;
+  double x = fp_val(a, n), y = fp_val(b, n);
+  if (x == y) return is_max ? a & b : a | b;
+  return (x < y) ^ is_max ? a : b;
+}
+
+// feq is a quiet comparison, flt and fle are signaling ones
+static bool fp_cmp(uint64_t a, uint64_t b, int n, int op, uint32_t *flags) {
+  if (fp_isnan(a, n) || fp_isnan(b, n)) {
+    if (op != 0 || fp_issnan(a, n) || fp_issnan(b, n)) *flags |= FFLAG_NV;
+    return false;
+  }
+  double x = fp_val(a, n), y = fp_val(b, n);
+  switch (op) {
+    case 0: return x == y;
+    case 1: return x < y;
+    default: return x <= y;
+  }
+}
+
+static uint32_t fp_class(uint64_t a, int n) {
+  bool neg = fp_sign(a, n);
+  if (fp_isnan(a, n)) return fp_issnan(a, n) ? 1 << 8 : 1 << 9;
+  if (fp_exp(a, n) == EXP_MAX(n)) return neg ? 1 << 0 : 1 << 7;
+  if (fp_zero(a, n)) return neg ? 1 << 3 : 1 << 4;
+  if (fp_exp(a, n) == 0) return neg ? 1 << 2 : 1 << 5;
+  return neg ? 1 << 1 : 1 << 6;
+}
+
+uint32_t f32_min(uint32_t a, uint32_t b, uint32_t *flags) { return fp_minmax(a, b, 32, false, flags); }
+uint32_t f32_max(uint32_t a, uint32_t b, uint32_t *flags) { return fp_minmax(a, b, 32, true, flags); }
+bool f32_eq(uint32_t a, uint32_t b, uint32_t *flags) { return fp_cmp(a, b, 32, 0, flags); }
+bool f32_lt(uint32_t a, uint32_t b, uint32_t *flags) { return fp_cmp(a, b, 32, 1, flags); }
+bool f32_le(uint32_t a, uint32_t b, uint32_t *flags) { return fp_cmp(a, b, 32, 2, flags); }
+uint32_t f32_class(uint32_t a) { return fp_class(a, 32); }
+uint64_t f64_min(uint64_t a, uint64_t b, uint32_t *flags) { return fp_minmax(a, b, 64, false, flags); }
+uint64_t f64_max(uint64_t a, uint64_t b, uint32_t *flags) { return fp_minmax(a, b, 64, true, flags); }
+bool f64_eq(uint64_t a, uint64_t b, uint32_t *flags) { return fp_cmp(a, b, 64, 0, flags); }
+bool f64_lt(uint64_t a, uint64_t b, uint32_t *flags) { return fp_cmp(a, b, 64, 1, flags); }
+bool f64_le(uint64_t a, uint64_t b, uint32_t *flags) { return fp_cmp(a, b, 64, 2, flags); }
+uint32_t f64_class(uint64_t a) { return fp_class(a, 64); }
+
+// --- conversions between formats ---
+uint64_t f32_to_f64(uint32_t a, uint32_t *flags) {
+  if (unlikely(fp_isnan(a, 32))) {
+    if (fp_issnan(a, 32)) *flags |= FFLAG_NV;
+    return F64_NAN;
+  }
+  return from_f64(to_f32(a));
+}
+
+uint32_t f64_to_f32(uint64_t a, int rm, uint32_t *flags) {
+  if (likely(FAST(rm, flags) && fp_zn(a, 64))) {
+    uint32_t r = from_f32(to_f64(a));
+    if (likely(fp_normal(r, 32))) return r;
+  }
+  volatile double x = to_f64(a);
+  slow_begin(rm);
+  volatile float r = x;
+  slow_end(rm, flags);
+  if (unlikely(rm == FRM_RMM)) r = rmm_fix32(r, x - r, flags);
+  return canon32(r);
+}
+
+// --- conversions to integers ---
+static double round_integral(double x, int rm) {
+  switch (rm) {
+    case FRM_RTZ: return trunc(x);
+    case FRM_RDN: return floor(x);
+    case FRM_RUP: return ceil(x);
+    case FRM_RMM: return round(x);
+    default: return nearbyint(x); // the host rounds to nearest even
+  }
+}
+
+/* NaNs convert to the largest integer, and out of range values to the
+ * nearest representable one, both raising NV. The bounds are exact in
+ * double precision, and so is every single precision value.
+ */
+#define DEF_TO_INT(n, name, type, lo, hi, max) \
+type concat3(f, n, _to_##name)(concat(U, n##_TYPE) a, int rm, uint32_t *flags) { \
+  if (fp_isnan(a, n)) { *flags |= FFLAG_NV; return max; } \
+  double x = fp_val(a, n), v = round_integral(x, rm); \
+  if (v < (lo)) { *flags |= FFLAG_NV; return (type)(lo); } \
+  if (v >= (hi)) { *flags |= FFLAG_NV; return max; } \
+  if (v != x) *flags |= FFLAG_NX; \
+  return (type)v; \
+}
+
+DEF_TO_INT(32, i32, int32_t,  -0x1p31, 0x1p31, INT32_MAX)
+DEF_TO_INT(32, u32, uint32_t, 0,       0x1p32, UINT32_MAX)
+DEF_TO_INT(32, i64, int64_t,  -0x1p63, 0x1p63, INT64_MAX)
+DEF_TO_INT(32, u64, uint64_t, 0,       0x1p64, UINT64_MAX)
+DEF_TO_INT(64, i32, int32_t,  -0x1p31, 0x1p31, INT32_MAX)
+DEF_TO_INT(64, u32, uint32_t, 0,       0x1p32, UINT32_MAX)
+DEF_TO_INT(64, i64, int64_t,  -0x1p63, 0x1p63, INT64_MAX)
+DEF_TO_INT(64, u64, uint64_t, 0,       0x1p64, UINT64_MAX)
+
+// --- conversions from integers ---
+/* Integers below 2^24 (2^53) are exact in single (double) precision.
+ * For RMM, the error is an integer much smaller than 2^53.
+ */
+#define DEF_FROM_INT(n, name, type, exact) \
+concat(U, n##_TYPE) concat(name, _to_f##n)(type a, int rm, uint32_t *flags) { \
+  if (likely(exact)) return from_f##n(a); \
+  volatile type x = a; \
+  slow_begin(rm); \
+  volatile concat(F, n##_TYPE) r = x; \
+  slow_end(rm, flags); \
+  if (unlikely(rm == FRM_RMM)) r = rmm_fix##n(r, (double)((__int128)x - (__int128)r), flags); \
+  return from_f##n(r); \
+}
+
+DEF_FROM_INT(32, i64, int64_t,  a > -(1ll << 24) && a < (1ll << 24))
+DEF_FROM_INT(32, u64, uint64_t, a < (1ull << 24))
+DEF_FROM_INT(64, i64, int64_t,  a > -(1ll << 53) && a < (1ll << 53))
+DEF_FROM_INT(64, u64, uint64_t, a < (1ull << 53))
+#endif
@@ -0,0 +1,181 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <cpu/perf.h>
+#include <device/map.h>
+#include <time.h>
+
+#ifdef CONFIG_PERF
+
+#define NR_TRAP 64
+#define NR_PERF_MAP 32
+
+uint64_t perf_inst_cnt[PERF_NR_INST] = {};
+uint64_t perf_load[9] = {}, perf_store[9] = {};
+uint64_t perf_branch[2] = {};
+uint64_t perf_device_update_time = 0;
+
+static const char *perf_inst_name[PERF_NR_INST] = {};
+static int nr_perf_inst = 0;
+
+// indexed by the exception or interrupt code, the last slot takes the larger ones
+static uint64_t perf_exception[NR_TRAP] = {}, perf_interrupt[NR_TRAP] = {};
+
+static struct {
+  IOMap *map;
+  bool is_pio;
+} perf_maps[NR_PERF_MAP] = {};
+static int nr_perf_map = 0;
+
+extern uint64_t g_nr_guest_inst;
+
+int perf_inst_id(const char *name) {
+  int i;
+  for (i = 0; i < nr_perf_inst; i ++) {
+    if (strcmp(perf_inst_name[i], name) == 0) {
+      return i;
+    }
+  }
+  assert(nr_perf_inst < PERF_NR_INST);
+  perf_inst_name[nr_perf_inst] = name;
+  return nr_perf_inst ++;
+}
+
+void perf_trap(word_t cause) {
+  bool is_intr = cause >> (sizeof(word_t) * 8 - 1);
+  word_t code = cause & ~((word_t)1 << (sizeof(word_t) * 8 - 1));
+  if (code >= NR_TRAP) code = NR_TRAP - 1;
+  if (is_intr) perf_interrupt[code] ++;
+  else perf_exception[code] ++;
+}
+
+void perf_add_map(IOMap *map, bool is_pio) {
+  assert(nr_perf_map < NR_PERF_MAP);
+  perf_maps[nr_perf_map].map = map;
+  perf_maps[nr_perf_map].is_pio = is_pio;
+  nr_perf_map ++;
+}
+
+uint64_t perf_time_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static int cmp_inst(const void *a, const void *b) {
+  uint64_t x = perf_inst_cnt[*(const int *)a], y = perf_inst_cnt[*(const int *)b];
+  return (x < y) - (x > y);
+}
+
+// instruction slots sorted by their counts in descending order
+static int sorted_inst(int *idx) {
+  int i;
+  for (i = 0; i < nr_perf_inst; i ++) {
+    idx[i] = i;
+  }
+  qsort(idx, nr_perf_inst, sizeof(idx[0]), cmp_inst);
+  return nr_perf_inst;
+}
+
+void perf_display() {
+  int idx[PERF_NR_INST];
+  int n = sorted_inst(idx);
+  int i;
+  printf("Instruction mix (%" PRIu64 " instructions)\n", g_nr_guest_inst);
+  printf("----------------------------------------------------------------\n");
+  for (i = 0; i < n && perf_inst_cnt[idx[i]] != 0; i ++) {
+    uint64_t cnt = perf_inst_cnt[idx[i]];
+    printf("%-10s%-20" PRIu64 "%6.2f%%\n", perf_inst_name[idx[i]], cnt,
+        g_nr_guest_inst ? 100.0 * cnt / g_nr_guest_inst : 0.0);
+  }
+  printf("----------------------------------------------------------------\n");
+  printf("%-10s%-14s%-14s%-14s%-14s\n", "Memory", "1 byte", "2 bytes", "4 bytes", "8 bytes");
+  printf("%-10s%-14" PRIu64 "%-14" PRIu64 "%-14" PRIu64 "%-14" PRIu64 "\n", "load",
+      perf_load[1], perf_load[2], perf_load[4], perf_load[8]);
+  printf("%-10s%-14" PRIu64 "%-14" PRIu64 "%-14" PRIu64 "%-14" PRIu64 "\n", "store",
+      perf_store[1], perf_store[2], perf_store[4], perf_store[8]);
+  printf("----------------------------------------------------------------\n");
+  printf("Branch    taken = %" PRIu64 ", not taken = %" PRIu64 "\n", perf_branch[1], perf_branch[0]);
+  printf("----------------------------------------------------------------\n");
+  for (i = 0; i < NR_TRAP; i ++) {
+    if (perf_exception[i] != 0) printf("Exception %-4d%" PRIu64 "\n", i, perf_exception[i]);
+  }
+  for (i = 0; i < NR_TRAP; i ++) {
+    if (perf_interrupt[i] != 0) printf("Interrupt %-4d%" PRIu64 "\n", i, perf_interrupt[i]);
+  }
+  printf("----------------------------------------------------------------\n");
+  printf("%-14s%-14s%-14s%-20s\n", "Device", "reads", "writes", "callback time (us)");
+  for (i = 0; i < nr_perf_map; i ++) {
+    IOMap *map = perf_maps[i].map;
+    printf("%-14s%-14" PRIu64 "%-14" PRIu64 "%-20" PRIu64 "\n", map->name,
+        map->nr_read, map->nr_write, map->callback_time / 1000);
+  }
+  printf("%-42s%-20" PRIu64 "\n", "device_update()", perf_device_update_time / 1000);
+  printf("----------------------------------------------------------------\n");
+}
+
+void perf_dump() {
+  const char *path = CONFIG_PERF_JSON;
+  if (path[0] == '\0') {
+    return;
+  }
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    Log("Can not open '%s' to dump performance counters", path);
+    return;
+  }
+  int idx[PERF_NR_INST];
+  int n = sorted_inst(idx);
+  int i;
+  fprintf(fp, "{\n  \"instructions\": %" PRIu64 ",\n", g_nr_guest_inst);
+  fprintf(fp, "  \"mix\": {");
+  for (i = 0; i < n; i ++) {
+    fprintf(fp, "%s\n    \"%s\": %" PRIu64, i ? "," : "", perf_inst_name[idx[i]], perf_inst_cnt[idx[i]]);
+  }
+  fprintf(fp, "\n  },\n");
+  fprintf(fp, "  \"load\": {\"1\": %" PRIu64 ", \"2\": %" PRIu64 ", \"4\": %" PRIu64 ", \"8\": %" PRIu64 "},\n",
+      perf_load[1], perf_load[2], perf_load[4], perf_load[8]);
+  fprintf(fp, "  \"store\": {\"1\": %" PRIu64 ", \"2\": %" PRIu64 ", \"4\": %" PRIu64 ", \"8\": %" PRIu64 "},\n",
+      perf_store[1], perf_store[2], perf_store[4], perf_store[8]);
+  fprintf(fp, "  \"branch\": {\"taken\": %" PRIu64 ", \"not_taken\": %" PRIu64 "},\n",
+      perf_branch[1], perf_branch[0]);
+  bool first = true;
+  fprintf(fp, "  \"exception\": {");
+  for (i = 0; i < NR_TRAP; i ++) {
+    if (perf_exception[i] == 0) continue;
+    fprintf(fp, "%s\"%d\": %" PRIu64, first ? "" : ", ", i, perf_exception[i]);
+    first = false;
+  }
+  first = true;
+  fprintf(fp, "},\n  \"interrupt\": {");
+  for (i = 0; i < NR_TRAP; i ++) {
+    if (perf_interrupt[i] == 0) continue;
+    fprintf(fp, "%s\"%d\": %" PRIu64, first ? "" : ", ", i, perf_interrupt[i]);
+    first = false;
+  }
+  fprintf(fp, "},\n  \"device\": {");
+  for (i = 0; i < nr_perf_map; i ++) {
+    IOMap *map = perf_maps[i].map;
+    fprintf(fp, "%s\n    \"%s%s\": {\"read\": %" PRIu64 ", \"write\": %" PRIu64 ", \"callback_ns\": %" PRIu64 "}",
+        i ? "," : "", perf_maps[i].is_pio ? "pio:" : "", map->name,
+        map->nr_read, map->nr_write, map->callback_time);
+  }
+  fprintf(fp, "\n  },\n  \"device_update_ns\": %" PRIu64 "\n}\n", perf_device_update_time);
+  fclose(fp);
+  Log("Performance counters are dumped to %s", path);
+}
+
+#endif
@@ -0,0 +1,64 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/timing.h>
+
+#ifdef CONFIG_TIMING
+
+void cache_init(Cache *c, const char *name, int size, int nr_way, int line_size) {
+  Assert((line_size & (line_size - 1)) == 0, "cache line size %d of %s is not a power of 2", line_size, name);
+  c->name = name;
+  c->nr_way = nr_way;
+  c->nr_set = size / line_size / nr_way;
+  Assert(c->nr_set > 0 && (c->nr_set & (c->nr_set - 1)) == 0,
+      "number of sets %d of %s is not a power of 2", c->nr_set, name);
+  c->line_shift = __builtin_ctz(line_size);
+  c->tag = calloc(c->nr_set * nr_way, sizeof(c->tag[0]));
+  c->stamp = calloc(c->nr_set * nr_way, sizeof(c->stamp[0]));
+  assert(c->tag && c->stamp);
+  c->clock = 0;
+  c->hit = c->miss = 0;
+}
+
+bool cache_access(Cache *c, paddr_t addr) {
+  uint64_t line = (uint64_t)addr >> c->line_shift;
+  int set = line & (c->nr_set - 1);
+  uint64_t tag = line + 1; // keep 0 for invalid lines
+  uint64_t *tags = c->tag + set * c->nr_way;
+  uint64_t *stamps = c->stamp + set * c->nr_way;
+  int i, victim = 0;
+  c->clock ++;
+  for (i = 0; i < c->nr_way; i ++) {
+    if (tags[i] == tag) {
+      stamps[i] = c->clock;
+      c->hit ++;
+      return true;
+    }
+    if (stamps[i] < stamps[victim]) victim = i;
+  }
+  tags[victim] = tag;
+  stamps[victim] = c->clock;
+  c->miss ++;
+  return false;
+}
+
+void cache_report(Cache *c) {
+  uint64_t total = c->hit + c->miss;
+  Log("%s: %d sets x %d ways x %d bytes, hit = %" PRIu64 ", miss = %" PRIu64 ", hit rate = %.2f%%",
+      c->name, c->nr_set, c->nr_way, 1 << c->line_shift, c->hit, c->miss,
+      total ? 100.0 * c->hit / total : 0.0);
+}
+
+#endif
@@ -0,0 +1,119 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/decode.h>
+#include <cpu/timing.h>
+#include <memory/paddr.h>
+
+#ifdef CONFIG_TIMING
+
+uint64_t g_nr_guest_cycle = 0;
+extern uint64_t g_nr_guest_inst;
+
+static Cache icache, dcache;
+
+static const int class_lat[NR_INST_CLASS] = {
+  [INST_MUL] = CONFIG_TIMING_LAT_MUL,
+  [INST_DIV] = CONFIG_TIMING_LAT_DIV,
+};
+
+// --- branch predictor ---
+static uint8_t bht[CONFIG_TIMING_BHT_SIZE] = {}; // 2-bit saturating counters
+static struct {
+  vaddr_t pc, target;
+} btb[CONFIG_TIMING_BTB_SIZE] = {};
+static uint64_t nr_predict = 0, nr_mispredict = 0;
+
+#define PRED_IDX(pc, size) (((pc) >> 1) % (size))
+
+static bool predict_branch(vaddr_t pc, bool taken) {
+  uint8_t *ctr = &bht[PRED_IDX(pc, CONFIG_TIMING_BHT_SIZE)];
+  bool pred = (*ctr >= 2);
+  if (taken && *ctr < 3) (*ctr) ++;
+  if (!taken && *ctr > 0) (*ctr) --;
+  return pred == taken;
+}
+
+static bool predict_target(vaddr_t pc, vaddr_t target) {
+  int idx = PRED_IDX(pc, CONFIG_TIMING_BTB_SIZE);
+  bool hit = (btb[idx].pc == pc && btb[idx].target == target);
+  btb[idx].pc = pc;
+  btb[idx].target = target;
+  return hit;
+}
+
+void init_timing() {
+  cache_init(&icache, "icache", CONFIG_TIMING_ICACHE_SIZE * 1024,
+      CONFIG_TIMING_ICACHE_WAYS, CONFIG_TIMING_CACHE_LINE);
+  cache_init(&dcache, "dcache", CONFIG_TIMING_DCACHE_SIZE * 1024,
+      CONFIG_TIMING_DCACHE_WAYS, CONFIG_TIMING_CACHE_LINE);
+  memset(bht, 1, sizeof(bht)); // weakly not taken
+}
+
+/* Called after every instruction. Each one takes one cycle plus the
+ * latency of its class, a possible instruction fetch miss and a possible
+ * misprediction. Data accesses are charged by timing_mem().
+ */
+void timing_exec(Decode *s) {
+  int cls = isa_inst_class(s);
+  uint64_t cycle = 1 + class_lat[cls];
+  if (!cache_access(&icache, s->pc)) {
+    cycle += CONFIG_TIMING_MISS_PENALTY;
+  }
+  bool correct = true;
+  switch (cls) {
+    case INST_BRANCH: correct = predict_branch(s->pc, s->dnpc != s->snpc); break;
+    case INST_IJUMP:  correct = predict_target(s->pc, s->dnpc); break;
+    default: break;
+  }
+  if (cls == INST_BRANCH || cls == INST_IJUMP) {
+    nr_predict ++;
+    if (!correct) {
+      nr_mispredict ++;
+      cycle += CONFIG_TIMING_MISPREDICT_PENALTY;
+    }
+  }
+  g_nr_guest_cycle += cycle;
+}
+
+void timing_mem(paddr_t addr, int len, bool is_write) {
+  // accesses from the debugger do not take guest time
+  if (nemu_state.state != NEMU_RUNNING) {
+    return;
+  }
+  if (!in_pmem(addr)) {
+    g_nr_guest_cycle += CONFIG_TIMING_LAT_MMIO;
+    return;
+  }
+  // a misaligned access may touch the next line as well
+  paddr_t line = addr / CONFIG_TIMING_CACHE_LINE, last = (addr + len - 1) / CONFIG_TIMING_CACHE_LINE;
+  for (; line <= last; line ++) {
+    if (!cache_access(&dcache, line * CONFIG_TIMING_CACHE_LINE)) {
+      g_nr_guest_cycle += CONFIG_TIMING_MISS_PENALTY;
+    }
+  }
+}
+
+void timing_report() {
+  Log("estimated guest cycles = %" PRIu64, g_nr_guest_cycle);
+  if (g_nr_guest_inst > 0) Log("estimated CPI = %.3f", (double)g_nr_guest_cycle / g_nr_guest_inst);
+  cache_report(&icache);
+  cache_report(&dcache);
+  Log("branch predictor: %" PRIu64 " predictions, %" PRIu64 " mispredictions, accuracy = %.2f%%",
+      nr_predict, nr_mispredict, nr_predict ? 100.0 * (nr_predict - nr_mispredict) / nr_predict : 0.0);
+}
+
+#endif
@@ -37,10 +37,10 @@ void dtrace_display() {
   printf("%sDevice trace:%s\n", ANSI_FG_YELLOW, ANSI_NONE);
   while (p != NULL) {
     if (p->type == DREAD) {
-      printf("Read from %s when pc = %#08x.\n", p->name, p->pc);
+      printf("Read from %s when pc = " FMT_WORD ".\n", p->name, p->pc);
     }
     if (p->type == DWRITE) {
-      printf("Write to %s when pc = %#08x.\n", p->name, p->pc);
+      printf("Write to %s when pc = " FMT_WORD ".\n", p->name, p->pc);
     }
     p = p->next;
   }
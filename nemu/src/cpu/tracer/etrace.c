@@ -28,7 +28,7 @@ void etrace_display() {
   ETrace *p = head;
   printf("%sException trace:%s\n", ANSI_FG_YELLOW, ANSI_NONE);
   while (p != NULL) {
-    printf("Trigger exception of code %#08x when pc = %#08x.\n", p->code, p->pc);
+    printf("Trigger exception of code " FMT_WORD " when pc = " FMT_WORD ".\n", p->code, p->pc);
     p = p->next;
   }
 }
@@ -47,7 +47,7 @@ void ftrace_display() {
   printf("%sCall Stack: %d%s\n", ANSI_FG_YELLOW, top, ANSI_NONE);
   printf("------------------------------------\n");
   for (i = 0; i < top && i < CALL_STACK_MAXLEN; i++) {
-    printf("[%d] Call function %s(%#08x) at pc = %#08x\n", i, func_stack[i].symbol, func_stack[i].value, func_stack[i].pc);
+    printf("[%d] Call function %s(" FMT_WORD ") at pc = " FMT_WORD "\n", i, func_stack[i].symbol, func_stack[i].value, func_stack[i].pc);
   }
   printf("------------------------------------\n");
 }
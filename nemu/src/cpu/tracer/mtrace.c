@@ -36,10 +36,10 @@ void mtrace_display() {
   printf("%sMemory trace:%s\n", ANSI_FG_YELLOW, ANSI_NONE);
   while (p != NULL) {
     if (p->type == PREAD) {
-      printf("Read from physical address %#08x when pc = %#08x.\n", p->paddr, p->pc);
+      printf("Read from physical address " FMT_PADDR " when pc = " FMT_WORD ".\n", p->paddr, p->pc);
     }
     if (p->type == PWRITE) {
-      printf("Write to physical address %#08x when pc = %#08x.\n", p->paddr, p->pc);
+      printf("Write to physical address " FMT_PADDR " when pc = " FMT_WORD ".\n", p->paddr, p->pc);
     }
     p = p->next;
   }
@@ -0,0 +1,257 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/vector.h>
+
+#ifdef CONFIG_RVV
+#include <memory/vaddr.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HOST_X86
+#endif
+
+/* A kernel computes d = a op b for the `n' bytes at each pointer, `n'
+ * being a multiple of the element size. `d' may be `a' or `b', as the
+ * operands of a block are loaded before its result is stored.
+ */
+typedef void (*VKernel)(uint8_t *d, const uint8_t *a, const uint8_t *b, size_t n);
+
+// the elements left over by the SIMD loops
+#define TAIL(T, expr) for (; i < n; i += sizeof(T)) { \
+  T x, y, z; \
+  memcpy(&x, a + i, sizeof(T)); memcpy(&y, b + i, sizeof(T)); \
+  z = (expr); \
+  memcpy(d + i, &z, sizeof(T)); \
+}
+
+#ifdef HOST_X86
+#define LD128(p) _mm_loadu_si128((const __m128i *)(p))
+#define ST128(p, x) _mm_storeu_si128((__m128i *)(p), x)
+#define LD256(p) _mm256_loadu_si256((const __m256i *)(p))
+#define ST256(p, x) _mm256_storeu_si256((__m256i *)(p), x)
+
+/* SSE2 is always there on x86-64 and gives the baseline kernels. The
+ * AVX2 ones are compiled for that target alone and picked at runtime
+ * by init_vector(), so the binary still runs on older hosts.
+ */
+#define DEF_KERNEL(name, T, expr, op128, op256) \
+  static void name(uint8_t *d, const uint8_t *a, const uint8_t *b, size_t n) { \
+    size_t i = 0; \
+    for (; i + 16 <= n; i += 16) ST128(d + i, op128(LD128(a + i), LD128(b + i))); \
+    TAIL(T, expr); \
+  } \
+  __attribute__((target("avx2"))) \
+  static void name##_avx2(uint8_t *d, const uint8_t *a, const uint8_t *b, size_t n) { \
+    size_t i = 0; \
+    for (; i + 32 <= n; i += 32) ST256(d + i, op256(LD256(a + i), LD256(b + i))); \
+    for (; i + 16 <= n; i += 16) ST128(d + i, op128(LD128(a + i), LD128(b + i))); \
+    TAIL(T, expr); \
+  }
+
+// there is no multiply of bytes, so the even and odd bytes are done as halfwords
+static inline __m128i mul8_128(__m128i x, __m128i y) {
+  __m128i even = _mm_mullo_epi16(x, y);
+  __m128i odd = _mm_mullo_epi16(_mm_srli_epi16(x, 8), _mm_srli_epi16(y, 8));
+  return _mm_or_si128(_mm_and_si128(even, _mm_set1_epi16(0xff)), _mm_slli_epi16(odd, 8));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i mul8_256(__m256i x, __m256i y) {
+  __m256i even = _mm256_mullo_epi16(x, y);
+  __m256i odd = _mm256_mullo_epi16(_mm256_srli_epi16(x, 8), _mm256_srli_epi16(y, 8));
+  return _mm256_or_si256(_mm256_and_si256(even, _mm256_set1_epi16(0xff)), _mm256_slli_epi16(odd, 8));
+}
+
+// SSE2 only multiplies the even words to 64 bits
+static inline __m128i mul32_128(__m128i x, __m128i y) {
+  __m128i even = _mm_mul_epu32(x, y);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#else
+#define DEF_KERNEL(name, T, expr, op128, op256) \
+  static void name(uint8_t *d, const uint8_t *a, const uint8_t *b, size_t n) { \
+    size_t i = 0; \
+    TAIL(T, expr); \
+  }
+#endif
+
+DEF_KERNEL(add8 , uint8_t , x + y, _mm_add_epi8 , _mm256_add_epi8 )
+DEF_KERNEL(add16, uint16_t, x + y, _mm_add_epi16, _mm256_add_epi16)
+DEF_KERNEL(add32, uint32_t, x + y, _mm_add_epi32, _mm256_add_epi32)
+DEF_KERNEL(sub8 , uint8_t , x - y, _mm_sub_epi8 , _mm256_sub_epi8 )
+DEF_KERNEL(sub16, uint16_t, x - y, _mm_sub_epi16, _mm256_sub_epi16)
+DEF_KERNEL(sub32, uint32_t, x - y, _mm_sub_epi32, _mm256_sub_epi32)
+DEF_KERNEL(and8 , uint8_t , x & y, _mm_and_si128, _mm256_and_si256)
+DEF_KERNEL(or8  , uint8_t , x | y, _mm_or_si128 , _mm256_or_si256 )
+DEF_KERNEL(xor8 , uint8_t , x ^ y, _mm_xor_si128, _mm256_xor_si256)
+DEF_KERNEL(mul8 , uint8_t , x * y, mul8_128, mul8_256)
+DEF_KERNEL(mul16, uint16_t, (uint32_t)x * y, _mm_mullo_epi16, _mm256_mullo_epi16)
+DEF_KERNEL(mul32, uint32_t, x * y, mul32_128, _mm256_mullo_epi32)
+
+static void mv(uint8_t *d, const uint8_t *a, const uint8_t *b, size_t n) {
+  memmove(d, b, n);
+}
+
+// indexed by the operation and SEW, VOP_RSUB swaps the operands of sub
+static VKernel kernel[NR_VOP][3] = {
+  [VOP_ADD]  = { add8, add16, add32 },
+  [VOP_SUB]  = { sub8, sub16, sub32 },
+  [VOP_RSUB] = { sub8, sub16, sub32 },
+  [VOP_AND]  = { and8, and8, and8 },
+  [VOP_OR]   = { or8, or8, or8 },
+  [VOP_XOR]  = { xor8, xor8, xor8 },
+  [VOP_MUL]  = { mul8, mul16, mul32 },
+  [VOP_MV]   = { mv, mv, mv },
+};
+
+void init_vector() {
+  const char *simd = "none";
+#ifdef HOST_X86
+  simd = "SSE2";
+  if (__builtin_cpu_supports("avx2")) {
+    static const VKernel avx2[NR_VOP][3] = {
+      [VOP_ADD]  = { add8_avx2, add16_avx2, add32_avx2 },
+      [VOP_SUB]  = { sub8_avx2, sub16_avx2, sub32_avx2 },
+      [VOP_RSUB] = { sub8_avx2, sub16_avx2, sub32_avx2 },
+      [VOP_AND]  = { and8_avx2, and8_avx2, and8_avx2 },
+      [VOP_OR]   = { or8_avx2, or8_avx2, or8_avx2 },
+      [VOP_XOR]  = { xor8_avx2, xor8_avx2, xor8_avx2 },
+      [VOP_MUL]  = { mul8_avx2, mul16_avx2, mul32_avx2 },
+      [VOP_MV]   = { mv, mv, mv },
+    };
+    memcpy(kernel, avx2, sizeof(kernel));
+    simd = "AVX2";
+  }
+#endif
+  Log("Vector unit with VLEN = %d, host SIMD: %s", CONFIG_RVV_VLEN, simd);
+}
+
+#define SEW(v)  ((int)BITS((v)->vtype, 5, 3))
+#define LMUL(v) ((int)SEXT(BITS((v)->vtype, 2, 0), 3))
+
+// a group of 2^emul registers starts at a multiple of its size
+static inline bool aligned(int reg, int emul) {
+  return emul <= 0 || (reg & ((1 << emul) - 1)) == 0;
+}
+
+static inline bool active(VecState *v, word_t i) {
+  return (VREG(v, 0)[i / 8] >> (i % 8)) & 1;
+}
+
+/* The only ELEN is 32, so SEW = 64, and a fractional LMUL with SEW
+ * above LMUL * ELEN, are unsupported and set vill.
+ */
+word_t vec_setvl(VecState *v, word_t avl, word_t vtype) {
+  int sew = BITS(vtype, 5, 3);
+  int lmul = SEXT(BITS(vtype, 2, 0), 3);
+  v->vstart = 0;
+  if ((vtype >> 8) != 0 || sew > 2 || lmul == -4 || sew - lmul > 2) {
+    v->vtype = VTYPE_VILL;
+    v->vl = 0;
+    return 0;
+  }
+  word_t vlmax = (lmul >= 0 ? VLENB << lmul : VLENB >> -lmul) >> sew;
+  v->vtype = vtype;
+  v->vl = (avl < vlmax ? avl : vlmax);
+  return v->vl;
+}
+
+/* Masked-off elements and those past vl are left undisturbed, which
+ * is a valid choice under any vta and vma.
+ */
+static bool vec_op(VecState *v, int op, int vd, int vs2, const uint8_t *b, bool masked) {
+  static uint8_t res[8 * VLENB] __attribute__((aligned(32)));
+  int sew = SEW(v);
+  if (!aligned(vd, LMUL(v)) || !aligned(vs2, LMUL(v)) || (masked && vd == 0)) return false;
+  word_t start = v->vstart, end = v->vl;
+  v->vstart = 0;
+  if (start >= end) return true;
+
+  size_t off = start << sew, n = (end - start) << sew;
+  uint8_t *d = VREG(v, vd);
+  const uint8_t *a = VREG(v, vs2);
+  uint8_t *dst = (masked ? res : d);
+  if (op == VOP_RSUB) kernel[op][sew](dst + off, b + off, a + off, n);
+  else kernel[op][sew](dst + off, a + off, b + off, n);
+  if (masked) {
+    word_t i;
+    for (i = start; i < end; i ++) {
+      if (active(v, i)) memcpy(d + (i << sew), res + (i << sew), 1 << sew);
+    }
+  }
+  return true;
+}
+
+bool vec_op_vv(VecState *v, int op, int vd, int vs2, int vs1, bool masked) {
+  if (v->vtype & VTYPE_VILL) return false;
+  if (!aligned(vs1, LMUL(v))) return false;
+  return vec_op(v, op, vd, vs2, VREG(v, vs1), masked);
+}
+
+bool vec_op_vx(VecState *v, int op, int vd, int vs2, word_t x, bool masked) {
+  static uint8_t splat[8 * VLENB] __attribute__((aligned(32)));
+  if (v->vtype & VTYPE_VILL) return false;
+  int sew = SEW(v);
+  word_t i;
+  for (i = v->vstart; i < v->vl; i ++) memcpy(splat + (i << sew), &x, 1 << sew);
+  return vec_op(v, op, vd, vs2, splat, masked);
+}
+
+/* Unmasked accesses move all elements as a single burst. A masked one
+ * goes element by element, keeping vstart at the current element, so
+ * that it resumes from there after a page fault.
+ */
+static bool vec_access(VecState *v, int vreg, vaddr_t addr, int eew, bool masked, bool is_store) {
+  if (v->vtype & VTYPE_VILL) return false;
+  int emul = LMUL(v) + eew - SEW(v);
+  if (emul < -3 || emul > 3 || !aligned(vreg, emul) || (masked && vreg == 0 && !is_store)) return false;
+
+  int esz = 1 << eew;
+  uint8_t *r = VREG(v, vreg);
+  word_t i = v->vstart, end = v->vl;
+  if (!masked) {
+    if (i < end) {
+      if (is_store) vaddr_write_burst(addr + i * esz, r + i * esz, esz, end - i);
+      else vaddr_read_burst(addr + i * esz, r + i * esz, esz, end - i);
+    }
+  } else {
+    for (; i < end; i ++) {
+      if (!active(v, i)) continue;
+      v->vstart = i;
+      word_t data = 0;
+      if (is_store) {
+        memcpy(&data, r + i * esz, esz);
+        vaddr_write(addr + i * esz, esz, data);
+      } else {
+        data = vaddr_read(addr + i * esz, esz);
+        memcpy(r + i * esz, &data, esz);
+      }
+    }
+  }
+  v->vstart = 0;
+  return true;
+}
+
+bool vec_load(VecState *v, int vd, vaddr_t addr, int eew, bool masked) {
+  return vec_access(v, vd, addr, eew, masked, false);
+}
+
+bool vec_store(VecState *v, int vs3, vaddr_t addr, int eew, bool masked) {
+  return vec_access(v, vs3, addr, eew, masked, true);
+}
+#endif
@@ -15,6 +15,8 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <device/intr.h>
+#include <stdatomic.h>
 
 enum {
   reg_freq,
@@ -22,28 +24,48 @@ enum {
   reg_samples,
   reg_sbuf_size,
   reg_init,
-  reg_count,
+  reg_count,    // read only from here on
   reg_front,
   reg_rear,
+  reg_push,     // a write of n appends the n bytes written at reg_rear
+  reg_lowmark,  // STATUS_LOW while reg_count is not above it
+  reg_status,
+  reg_irq,      // 1 raises the external interrupt while STATUS_LOW
   nr_reg
 };
 
+#define STATUS_LOW 0x1
+
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+/* sbuf is a ring with a single producer, the guest, and a single
+ * consumer, the SDL audio thread. `tail' and `head' count the bytes
+ * ever appended and consumed, so that each side only writes its own
+ * and the ring needs no lock; the size of sbuf is a power of 2 so that
+ * they can wrap around.
+ */
+static _Atomic uint32_t head = 0, tail = 0;
+
+static inline uint32_t sb_count() {
+  return atomic_load_explicit(&tail, memory_order_relaxed) -
+    atomic_load_explicit(&head, memory_order_acquire);
+}
+
 #ifdef CONFIG_AUDIO_PLAY_SOUND
 #include <SDL2/SDL.h>
 
 static void play_sound(void *userdata, uint8_t *stream, int len) {
-  int i = 0;
-  while (i < len && audio_base[reg_count] > 0) {
-    stream[i] = sbuf[audio_base[reg_front]];
-    audio_base[reg_front] = (audio_base[reg_front] + 1) % audio_base[reg_sbuf_size];
-    audio_base[reg_count]--;
-    i++;
-  }
-  if (i < len) {
-    memset(stream + i, 0, len - i);
+  uint32_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  uint32_t n = atomic_load_explicit(&tail, memory_order_acquire) - h;
+  if (n > (uint32_t)len) n = len;
+  uint32_t off = h % CONFIG_SB_SIZE;
+  uint32_t first = (n < CONFIG_SB_SIZE - off ? n : CONFIG_SB_SIZE - off);
+  memcpy(stream, sbuf + off, first);
+  memcpy(stream + first, sbuf, n - first);
+  atomic_store_explicit(&head, h + n, memory_order_release);
+  if (n < len) {
+    memset(stream + n, 0, len - n);
   }
 }
 
@@ -63,22 +85,63 @@ static void init_sound() {
 
 #endif
 
+static inline bool is_low() {
+  return sb_count() <= audio_base[reg_lowmark];
+}
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
-#ifdef CONFIG_AUDIO_PLAY_SOUND
-  if (is_write && audio_base[reg_init]) {
-    init_sound();
-    audio_base[reg_init] = 0;
+  if (!is_write) {
+    uint32_t count = sb_count();
+    audio_base[reg_count] = count;
+    audio_base[reg_front] = (atomic_load_explicit(&tail, memory_order_relaxed) - count) % CONFIG_SB_SIZE;
+    audio_base[reg_rear] = atomic_load_explicit(&tail, memory_order_relaxed) % CONFIG_SB_SIZE;
+    audio_base[reg_status] = (count <= audio_base[reg_lowmark] ? STATUS_LOW : 0);
+    return;
   }
+  switch (offset / 4) {
+    case reg_init:
+#ifdef CONFIG_AUDIO_PLAY_SOUND
+      if (audio_base[reg_init]) {
+        init_sound();
+        audio_base[reg_init] = 0;
+      }
 #endif
+      break;
+    case reg_push: {
+      uint32_t n = audio_base[reg_push], space = CONFIG_SB_SIZE - sb_count();
+      if (n > space) {
+        Log("audio: %u bytes pushed with only %u bytes free", n, space);
+        n = space;
+      }
+      atomic_fetch_add_explicit(&tail, n, memory_order_release);
+      break;
+    }
+  }
+  dev_set_ext_irq(EXT_IRQ_AUDIO, audio_base[reg_irq] && is_low());
 }
 
+// the consumer drains sbuf on its own thread, so the interrupt is updated with the devices
+void audio_update() {
+  if (audio_base[reg_irq]) dev_set_ext_irq(EXT_IRQ_AUDIO, is_low());
+}
+
+static const IOReg audio_regs[] = {
+  { reg_init * 4, 4, IO_HOOK_W, audio_io_handler },
+  { reg_count * 4, 12, IO_HOOK_R, audio_io_handler },
+  { reg_push * 4, 4, IO_HOOK_W, audio_io_handler },
+  { reg_lowmark * 4, 4, IO_HOOK_W, audio_io_handler },
+  { reg_status * 4, 4, IO_HOOK_R, audio_io_handler },
+  { reg_irq * 4, 4, IO_HOOK_W, audio_io_handler },
+};
+
 void init_audio() {
+  Assert((CONFIG_SB_SIZE & (CONFIG_SB_SIZE - 1)) == 0, "size of sbuf must be a power of 2");
   uint32_t space_size = sizeof(uint32_t) * nr_reg;
   audio_base = (uint32_t *)new_space(space_size);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("audio", CONFIG_AUDIO_CTL_PORT, audio_base, space_size, audio_io_handler);
+  add_pio_bank ("audio", CONFIG_AUDIO_CTL_PORT, audio_base, space_size, audio_regs, ARRLEN(audio_regs));
 #else
-  add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_io_handler);
+  add_mmio_bank("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_regs, ARRLEN(audio_regs));
 #endif
 
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
@@ -88,4 +151,6 @@ void init_audio() {
   audio_base[reg_front] = 0;
   audio_base[reg_rear] = 0;
   audio_base[reg_count] = 0;
+  audio_base[reg_lowmark] = 0;
+  audio_base[reg_irq] = 0;
 }
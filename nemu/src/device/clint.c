@@ -0,0 +1,94 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <device/intr.h>
+#include <cpu/cpu.h>
+
+#define CLINT_MSIP     0x0000
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME    0xbff8
+#define CLINT_SIZE     0x10000
+
+extern uint64_t g_nr_guest_inst;
+
+static uint8_t *clint_base = NULL;
+static uint64_t mtimecmp = UINT64_MAX;
+static uint64_t mtime_bias = 0;
+
+/* mtime is derived from the instruction count when it is read, so the
+ * CLINT costs nothing while the guest runs. A write to mtime only moves
+ * the bias.
+ */
+uint64_t clint_mtime() {
+  return g_nr_guest_inst / CONFIG_CLINT_INSTS_PER_TICK + mtime_bias;
+}
+
+/* Set MTIP if mtime has reached mtimecmp, and otherwise clear it and
+ * ask the execution loop to come back at the instruction count where
+ * it will be reached.
+ */
+void clint_update() {
+  if (clint_mtime() >= mtimecmp) {
+    dev_set_irq(IRQ_MTI, true);
+    return;
+  }
+  dev_set_irq(IRQ_MTI, false);
+  uint64_t ticks = mtimecmp - mtime_bias;
+  cpu_schedule_event(ticks > UINT64_MAX / CONFIG_CLINT_INSTS_PER_TICK ?
+      UINT64_MAX : ticks * CONFIG_CLINT_INSTS_PER_TICK);
+}
+
+static void write_half(uint64_t *reg, uint32_t offset, int len) {
+  uint64_t val = *reg;
+  memcpy((uint8_t *)&val + (offset & 7), clint_base + offset, len);
+  *reg = val;
+}
+
+static void clint_io_handler(uint32_t offset, int len, bool is_write) {
+  uint64_t mtime = clint_mtime();
+  if (offset >= CLINT_MTIME && offset < CLINT_MTIME + 8) {
+    if (is_write) {
+      write_half(&mtime, offset, len);
+      mtime_bias += mtime - clint_mtime();
+      clint_update();
+    } else {
+      memcpy(clint_base + CLINT_MTIME, &mtime, 8);
+    }
+  } else if (offset >= CLINT_MTIMECMP && offset < CLINT_MTIMECMP + 8) {
+    if (is_write) {
+      write_half(&mtimecmp, offset, len);
+      clint_update();
+    }
+  } else if (offset < CLINT_MSIP + 4) {
+    if (is_write) {
+      uint32_t *msip = (uint32_t *)(clint_base + CLINT_MSIP);
+      *msip &= 1;
+      dev_set_irq(IRQ_MSI, *msip);
+    }
+  }
+}
+
+static const IOReg clint_regs[] = {
+  { CLINT_MSIP, 4, IO_HOOK_W, clint_io_handler },
+  { CLINT_MTIMECMP, 8, IO_HOOK_W, clint_io_handler },
+  { CLINT_MTIME, 8, IO_HOOK_R | IO_HOOK_W, clint_io_handler },
+};
+
+void init_clint() {
+  clint_base = new_space(CLINT_SIZE);
+  memcpy(clint_base + CLINT_MTIMECMP, &mtimecmp, 8);
+  add_mmio_bank("clint", CONFIG_CLINT_MMIO, clint_base, CLINT_SIZE, clint_regs, ARRLEN(clint_regs));
+}
@@ -15,40 +15,106 @@
 
 #include <common.h>
 #include <utils.h>
-#include <device/alarm.h>
+#include <cpu/perf.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
 
+// rate at which the screen is refreshed and host events are polled
+#define TIMER_HZ 60
+
 void init_map();
 void init_serial();
+void serial_update();
 void init_timer();
 void init_vga();
+void init_gpu();
 void init_i8042();
 void init_audio();
+void audio_update();
+void init_dma();
 void init_disk();
+void disk_update();
+void init_net();
+void net_update();
 void init_sdcard();
-void init_alarm();
+void init_clint();
+void clint_update();
 
 void send_key(uint8_t, bool);
+void keyboard_update();
 void vga_update_screen();
 
+#ifndef CONFIG_TARGET_AM
+static void poll_events();
+#endif
+
+#ifdef CONFIG_DISPLAY_THREAD
+#include <stdatomic.h>
+
+void vga_init_display();
+void vga_present();
+
+/* The display thread owns the window. It presents the frames published
+ * by vga_update_screen() and polls host events, so that the guest never
+ * waits for the renderer or the window system. Keys reach the CPU thread
+ * through the lock-free queue of the i8042, and closing the window
+ * through `quit_requested'.
+ */
+static atomic_bool quit_requested = false;
+static atomic_bool display_stop = false;
+static SDL_Thread *display = NULL;
+
+static int display_thread(void *arg) {
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, vga_init_display());
+  while (!atomic_load(&display_stop)) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, vga_present());
+    poll_events();
+    SDL_Delay(1000 / TIMER_HZ);
+  }
+  return 0;
+}
+
+// the window must not be used by the display thread while NEMU exits
+static void finish_display() {
+  atomic_store(&display_stop, true);
+  SDL_WaitThread(display, NULL);
+}
+#endif
+
 void device_update() {
+  IFDEF(CONFIG_HAS_CLINT, clint_update());
+  IFDEF(CONFIG_HAS_DISK, disk_update());
+  IFDEF(CONFIG_HAS_NET, net_update());
+  IFDEF(CONFIG_KEY_REPLAY, keyboard_update());
+  IFDEF(CONFIG_HAS_SERIAL, serial_update());
+
   static uint64_t last = 0;
   uint64_t now = get_time();
   if (now - last < 1000000 / TIMER_HZ) {
     return;
   }
   last = now;
+  IFDEF(CONFIG_PERF, uint64_t start = perf_time_ns());
 
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+  IFDEF(CONFIG_HAS_AUDIO, audio_update());
+
+#ifdef CONFIG_DISPLAY_THREAD
+  if (atomic_load(&quit_requested)) nemu_state.state = NEMU_QUIT;
+#elif !defined(CONFIG_TARGET_AM)
+  poll_events();
+#endif
+  IFDEF(CONFIG_PERF, perf_device_update_time += perf_time_ns() - start);
+}
 
 #ifndef CONFIG_TARGET_AM
+static void poll_events() {
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
+        MUXDEF(CONFIG_DISPLAY_THREAD, atomic_store(&quit_requested, true), nemu_state.state = NEMU_QUIT);
         break;
 #ifdef CONFIG_HAS_KEYBOARD
       // If a key was pressed
@@ -63,11 +129,12 @@ void device_update() {
       default: break;
     }
   }
-#endif
 }
+#endif
 
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
+  // with the display thread, keys sent while the guest is stopped are dropped by send_key()
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_DISPLAY_THREAD)
   SDL_Event event;
   while (SDL_PollEvent(&event));
 #endif
@@ -80,10 +147,18 @@ void init_device() {
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
   IFDEF(CONFIG_HAS_VGA, init_vga());
+  IFDEF(CONFIG_HAS_GPU, init_gpu());
   IFDEF(CONFIG_HAS_KEYBOARD, init_i8042());
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
+  IFDEF(CONFIG_HAS_DMA, init_dma());
   IFDEF(CONFIG_HAS_DISK, init_disk());
+  IFDEF(CONFIG_HAS_NET, init_net());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
+  IFDEF(CONFIG_HAS_CLINT, init_clint());
 
-  IFNDEF(CONFIG_TARGET_AM, init_alarm());
+#ifdef CONFIG_DISPLAY_THREAD
+  display = SDL_CreateThread(display_thread, "display", NULL);
+  Assert(display, "cannot create the display thread: %s", SDL_GetError());
+  atexit(finish_display);
+#endif
 }
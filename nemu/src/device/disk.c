@@ -14,6 +14,222 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/intr.h>
+#include <memory/paddr.h>
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* A block device in the style of virtio-blk. The guest fills
+ * descriptors in a ring in its memory and posts them by writing the
+ * number of descriptors ever posted to reg_avail. Each request moves
+ * any number of blocks with a single pread()/pwrite() on one of the
+ * I/O threads. Finished requests are handed back to the CPU thread,
+ * which writes the status of the descriptor and bumps reg_used in
+ * disk_update(), so that requests may complete out of order. A buffer
+ * must be in pmem, as the I/O threads fill it while the guest runs
+ * without going through the hooks of a device; it reaches the DiffTest
+ * REF when the request completes. With reg_irq set, a completion
+ * raises the external interrupt until reg_isr is written.
+ */
+
+enum {
+  reg_blksz,      // read only
+  reg_blkcnt,     // read only, 0 if there is no image
+  reg_ring,       // physical address of the descriptors
+  reg_ring_size,  // number of descriptors, a power of 2
+  reg_avail,      // descriptors ever posted
+  reg_used,       // requests ever completed, read only
+  reg_irq,
+  reg_isr,        // 1 after a completion, a write clears it
+  nr_reg
+};
+
+enum { DISK_READ, DISK_WRITE, DISK_FLUSH };
+enum { DISK_PENDING, DISK_OK, DISK_IOERR, DISK_UNSUPP };
+
+typedef struct {
+  uint32_t type;
+  uint32_t status;  // written by the device when the request is done
+  uint32_t blkno, nblk;
+  uint32_t buf;     // physical address
+  uint32_t pad[3];
+} DiskDesc;
+
+#define BLKSZ 512
+#define MAX_RING_SIZE 256
+
+typedef struct {
+  uint32_t type;
+  DiskDesc *desc;
+  paddr_t desc_addr;
+  uint8_t *buf;
+  paddr_t buf_addr;
+  off_t off;
+  size_t len;
+  uint32_t status;
+} Job;
+
+static uint32_t *disk_base = NULL;
+static int fd = -1;
+static uint32_t last_avail = 0;
+static uint32_t nr_inflight = 0;
+static atomic_bool completed = false;
+
+/* Jobs are handed to the I/O threads through `job', and back through
+ * `finished'; both are guarded by `lock'. At most MAX_RING_SIZE jobs are in
+ * flight, so neither ring overflows.
+ */
+static Job job[MAX_RING_SIZE], finished[MAX_RING_SIZE];
+static uint32_t job_head = 0, job_tail = 0, fin_head = 0, fin_tail = 0;
+static SDL_mutex *lock = NULL;
+static SDL_sem *nr_job = NULL;
+
+static uint8_t *buf_ptr(paddr_t addr, uint64_t len) {
+  if (len > UINT32_MAX || !in_pmem(addr) || (len > 0 && !in_pmem(addr + len - 1))) return NULL;
+  return guest_to_host(addr);
+}
+
+static uint32_t serve(Job *j) {
+  if (j->type == DISK_FLUSH) return fsync(fd) == 0 ? DISK_OK : DISK_IOERR;
+  size_t done = 0;
+  while (done < j->len) {
+    ssize_t n = (j->type == DISK_READ ?
+        pread(fd, j->buf + done, j->len - done, j->off + done) :
+        pwrite(fd, j->buf + done, j->len - done, j->off + done));
+    if (n <= 0) return DISK_IOERR;
+    done += n;
+  }
+  return DISK_OK;
+}
+
+static int io_thread(void *arg) {
+  while (true) {
+    SDL_SemWait(nr_job);
+    SDL_LockMutex(lock);
+    Job j = job[job_head ++ % MAX_RING_SIZE];
+    SDL_UnlockMutex(lock);
+    j.status = serve(&j);
+    SDL_LockMutex(lock);
+    finished[fin_tail ++ % MAX_RING_SIZE] = j;
+    SDL_UnlockMutex(lock);
+    atomic_store(&completed, true);
+  }
+  return 0;
+}
+
+// on the CPU thread only
+static void complete(Job *j) {
+  if (j->type == DISK_READ && j->status == DISK_OK) paddr_dma_sync(j->buf_addr, j->len);
+  j->desc->status = j->status;
+  paddr_dma_sync(j->desc_addr + offsetof(DiskDesc, status), sizeof(j->desc->status));
+  disk_base[reg_used] ++;
+  disk_base[reg_isr] = 1;
+  if (disk_base[reg_irq]) dev_set_ext_irq(EXT_IRQ_DISK, true);
+}
+
+static void submit(DiskDesc *d, paddr_t desc_addr) {
+  uint64_t len = (uint64_t)d->nblk * BLKSZ;
+  Job j = { .type = d->type, .desc = d, .desc_addr = desc_addr, .buf_addr = d->buf,
+    .off = (off_t)d->blkno * BLKSZ, .len = len, .status = DISK_IOERR };
+  if (d->type != DISK_READ && d->type != DISK_WRITE && d->type != DISK_FLUSH) {
+    j.status = DISK_UNSUPP;
+    complete(&j);
+    return;
+  }
+  if (d->type != DISK_FLUSH) {
+    j.buf = buf_ptr(d->buf, len);
+    if (j.buf == NULL || (uint64_t)d->blkno + d->nblk > disk_base[reg_blkcnt]) {
+      complete(&j);
+      return;
+    }
+  }
+  if (fd < 0 || nr_inflight == MAX_RING_SIZE) {
+    complete(&j);
+    return;
+  }
+  nr_inflight ++;
+  SDL_LockMutex(lock);
+  job[job_tail ++ % MAX_RING_SIZE] = j;
+  SDL_UnlockMutex(lock);
+  SDL_SemPost(nr_job);
+}
+
+static void kick() {
+  uint32_t size = disk_base[reg_ring_size];
+  if (size == 0 || size > MAX_RING_SIZE || (size & (size - 1)) != 0) {
+    Log("disk: bad ring size %u", size);
+    return;
+  }
+  paddr_t ring_addr = disk_base[reg_ring];
+  DiskDesc *ring = (DiskDesc *)paddr_dma_ptr(ring_addr, size * sizeof(DiskDesc), false);
+  if (ring == NULL) {
+    Log("disk: bad ring at " FMT_PADDR, ring_addr);
+    return;
+  }
+  for (; last_avail != disk_base[reg_avail]; last_avail ++) {
+    uint32_t i = last_avail % size;
+    submit(&ring[i], ring_addr + i * sizeof(DiskDesc));
+  }
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / 4) {
+    case reg_avail: if (is_write) kick(); break;
+    case reg_isr:
+      if (is_write) {
+        disk_base[reg_isr] = 0;
+        dev_set_ext_irq(EXT_IRQ_DISK, false);
+      }
+      break;
+  }
+}
+
+// jobs finished by the I/O threads are completed here
+void disk_update() {
+  if (!atomic_exchange(&completed, false)) return;
+  SDL_LockMutex(lock);
+  for (; fin_head != fin_tail; fin_head ++) {
+    complete(&finished[fin_head % MAX_RING_SIZE]);
+    nr_inflight --;
+  }
+  SDL_UnlockMutex(lock);
+}
+
+static const IOReg disk_regs[] = {
+  { reg_avail * 4, 4, IO_HOOK_W, disk_io_handler },
+  { reg_isr * 4, 4, IO_HOOK_W, disk_io_handler },
+};
 
 void init_disk() {
+  disk_base = (uint32_t *)new_space(nr_reg * 4);
+  memset(disk_base, 0, nr_reg * 4);
+  disk_base[reg_blksz] = BLKSZ;
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_bank ("disk", CONFIG_DISK_CTL_PORT, disk_base, nr_reg * 4, disk_regs, ARRLEN(disk_regs));
+#else
+  add_mmio_bank("disk", CONFIG_DISK_CTL_MMIO, disk_base, nr_reg * 4, disk_regs, ARRLEN(disk_regs));
+#endif
+
+  const char *img = CONFIG_DISK_IMG_PATH;
+  if (img[0] == '\0') return;
+  fd = open(img, O_RDWR);
+  if (fd < 0) {
+    Log("Can not open disk image: %s", img);
+    return;
+  }
+  off_t size = lseek(fd, 0, SEEK_END);
+  disk_base[reg_blkcnt] = size / BLKSZ;
+  lock = SDL_CreateMutex();
+  nr_job = SDL_CreateSemaphore(0);
+  Assert(lock && nr_job, "cannot create the I/O threads of disk: %s", SDL_GetError());
+  int i;
+  for (i = 0; i < CONFIG_DISK_IO_THREADS; i ++) {
+    SDL_Thread *t = SDL_CreateThread(io_thread, "disk-io", NULL);
+    Assert(t, "cannot create the I/O threads of disk: %s", SDL_GetError());
+    SDL_DetachThread(t);
+  }
+  Log("Disk image %s with %u blocks", img, disk_base[reg_blkcnt]);
 }
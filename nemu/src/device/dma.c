@@ -0,0 +1,88 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <device/intr.h>
+#include <memory/paddr.h>
+
+/* A DMA engine for bulk copies between guest memory and devices. The
+ * copy is a single memmove() on the host and is done by the time the
+ * write to reg_ctrl returns, so polling reg_status never spins; with
+ * CTRL_IRQ the completion also raises the external interrupt, which
+ * stays pending until reg_status is written.
+ */
+
+enum {
+  reg_src,    // physical addresses
+  reg_dst,
+  reg_len,    // in bytes
+  reg_ctrl,   // CTRL_*, a write with CTRL_START starts a copy
+  reg_status, // STATUS_*, a write clears it and the interrupt
+  nr_reg
+};
+
+#define CTRL_START   0x1
+#define CTRL_IRQ     0x2
+#define STATUS_DONE  0x1
+#define STATUS_ERROR 0x2
+
+static uint32_t *dma_base = NULL;
+
+static void dma_copy() {
+  uint32_t len = dma_base[reg_len];
+  uint8_t *src = paddr_dma_ptr(dma_base[reg_src], len, false);
+  uint8_t *dst = paddr_dma_ptr(dma_base[reg_dst], len, true);
+  if (len != 0 && (src == NULL || dst == NULL)) {
+    Log("bad DMA of %u bytes from " FMT_PADDR " to " FMT_PADDR, len,
+        (paddr_t)dma_base[reg_src], (paddr_t)dma_base[reg_dst]);
+    dma_base[reg_status] = STATUS_DONE | STATUS_ERROR;
+  } else {
+    if (len != 0) memmove(dst, src, len);
+    paddr_dma_sync(dma_base[reg_dst], len);
+    dma_base[reg_status] = STATUS_DONE;
+  }
+  if (dma_base[reg_ctrl] & CTRL_IRQ) dev_set_ext_irq(EXT_IRQ_DMA, true);
+}
+
+static void dma_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  switch (offset / 4) {
+    case reg_ctrl:
+      if (dma_base[reg_ctrl] & CTRL_START) {
+        dma_base[reg_ctrl] &= ~CTRL_START;
+        dma_copy();
+      }
+      break;
+    case reg_status:
+      dma_base[reg_status] = 0;
+      dev_set_ext_irq(EXT_IRQ_DMA, false);
+      break;
+  }
+}
+
+static const IOReg dma_regs[] = {
+  { reg_ctrl * 4, 4, IO_HOOK_W, dma_io_handler },
+  { reg_status * 4, 4, IO_HOOK_W, dma_io_handler },
+};
+
+void init_dma() {
+  dma_base = (uint32_t *)new_space(nr_reg * 4);
+  memset(dma_base, 0, nr_reg * 4);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_bank ("dma", CONFIG_DMA_CTL_PORT, dma_base, nr_reg * 4, dma_regs, ARRLEN(dma_regs));
+#else
+  add_mmio_bank("dma", CONFIG_DMA_CTL_MMIO, dma_base, nr_reg * 4, dma_regs, ARRLEN(dma_regs));
+#endif
+}
@@ -0,0 +1,173 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/map.h>
+#include <memory/paddr.h>
+
+/* A 2D accelerator. The guest puts an array of commands in memory,
+ * writes its address and length, and starts it with a write to
+ * reg_start. All commands run at once on the host, with whole rows
+ * moved by memcpy(), so a full screen update costs a few MMIO writes
+ * instead of one per pixel. Addresses are physical, and may point to
+ * pmem or to vmem.
+ */
+
+enum {
+  reg_queue,  // physical address of the commands
+  reg_count,  // number of commands
+  reg_start,  // a write runs the commands
+  reg_done,   // commands run by the last start, less than reg_count if one is bad
+  nr_reg
+};
+
+enum { GPU_NOP, GPU_FILL, GPU_BLIT, GPU_BLIT_KEY, GPU_PAL8, GPU_SCALE };
+
+typedef struct {
+  uint32_t op;
+  uint32_t dst, dst_pitch;  // pitch in bytes
+  uint16_t w, h;            // size of the destination
+  uint32_t src, src_pitch;
+  uint16_t sw, sh;          // size of the source, for GPU_SCALE
+  uint32_t arg;             // colour of GPU_FILL, key of GPU_BLIT_KEY, palette of GPU_PAL8
+} GPUCmd;
+
+static uint32_t *gpu_base = NULL;
+
+// host memory behind a rectangle of `h' rows of `row' bytes
+static uint8_t *rect(paddr_t addr, uint32_t pitch, uint32_t row, uint32_t h, bool is_write) {
+  uint64_t len = (uint64_t)pitch * (h - 1) + row;
+  if (len > UINT32_MAX) return NULL;
+  return paddr_dma_ptr(addr, len, is_write);
+}
+
+static void fill(uint8_t *dst, const GPUCmd *c) {
+  uint32_t *d = (uint32_t *)dst;
+  int x, y;
+  for (x = 0; x < c->w; x ++) d[x] = c->arg;
+  for (y = 1; y < c->h; y ++) memcpy(dst + y * c->dst_pitch, dst, c->w * 4);
+}
+
+static void blit(uint8_t *dst, const uint8_t *src, const GPUCmd *c) {
+  int y;
+  if (dst <= src) {
+    for (y = 0; y < c->h; y ++) memmove(dst + y * c->dst_pitch, src + y * c->src_pitch, c->w * 4);
+  } else { // bottom up, so that scrolling down works in place
+    for (y = c->h - 1; y >= 0; y --) memmove(dst + y * c->dst_pitch, src + y * c->src_pitch, c->w * 4);
+  }
+}
+
+static void blit_key(uint8_t *dst, const uint8_t *src, const GPUCmd *c) {
+  int x, y;
+  for (y = 0; y < c->h; y ++) {
+    uint32_t *d = (uint32_t *)(dst + y * c->dst_pitch);
+    const uint32_t *s = (const uint32_t *)(src + y * c->src_pitch);
+    for (x = 0; x < c->w; x ++) d[x] = (s[x] == c->arg ? d[x] : s[x]);
+  }
+}
+
+static void pal8(uint8_t *dst, const uint8_t *src, const uint32_t *pal, const GPUCmd *c) {
+  int x, y;
+  for (y = 0; y < c->h; y ++) {
+    uint32_t *d = (uint32_t *)(dst + y * c->dst_pitch);
+    const uint8_t *s = src + y * c->src_pitch;
+    for (x = 0; x < c->w; x ++) d[x] = pal[s[x]];
+  }
+}
+
+// nearest neighbour: pixel (x, y) comes from (x * sw / w, y * sh / h)
+static void scale(uint8_t *dst, const uint8_t *src, const GPUCmd *c) {
+  static uint32_t *sx = NULL;
+  static int sx_len = 0;
+  if (sx_len < c->w) {
+    sx_len = c->w;
+    sx = realloc(sx, sx_len * sizeof(*sx));
+    assert(sx);
+  }
+  int x, y;
+  for (x = 0; x < c->w; x ++) sx[x] = x * c->sw / c->w;
+  for (y = 0; y < c->h; y ++) {
+    uint32_t *d = (uint32_t *)(dst + y * c->dst_pitch);
+    int sy = y * c->sh / c->h;
+    if (y > 0 && sy == (y - 1) * c->sh / c->h) {
+      memcpy(d, dst + (y - 1) * c->dst_pitch, c->w * 4);
+      continue;
+    }
+    const uint32_t *s = (const uint32_t *)(src + sy * c->src_pitch);
+    for (x = 0; x < c->w; x ++) d[x] = s[sx[x]];
+  }
+}
+
+static bool run(const GPUCmd *c) {
+  if (c->op == GPU_NOP || c->w == 0 || c->h == 0) return true;
+  uint8_t *src = NULL;
+  const uint32_t *pal = NULL;
+  switch (c->op) {
+    case GPU_FILL: break;
+    case GPU_BLIT: case GPU_BLIT_KEY:
+      src = rect(c->src, c->src_pitch, c->w * 4, c->h, false); break;
+    case GPU_PAL8:
+      src = rect(c->src, c->src_pitch, c->w, c->h, false);
+      pal = (uint32_t *)paddr_dma_ptr(c->arg, 256 * 4, false);
+      if (pal == NULL) return false;
+      break;
+    case GPU_SCALE:
+      if (c->sw == 0 || c->sh == 0) return false;
+      src = rect(c->src, c->src_pitch, c->sw * 4, c->sh, false); break;
+    default: return false;
+  }
+  if (c->op != GPU_FILL && src == NULL) return false;
+  uint8_t *dst = rect(c->dst, c->dst_pitch, c->w * 4, c->h, true);
+  if (dst == NULL) return false;
+
+  switch (c->op) {
+    case GPU_FILL: fill(dst, c); break;
+    case GPU_BLIT: blit(dst, src, c); break;
+    case GPU_BLIT_KEY: blit_key(dst, src, c); break;
+    case GPU_PAL8: pal8(dst, src, pal, c); break;
+    case GPU_SCALE: scale(dst, src, c); break;
+  }
+  paddr_dma_sync(c->dst, c->dst_pitch * (c->h - 1) + c->w * 4);
+  return true;
+}
+
+static void gpu_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write || offset / 4 != reg_start) return;
+  uint32_t n = gpu_base[reg_count], i;
+  const GPUCmd *cmd = (n > UINT32_MAX / sizeof(GPUCmd) ? NULL :
+      (GPUCmd *)paddr_dma_ptr(gpu_base[reg_queue], n * sizeof(GPUCmd), false));
+  for (i = 0; cmd != NULL && i < n; i ++) {
+    GPUCmd c = cmd[i]; // the commands may be overwritten by themselves
+    if (!run(&c)) {
+      Log("bad command %d of the 2D accelerator at " FMT_PADDR, c.op,
+          (paddr_t)(gpu_base[reg_queue] + i * sizeof(GPUCmd)));
+      break;
+    }
+  }
+  gpu_base[reg_done] = i;
+}
+
+static const IOReg gpu_regs[] = {
+  { reg_start * 4, 4, IO_HOOK_W, gpu_io_handler },
+};
+
+void init_gpu() {
+  gpu_base = (uint32_t *)new_space(nr_reg * 4);
+  memset(gpu_base, 0, nr_reg * 4);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_bank ("gpu", CONFIG_GPU_CTL_PORT, gpu_base, nr_reg * 4, gpu_regs, ARRLEN(gpu_regs));
+#else
+  add_mmio_bank("gpu", CONFIG_GPU_CTL_MMIO, gpu_base, nr_reg * 4, gpu_regs, ARRLEN(gpu_regs));
+#endif
+}
@@ -14,6 +14,21 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/cpu.h>
+#include <device/intr.h>
 
-void dev_raise_intr() {
+/* Devices drive level-sensitive interrupt lines. The execution loop
+ * looks at pending interrupts only at its next event, so a rising line
+ * moves the event to now.
+ */
+void dev_set_irq(int irq, bool level) {
+  isa_set_irq(irq, level);
+  if (level) cpu_schedule_event(0);
+}
+
+void dev_set_ext_irq(int source, bool level) {
+  static uint32_t sources = 0;
+  if (level) sources |= 1u << source;
+  else sources &= ~(1u << source);
+  dev_set_irq(IRQ_MEI, sources != 0);
 }
@@ -17,6 +17,7 @@
 #include <memory/host.h>
 #include <memory/vaddr.h>
 #include <device/map.h>
+#include <cpu/perf.h>
 
 #define IO_SPACE_MAX (2 * 1024 * 1024)
 
@@ -49,8 +50,43 @@ static void check_bound(IOMap *map, paddr_t addr) {
   }
 }
 
-static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_write) {
-  if (c != NULL) { c(offset, len, is_write); }
+void map_set_regs(IOMap *map, const IOReg *regs, int nr_reg) {
+  int i;
+  map->hook_flags = 0;
+  for (i = 0; i < nr_reg; i ++) {
+    Assert(regs[i].size > 0 && regs[i].offset + regs[i].size - 1 <= map->high - map->low,
+        "register %d of {%s} is outside the map", i, map->name);
+    Assert(i == 0 || regs[i].offset >= regs[i - 1].offset + regs[i - 1].size,
+        "registers of {%s} are not sorted or overlap", map->name);
+    Assert(regs[i].flags == 0 || regs[i].hook != NULL, "register %d of {%s} has no hook", i, map->name);
+    map->hook_flags |= regs[i].flags;
+  }
+  map->regs = regs;
+  map->nr_reg = nr_reg;
+}
+
+// run the hooks of the registers the access overlaps
+static void invoke_hooks(IOMap *map, paddr_t offset, int len, bool is_write) {
+  int flag = (is_write ? IO_HOOK_W : IO_HOOK_R);
+  if (!(map->hook_flags & flag)) return;
+  paddr_t end = offset + len;
+  int i;
+  for (i = 0; i < map->nr_reg; i ++) {
+    const IOReg *r = &map->regs[i];
+    if (r->offset >= end) break;
+    if (r->offset + r->size <= offset || !(r->flags & flag)) continue;
+    paddr_t lo = (offset > r->offset ? offset : r->offset);
+    paddr_t hi = (end < r->offset + r->size ? end : r->offset + r->size);
+    r->hook(lo, hi - lo, is_write);
+  }
+}
+
+void map_invoke(IOMap *map, paddr_t offset, int len, bool is_write) {
+  if (map->regs == NULL && map->callback == NULL) { return; }
+  IFDEF(CONFIG_PERF, uint64_t start = perf_time_ns());
+  if (map->regs != NULL) invoke_hooks(map, offset, len, is_write);
+  else map->callback(offset, len, is_write);
+  IFDEF(CONFIG_PERF, map->callback_time += perf_time_ns() - start);
 }
 
 void init_map() {
@@ -63,8 +99,9 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   IFDEF(CONFIG_DTRACE, dtrace_add(map, cpu.pc, DREAD));
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  IFDEF(CONFIG_PERF, map->nr_read ++);
   paddr_t offset = addr - map->low;
-  invoke_callback(map->callback, offset, len, false); // prepare data to read
+  map_invoke(map, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
   return ret;
 }
@@ -73,7 +110,8 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   IFDEF(CONFIG_DTRACE, dtrace_add(map, cpu.pc, DWRITE));
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
+  IFDEF(CONFIG_PERF, map->nr_write ++);
   paddr_t offset = addr - map->low;
   host_write(map->space + offset, len, data);
-  invoke_callback(map->callback, offset, len, true);
+  map_invoke(map, offset, len, true);
 }
@@ -16,14 +16,22 @@
 #include <device/map.h>
 #include <memory/paddr.h>
 
-#define NR_MAP 16
+#define NR_MAP 32
 
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
 
 static IOMap* fetch_mmio_map(paddr_t addr) {
+  // accesses to a device tend to come in runs
+  static IOMap *last = NULL;
+  if (last != NULL && map_inside(last, addr)) {
+    difftest_skip_ref();
+    return last;
+  }
   int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
+  if (mapid == -1) return NULL;
+  last = &maps[mapid];
+  return last;
 }
 
 static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
@@ -49,10 +57,16 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
     .space = space, .callback = callback };
   Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
       maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
+  IFDEF(CONFIG_PERF, perf_add_map(&maps[nr_map], false));
 
   nr_map ++;
 }
 
+void add_mmio_bank(const char *name, paddr_t addr, void *space, uint32_t len, const IOReg *regs, int nr_reg) {
+  add_mmio_map(name, addr, space, len, NULL);
+  map_set_regs(&maps[nr_map - 1], regs, nr_reg);
+}
+
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
   return map_read(addr, len, fetch_mmio_map(addr));
@@ -61,3 +75,16 @@ word_t mmio_read(paddr_t addr, int len) {
 void mmio_write(paddr_t addr, int len, word_t data) {
   map_write(addr, len, data, fetch_mmio_map(addr));
 }
+
+/* The range must lie in a single map. For a write, the callback or the
+ * hooks of the map see the whole range at once, before the caller fills
+ * it in; this is enough for hooks which only record what has changed,
+ * such as the one of vmem.
+ */
+uint8_t* mmio_dma_ptr(paddr_t addr, uint32_t len, bool is_write) {
+  IOMap *map = fetch_mmio_map(addr);
+  if (map == NULL || len - 1 > map->high - addr) return NULL;
+  paddr_t offset = addr - map->low;
+  if (is_write) map_invoke(map, offset, len, true);
+  return (uint8_t *)map->space + offset;
+}
@@ -29,10 +29,16 @@ void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_
     .space = space, .callback = callback };
   Log("Add port-io map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
       maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
+  IFDEF(CONFIG_PERF, perf_add_map(&maps[nr_map], true));
 
   nr_map ++;
 }
 
+void add_pio_bank(const char *name, ioaddr_t addr, void *space, uint32_t len, const IOReg *regs, int nr_reg) {
+  add_pio_map(name, addr, space, len, NULL);
+  map_set_regs(&maps[nr_map - 1], regs, nr_reg);
+}
+
 /* CPU interface */
 uint32_t pio_read(ioaddr_t addr, int len) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
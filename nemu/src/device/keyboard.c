@@ -14,12 +14,14 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <cpu/cpu.h>
 #include <utils.h>
 
 #define KEYDOWN_MASK 0x8000
 
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 
 // Note that this is not the standard
 #define _KEYS(f) \
@@ -45,27 +47,121 @@ static void init_keymap() {
   MAP(_KEYS, SDL_KEYMAP)
 }
 
+/* Keys are sent by the thread polling host events, which may not be
+ * the CPU thread (see CONFIG_DISPLAY_THREAD), so the queue is a
+ * single-producer single-consumer ring: each side only writes its own
+ * index, and a key is published by the release store of `key_r'. A key
+ * arriving when the queue is full is dropped.
+ */
 #define KEY_QUEUE_LEN 1024
-static int key_queue[KEY_QUEUE_LEN] = {};
-static int key_f = 0, key_r = 0;
+static uint32_t key_queue[KEY_QUEUE_LEN] = {};
+static _Atomic int key_f = 0, key_r = 0;
 
 static void key_enqueue(uint32_t am_scancode) {
-  key_queue[key_r] = am_scancode;
-  key_r = (key_r + 1) % KEY_QUEUE_LEN;
-  Assert(key_r != key_f, "key queue overflow!");
+  int r = atomic_load_explicit(&key_r, memory_order_relaxed);
+  int next = (r + 1) % KEY_QUEUE_LEN;
+  if (next == atomic_load_explicit(&key_f, memory_order_acquire)) {
+    Log("key queue overflow, key dropped");
+    return;
+  }
+  key_queue[r] = am_scancode;
+  atomic_store_explicit(&key_r, next, memory_order_release);
 }
 
 static uint32_t key_dequeue() {
   uint32_t key = _KEY_NONE;
-  if (key_f != key_r) {
-    key = key_queue[key_f];
-    key_f = (key_f + 1) % KEY_QUEUE_LEN;
+  int f = atomic_load_explicit(&key_f, memory_order_relaxed);
+  if (f != atomic_load_explicit(&key_r, memory_order_acquire)) {
+    key = key_queue[f];
+    atomic_store_explicit(&key_f, (f + 1) % KEY_QUEUE_LEN, memory_order_release);
   }
   return key;
 }
 
+#ifdef CONFIG_KEY_REPLAY
+/* A file of key events has one event per line, as
+ *   <guest instructions> <down|up> <key>
+ * with the names of _KEYS, and lines starting with '#' ignored. A
+ * recorded event is the key read by the guest, with the instructions
+ * before the read. A replayed event is sent when the count is reached,
+ * so the guest reads it at the same instruction as when it was
+ * recorded, and keys of the host are ignored.
+ */
+#define _KEY_STR(k) [concat(_KEY_, k)] = #k,
+static const char *keyname[] = { MAP(_KEYS, _KEY_STR) };
+
+extern uint64_t g_nr_guest_inst;
+static const char *replay_file = NULL, *record_file = NULL;
+static FILE *replay_fp = NULL, *record_fp = NULL;
+static uint64_t replay_at = 0;
+static uint32_t replay_key = _KEY_NONE;
+static int replay_line = 0;
+
+void keyboard_set_replay(const char *file) { replay_file = file; }
+void keyboard_set_record(const char *file) { record_file = file; }
+
+// read the next event into replay_at and replay_key, or close the file at its end
+static void replay_next() {
+  char line[128], dir[8], name[32];
+  while (fgets(line, sizeof(line), replay_fp)) {
+    replay_line ++;
+    if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') continue;
+    Assert(sscanf(line, "%" SCNu64 " %7s %31s", &replay_at, dir, name) == 3 &&
+        (!strcmp(dir, "down") || !strcmp(dir, "up")),
+        "%s:%d: bad key event", replay_file, replay_line);
+    int k;
+    for (k = 1; k < ARRLEN(keyname); k ++) {
+      if (!strcmp(name, keyname[k])) break;
+    }
+    Assert(k < ARRLEN(keyname), "%s:%d: unknown key %s", replay_file, replay_line, name);
+    replay_key = k | (dir[0] == 'd' ? KEYDOWN_MASK : 0);
+    return;
+  }
+  fclose(replay_fp);
+  replay_fp = NULL;
+  Log("All key events in %s are replayed", replay_file);
+}
+
+void keyboard_update() {
+  if (replay_fp == NULL) return;
+  while (replay_fp != NULL && replay_at <= g_nr_guest_inst) {
+    key_enqueue(replay_key);
+    replay_next();
+  }
+  if (replay_fp != NULL) cpu_schedule_event(replay_at);
+}
+
+static void record_key(uint32_t key) {
+  if (record_fp == NULL || key == _KEY_NONE) return;
+  fprintf(record_fp, "%" PRIu64 " %s %s\n", g_nr_guest_inst,
+      (key & KEYDOWN_MASK ? "down" : "up"), keyname[key & ~KEYDOWN_MASK]);
+}
+
+static void finish_record() {
+  fclose(record_fp);
+}
+
+static void init_key_replay() {
+  if (replay_file != NULL) {
+    replay_fp = fopen(replay_file, "r");
+    Assert(replay_fp, "Can not open '%s'", replay_file);
+    replay_next();
+    Log("Key events are replayed from %s", replay_file);
+  }
+  if (record_file != NULL) {
+    record_fp = fopen(record_file, "w");
+    Assert(record_fp, "Can not open '%s'", record_file);
+    fprintf(record_fp, "# <guest instructions> <down|up> <key>\n");
+    atexit(finish_record);
+    Log("Key events are recorded to %s", record_file);
+  }
+}
+#endif
+
 void send_key(uint8_t scancode, bool is_keydown) {
-  if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != _KEY_NONE) {
+  if (MUXDEF(CONFIG_KEY_REPLAY, replay_file != NULL, false)) return;
+  // with CONFIG_DISPLAY_THREAD, this runs on the display thread
+  if (__atomic_load_n(&nemu_state.state, __ATOMIC_ACQUIRE) == NEMU_RUNNING && keymap[scancode] != _KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
     key_enqueue(am_scancode);
   }
@@ -86,15 +182,21 @@ static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
   assert(!is_write);
   assert(offset == 0);
   i8042_data_port_base[0] = key_dequeue();
+  IFDEF(CONFIG_KEY_REPLAY, record_key(i8042_data_port_base[0]));
 }
 
+static const IOReg i8042_data_regs[] = {
+  { 0, 4, IO_HOOK_R, i8042_data_io_handler },
+};
+
 void init_i8042() {
   i8042_data_port_base = (uint32_t *)new_space(4);
   i8042_data_port_base[0] = _KEY_NONE;
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("keyboard", CONFIG_I8042_DATA_PORT, i8042_data_port_base, 4, i8042_data_io_handler);
+  add_pio_bank ("keyboard", CONFIG_I8042_DATA_PORT, i8042_data_port_base, 4, i8042_data_regs, ARRLEN(i8042_data_regs));
 #else
-  add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
+  add_mmio_bank("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_regs, ARRLEN(i8042_data_regs));
 #endif
   IFNDEF(CONFIG_TARGET_AM, init_keymap());
+  IFDEF(CONFIG_KEY_REPLAY, init_key_replay());
 }
@@ -0,0 +1,340 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <utils.h>
+#include <device/map.h>
+#include <device/intr.h>
+#include <memory/paddr.h>
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+
+/* A network card in the style of virtio-net. The guest keeps a TX ring
+ * and an RX ring of descriptors in its memory, each descriptor holding
+ * one Ethernet frame, and posts them by writing the number of
+ * descriptors ever posted to reg_tx_avail or reg_rx_avail. Frames move
+ * between the buffers of the guest and the host without a copy in
+ * NEMU: a TX frame is written to the host when it is posted, and a
+ * reader thread reads the next frame from the host straight into the
+ * next posted RX buffer. The CPU thread resolves an RX descriptor when
+ * it is posted, so the reader thread never touches the registers or the
+ * devices; the rings and the RX buffers must be in pmem. The
+ * descriptor of a received frame is only written, and reg_rx_used
+ * bumped, by the CPU thread in net_update(), so that DiffTest can be
+ * told about the frame at that point.
+ *
+ * The host side is a TAP device, or else a SOCK_SEQPACKET socket at
+ * CONFIG_NET_SOCKET_PATH, which keeps frame boundaries and accepts one
+ * peer at a time. Without a peer, the link is down and TX frames fail;
+ * they also fail when the peer is not keeping up.
+ *
+ * Completions are coalesced: reg_isr gets the bits of the directions
+ * with new completions once reg_coal_frames of them are pending, or
+ * the oldest has waited reg_coal_usec. With the bit set in reg_irq,
+ * this raises the external interrupt until the bit is written to
+ * reg_isr.
+ */
+
+enum {
+  reg_mac_lo,     // read only
+  reg_mac_hi,     // read only
+  reg_link,       // 1 if there is a peer, read only
+  reg_ring_size,  // number of descriptors of each ring, a power of 2
+  reg_tx_ring,    // physical address of the descriptors
+  reg_tx_avail,   // descriptors ever posted
+  reg_tx_used,    // frames ever sent, read only
+  reg_rx_ring,
+  reg_rx_avail,
+  reg_rx_used,    // frames ever received, read only
+  reg_irq,
+  reg_isr,        // a write clears the bits written
+  reg_coal_frames,
+  reg_coal_usec,
+  nr_reg
+};
+
+enum { NET_IRQ_TX = 1, NET_IRQ_RX = 2 };
+enum { NET_PENDING, NET_OK, NET_IOERR };
+
+typedef struct {
+  uint32_t buf;     // physical address
+  uint32_t len;     // of the frame to send, or of the buffer and then of the frame received
+  uint32_t status;  // written by the device when the frame is done
+  uint32_t pad;
+} NetDesc;
+
+#define MAX_RING_SIZE 256
+
+// an RX descriptor posted by the guest, with NULL pointers if it is bad
+typedef struct {
+  NetDesc *desc;
+  paddr_t desc_addr;
+  uint8_t *buf;
+  paddr_t buf_addr;
+  uint32_t len;
+} RxSlot;
+
+static uint32_t *net_base = NULL;
+static bool is_tap = false;
+static int listen_fd = -1;
+static _Atomic int peer_fd = -1;
+static SDL_mutex *peer_lock = NULL; // a TX frame is not sent to a closing peer
+static uint32_t last_tx_avail = 0;
+static _Atomic uint32_t rx_avail = 0;
+static RxSlot rx_slot[MAX_RING_SIZE];
+static SDL_sem *rx_kick = NULL;
+
+// frames read by the reader thread, and their lengths, or -1 after an error
+static _Atomic uint32_t rx_done = 0;
+static int32_t rx_len[MAX_RING_SIZE];
+static uint32_t rx_used = 0;
+
+// completions not yet reported in reg_isr, and since when
+static uint32_t isr = 0;
+static uint32_t tx_pending = 0, rx_reported = 0;
+static uint64_t pending_since = 0;
+
+static void *pmem_ptr(paddr_t addr, uint64_t len) {
+  if (!in_pmem(addr) || (len > 0 && !in_pmem(addr + len - 1))) return NULL;
+  return guest_to_host(addr);
+}
+
+static NetDesc *ring(uint32_t addr) {
+  uint32_t size = net_base[reg_ring_size];
+  if (size == 0 || size > MAX_RING_SIZE || (size & (size - 1)) != 0) return NULL;
+  return (NetDesc *)pmem_ptr(addr, size * sizeof(NetDesc));
+}
+
+// on the CPU thread only
+static void complete(NetDesc *d, paddr_t desc_addr, uint32_t s) {
+  d->status = s;
+  paddr_dma_sync(desc_addr, sizeof(NetDesc));
+}
+
+static void send_frames() {
+  uint32_t ring_addr = net_base[reg_tx_ring];
+  NetDesc *r = ring(ring_addr);
+  if (r == NULL) {
+    Log("net: bad TX ring");
+    return;
+  }
+  uint32_t size = net_base[reg_ring_size];
+  for (; last_tx_avail != net_base[reg_tx_avail]; last_tx_avail ++) {
+    uint32_t i = last_tx_avail % size;
+    NetDesc *d = &r[i];
+    uint8_t *p = paddr_dma_ptr(d->buf, d->len, false);
+    ssize_t n = -1;
+    // this runs in the MMIO write, so a peer which is not reading must not stall the CPU
+    SDL_LockMutex(peer_lock);
+    int fd = atomic_load(&peer_fd);
+    if (p != NULL && fd >= 0) {
+      n = (is_tap ? write(fd, p, d->len) : send(fd, p, d->len, MSG_NOSIGNAL | MSG_DONTWAIT));
+    }
+    SDL_UnlockMutex(peer_lock);
+    complete(d, ring_addr + i * sizeof(NetDesc), n == d->len ? NET_OK : NET_IOERR);
+    net_base[reg_tx_used] ++;
+    tx_pending ++;
+  }
+}
+
+// wait for a peer on the socket; a TAP device is always there
+static int connect_peer() {
+  int fd = atomic_load(&peer_fd);
+  if (fd >= 0) return fd;
+  fd = accept(listen_fd, NULL, NULL);
+  if (fd >= 0) {
+    atomic_store(&peer_fd, fd);
+    Log("net: peer connected");
+  }
+  return fd;
+}
+
+static void drop_peer(int fd) {
+  if (is_tap) return;
+  SDL_LockMutex(peer_lock);
+  atomic_store(&peer_fd, -1);
+  close(fd);
+  SDL_UnlockMutex(peer_lock);
+  Log("net: peer disconnected");
+}
+
+static int rx_thread(void *arg) {
+  uint32_t next = 0;
+  while (true) {
+    while (next == atomic_load_explicit(&rx_avail, memory_order_acquire)) SDL_SemWait(rx_kick);
+    RxSlot *slot = &rx_slot[next % MAX_RING_SIZE];
+    ssize_t n = -1;
+    if (slot->buf != NULL) {
+      int fd = connect_peer();
+      if (fd < 0) continue;
+      n = read(fd, slot->buf, slot->len);
+      if (n == 0) { drop_peer(fd); continue; }
+      if (n < 0) {
+        if (!is_tap) drop_peer(fd);
+        continue;
+      }
+    }
+    rx_len[next % MAX_RING_SIZE] = n;
+    atomic_store_explicit(&rx_done, ++ next, memory_order_release);
+  }
+  return 0;
+}
+
+// resolve the newly posted RX descriptors for the reader thread
+static void post_rx() {
+  uint32_t ring_addr = net_base[reg_rx_ring];
+  NetDesc *r = ring(ring_addr);
+  if (r == NULL) Log("net: bad RX ring");
+  uint32_t avail = atomic_load_explicit(&rx_avail, memory_order_relaxed);
+  for (; avail != net_base[reg_rx_avail]; avail ++) {
+    if (avail - rx_used == MAX_RING_SIZE) {
+      Log("net: more RX descriptors posted than the ring holds");
+      break;
+    }
+    RxSlot *slot = &rx_slot[avail % MAX_RING_SIZE];
+    *slot = (RxSlot){ 0 };
+    if (r == NULL) continue;
+    uint32_t i = avail % net_base[reg_ring_size];
+    slot->desc = &r[i];
+    slot->desc_addr = ring_addr + i * sizeof(NetDesc);
+    slot->len = r[i].len;
+    slot->buf_addr = r[i].buf;
+    slot->buf = pmem_ptr(slot->buf_addr, slot->len);
+  }
+  atomic_store_explicit(&rx_avail, avail, memory_order_release);
+  if (rx_kick) SDL_SemPost(rx_kick);
+}
+
+static void net_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / 4) {
+    case reg_link: net_base[reg_link] = (atomic_load(&peer_fd) >= 0); break;
+    case reg_tx_avail: if (is_write) send_frames(); break;
+    case reg_rx_avail: if (is_write) post_rx(); break;
+    case reg_isr:
+      if (is_write) isr &= ~net_base[reg_isr];
+      net_base[reg_isr] = isr;
+      dev_set_ext_irq(EXT_IRQ_NET, (isr & net_base[reg_irq]) != 0);
+      break;
+  }
+}
+
+// complete the frames read by the reader thread
+static void receive_frames() {
+  uint32_t done = atomic_load_explicit(&rx_done, memory_order_acquire);
+  for (; rx_used != done; rx_used ++) {
+    int32_t n = rx_len[rx_used % MAX_RING_SIZE];
+    RxSlot *slot = &rx_slot[rx_used % MAX_RING_SIZE];
+    if (slot->desc == NULL) continue;
+    if (n > 0) paddr_dma_sync(slot->buf_addr, n);
+    slot->desc->len = (n < 0 ? 0 : n);
+    complete(slot->desc, slot->desc_addr, n < 0 ? NET_IOERR : NET_OK);
+  }
+  net_base[reg_rx_used] = rx_used;
+}
+
+void net_update() {
+  receive_frames();
+  uint32_t rx = rx_used;
+  uint32_t pending = tx_pending + (rx - rx_reported);
+  if (pending == 0) return;
+  uint64_t now = get_time();
+  if (pending_since == 0) pending_since = now;
+  if (pending < net_base[reg_coal_frames] && now - pending_since < net_base[reg_coal_usec]) return;
+  isr |= (tx_pending ? NET_IRQ_TX : 0) | (rx != rx_reported ? NET_IRQ_RX : 0);
+  tx_pending = 0;
+  rx_reported = rx;
+  pending_since = 0;
+  net_base[reg_isr] = isr;
+  dev_set_ext_irq(EXT_IRQ_NET, (isr & net_base[reg_irq]) != 0);
+}
+
+static int open_tap(const char *name) {
+  int fd = open("/dev/net/tun", O_RDWR);
+  if (fd < 0) return -1;
+  struct ifreq ifr = {};
+  ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+  strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+  if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int open_socket(const char *path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (fd < 0) return -1;
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static const IOReg net_regs[] = {
+  { reg_link * 4, 4, IO_HOOK_R, net_io_handler },
+  { reg_tx_avail * 4, 4, IO_HOOK_W, net_io_handler },
+  { reg_rx_avail * 4, 4, IO_HOOK_W, net_io_handler },
+  { reg_isr * 4, 4, IO_HOOK_R | IO_HOOK_W, net_io_handler },
+};
+
+void init_net() {
+  net_base = (uint32_t *)new_space(nr_reg * 4);
+  memset(net_base, 0, nr_reg * 4);
+  net_base[reg_mac_lo] = 0x12005452; // 52:54:00:12:34:56
+  net_base[reg_mac_hi] = 0x5634;
+  net_base[reg_coal_frames] = 8;
+  net_base[reg_coal_usec] = 50;
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_bank ("net", CONFIG_NET_CTL_PORT, net_base, nr_reg * 4, net_regs, ARRLEN(net_regs));
+#else
+  add_mmio_bank("net", CONFIG_NET_CTL_MMIO, net_base, nr_reg * 4, net_regs, ARRLEN(net_regs));
+#endif
+
+  const char *tap = CONFIG_NET_TAP, *path = CONFIG_NET_SOCKET_PATH;
+  if (tap[0] != '\0') {
+    int fd = open_tap(tap);
+    if (fd < 0) {
+      Log("Can not open TAP device %s", tap);
+      return;
+    }
+    is_tap = true;
+    atomic_store(&peer_fd, fd);
+    Log("Network card on TAP device %s", tap);
+  } else if (path[0] != '\0') {
+    listen_fd = open_socket(path);
+    if (listen_fd < 0) {
+      Log("Can not listen on %s", path);
+      return;
+    }
+    Log("Network card waits for a peer on %s", path);
+  } else return;
+
+  rx_kick = SDL_CreateSemaphore(0);
+  peer_lock = SDL_CreateMutex();
+  SDL_Thread *t = SDL_CreateThread(rx_thread, "net-rx", NULL);
+  Assert(rx_kick && peer_lock && t, "cannot start the network card: %s", SDL_GetError());
+  SDL_DetachThread(t);
+}
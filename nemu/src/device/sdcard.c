@@ -14,6 +14,10 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -31,28 +35,77 @@
 // No DMA and IRQ is supported, so the driver must be modified to start PIO
 // right after sending the actual read/write commands.
 
+/* Besides the word-sized SDDATA, a transfer can go through the 512-byte
+ * FIFO window at SDBUF_OFFSET: it holds the current block of a read, or
+ * collects the current block of a write. Writing SDFIFO moves on to the
+ * next block, so a driver can copy whole blocks with bursts or the DMA
+ * engine.
+ */
+#define SD_BLKSZ 512
+#define SDBUF_OFFSET 0x200
+#define SD_SPACE_SIZE (SDBUF_OFFSET + SD_BLKSZ)
+
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
   SDRSP0, SDRSP1, SDRSP2, SDRSP3,
   SDHSTS, __PAD0, __PAD1, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
   SDDATA, __PAD10, __PAD11, __PAD12,
-  SDHBLC
+  SDHBLC, __PAD20, __PAD21, __PAD22,
+  SDFIFO
 };
 
-static FILE *fp = NULL;
+/* The whole card is mapped over the image, so data never goes through
+ * stdio. The image may be shorter than the card: blocks past its end
+ * read as zeros, and a write there grows the (sparse) image first.
+ */
+static uint8_t *card = NULL;
+static uint64_t card_size = 0;
+static int card_fd = -1;
 static uint32_t *base = NULL;
+static uint8_t *fifo = NULL;
 static uint32_t blkcnt = 0;
 static long blk_addr = 0;
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
 
+// the byte of the card at the current position, or NULL if it is outside
+static uint8_t *card_ptr(int len, bool is_write) {
+  uint64_t pos = ((uint64_t)blk_addr << 9) + addr;
+  if (card == NULL) return NULL;
+  if (pos + len > card_size) {
+    if (!is_write) return NULL;
+    uint64_t size = ROUNDUP(pos + len, SD_BLKSZ);
+    if (size > MEMORY_SIZE || ftruncate(card_fd, size) != 0) {
+      Log("sdcard: write of %d bytes at %#" PRIx64 " is dropped", len, pos);
+      return NULL;
+    }
+    card_size = size;
+  }
+  return card + pos;
+}
+
+static void fifo_load() {
+  uint8_t *p = card_ptr(SD_BLKSZ, false);
+  if (p) memcpy(fifo, p, SD_BLKSZ);
+  else memset(fifo, 0, SD_BLKSZ);
+}
+
+static void fifo_next() {
+  if (write_cmd) {
+    uint8_t *p = card_ptr(SD_BLKSZ, true);
+    if (p) memcpy(p, fifo, SD_BLKSZ);
+  }
+  addr += SD_BLKSZ;
+  if (!write_cmd) fifo_load();
+}
+
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
+  if (!is_write) fifo_load();
 }
 
 static void sdcard_handle_cmd(int cmd) {
@@ -89,15 +142,8 @@ static void sdcard_handle_cmd(int cmd) {
 }
 
 static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
-  int idx = offset / 4;
-  switch (idx) {
+  switch (offset / 4) {
     case SDCMD: sdcard_handle_cmd(base[SDCMD] & 0x3f); break;
-    case SDARG:
-    case SDRSP0:
-    case SDRSP1:
-    case SDRSP2:
-    case SDRSP3:
-      break;
     case SDDATA:
        if (read_ext_csd) {
          // See section 8.1 JEDEC Standard JED84-A441
@@ -109,26 +155,48 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else {
+         if (!write_cmd) {
+           uint8_t *p = card_ptr(4, false);
+           if (p) memcpy(&base[SDDATA], p, 4); else base[SDDATA] = 0;
+         } else if (is_write) {
+           uint8_t *p = card_ptr(4, true);
+           if (p) memcpy(p, &base[SDDATA], 4);
+         }
        }
        addr += 4;
        break;
-    default:
-      Log("offset = 0x%x(idx = %d), is_write = %d, data = 0x%x", offset, idx, is_write, base[idx]);
-      panic("unhandle offset = %d", offset);
+    case SDFIFO: fifo_next(); break;
   }
 }
 
+// the other registers and the FIFO window are plain storage
+static const IOReg sdcard_regs[] = {
+  { SDCMD * 4, 4, IO_HOOK_W, sdcard_io_handler },
+  { SDDATA * 4, 4, IO_HOOK_R | IO_HOOK_W, sdcard_io_handler },
+  { SDFIFO * 4, 4, IO_HOOK_W, sdcard_io_handler },
+};
+
 void init_sdcard() {
-  base = (uint32_t *)new_space(0x80);
-  add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
+  base = (uint32_t *)new_space(SD_SPACE_SIZE);
+  fifo = (uint8_t *)base + SDBUF_OFFSET;
+  add_mmio_bank("sdhci", CONFIG_SDCARD_CTL_MMIO, base, SD_SPACE_SIZE, sdcard_regs, ARRLEN(sdcard_regs));
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
   const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  int fd = open(img, O_RDWR);
+  if (fd < 0) {
+    Log("Can not find sdcard image: %s", img);
+    return;
+  }
+
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "can not stat sdcard image %s", img);
+  // only the part within the image is ever touched, the rest is address space
+  void *p = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+  Assert(p != MAP_FAILED, "can not map sdcard image %s", img);
+  card = p;
+  card_size = (st.st_size < MEMORY_SIZE ? st.st_size : MEMORY_SIZE);
+  card_fd = fd;
 }
@@ -15,37 +15,219 @@
 
 #include <utils.h>
 #include <device/map.h>
+#include <device/intr.h>
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 // NOTE: this is compatible to 16550
 
 #define CH_OFFSET 0
+#define IER_OFFSET 1
+#define IIR_OFFSET 2
+#define LCR_OFFSET 3
+#define LSR_OFFSET 5
+
+#define IER_RX    0x01  // interrupt when data is received
+#define IIR_NONE  0x01
+#define IIR_RX    0x04
+#define LCR_DLAB  0x80  // offsets 0 and 1 are the divisor latch
+#define LSR_DR    0x01  // data ready
+#define LSR_THRE  0x20  // the transmitter can take a byte
+#define LSR_TEMT  0x40  // the transmitter is empty
 
 static uint8_t *serial_base = NULL;
 
+#ifndef CONFIG_TARGET_AM
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Both directions go through a single-producer single-consumer ring
+ * with free-running indices. The output of the guest is written to the
+ * host stderr by a writer thread, which is woken up by a newline or
+ * when TX_KICK bytes are pending, and otherwise flushes every
+ * TX_FLUSH_MS. Input is read by a reader thread, so that the guest
+ * only polls LSR, or waits for the interrupt.
+ */
+#define TX_SIZE 65536
+#define TX_KICK 4096
+#define TX_FLUSH_MS 10
+#define RX_SIZE 4096
+
+static char tx_buf[TX_SIZE];
+static _Atomic uint32_t tx_head = 0, tx_tail = 0;
+static _Atomic bool tx_stop = false;
+static SDL_sem *tx_kick = NULL;
+static SDL_Thread *tx_writer = NULL;
+
+static char rx_buf[RX_SIZE];
+static _Atomic uint32_t rx_head = 0, rx_tail = 0;
+static bool rx_stdin = false;
+
+void serial_set_stdin_input() {
+  rx_stdin = true;
+}
+
+static uint32_t tx_pending() {
+  return atomic_load_explicit(&tx_tail, memory_order_acquire) -
+    atomic_load_explicit(&tx_head, memory_order_acquire);
+}
+
+static void tx_drain() {
+  uint32_t head = atomic_load_explicit(&tx_head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&tx_tail, memory_order_acquire);
+  while (head != tail) {
+    uint32_t off = head % TX_SIZE;
+    uint32_t n = tail - head < TX_SIZE - off ? tail - head : TX_SIZE - off;
+    ssize_t ret = write(STDERR_FILENO, tx_buf + off, n);
+    if (ret < 0 && (errno == EINTR || errno == EAGAIN)) {
+      if (errno == EAGAIN) SDL_Delay(1); // stderr is non-blocking and full
+      continue;
+    }
+    if (ret <= 0) ret = n; // nowhere to write, drop them
+    head += ret;
+    atomic_store_explicit(&tx_head, head, memory_order_release);
+  }
+}
+
+static int tx_writer_thread(void *arg) {
+  while (!atomic_load(&tx_stop)) {
+    SDL_SemWaitTimeout(tx_kick, TX_FLUSH_MS);
+    tx_drain();
+  }
+  tx_drain();
+  return 0;
+}
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+  uint32_t tail = atomic_load_explicit(&tx_tail, memory_order_relaxed);
+  while (tail - atomic_load_explicit(&tx_head, memory_order_acquire) == TX_SIZE) {
+    // the writer is behind, wait for it instead of losing output
+    SDL_SemPost(tx_kick);
+    SDL_Delay(1);
+  }
+  tx_buf[tail % TX_SIZE] = ch;
+  atomic_store_explicit(&tx_tail, tail + 1, memory_order_release);
+  if (ch == '\n' || tx_pending() == TX_KICK) SDL_SemPost(tx_kick);
+}
+
+// write what is still pending when NEMU exits, or aborts without running atexit()
+void serial_flush() {
+  if (tx_writer == NULL) return;
+  atomic_store(&tx_stop, true);
+  SDL_SemPost(tx_kick);
+  SDL_WaitThread(tx_writer, NULL);
+  tx_writer = NULL;
+}
+
+static int rx_reader_thread(void *arg) {
+  int fd = (intptr_t)arg;
+  char buf[256];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    ssize_t i;
+    for (i = 0; i < n; i ++) {
+      uint32_t tail = atomic_load_explicit(&rx_tail, memory_order_relaxed);
+      while (tail - atomic_load_explicit(&rx_head, memory_order_acquire) == RX_SIZE) {
+        SDL_Delay(1); // the guest is not reading, hold the input back
+      }
+      rx_buf[tail % RX_SIZE] = buf[i];
+      atomic_store_explicit(&rx_tail, tail + 1, memory_order_release);
+    }
+  }
+  return 0;
+}
+
+static bool rx_ready() {
+  return atomic_load_explicit(&rx_head, memory_order_relaxed) !=
+    atomic_load_explicit(&rx_tail, memory_order_acquire);
+}
+
+static uint8_t serial_getc() {
+  if (!rx_ready()) return 0;
+  uint32_t head = atomic_load_explicit(&rx_head, memory_order_relaxed);
+  uint8_t ch = rx_buf[head % RX_SIZE];
+  atomic_store_explicit(&rx_head, head + 1, memory_order_release);
+  return ch;
+}
+
+static uint8_t serial_lsr() {
+  uint32_t n = tx_pending();
+  return (rx_ready() ? LSR_DR : 0) | (n < TX_SIZE ? LSR_THRE : 0) | (n == 0 ? LSR_TEMT : 0);
+}
+
+static void init_serial_host() {
+  tx_kick = SDL_CreateSemaphore(0);
+  tx_writer = SDL_CreateThread(tx_writer_thread, "serial-tx", NULL);
+  Assert(tx_kick && tx_writer, "cannot start the writer of serial: %s", SDL_GetError());
+  atexit(serial_flush);
+
+  int fd = -1;
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+  const char *fifo = "/tmp/nemu.serial";
+  if (mkfifo(fifo, 0666) != 0 && errno != EEXIST) Log("Can not create %s", fifo);
+  // O_RDWR keeps the FIFO open when writers come and go
+  fd = open(fifo, O_RDWR);
+  if (fd < 0) Log("Can not open %s", fifo);
+  else Log("Input of serial is read from %s", fifo);
+#endif
+  if (fd < 0 && rx_stdin) fd = STDIN_FILENO;
+  if (fd < 0) return;
+  SDL_Thread *reader = SDL_CreateThread(rx_reader_thread, "serial-rx", (void *)(intptr_t)fd);
+  Assert(reader, "cannot start the reader of serial: %s", SDL_GetError());
+  SDL_DetachThread(reader); // it may be blocked in read() until NEMU exits
+}
+#else
+static void serial_putc(char ch) { putch(ch); }
+static bool rx_ready() { return false; }
+static uint8_t serial_getc() { return 0; }
+static uint8_t serial_lsr() { return LSR_THRE | LSR_TEMT; }
+void serial_flush() {}
+#endif
+
+static bool serial_irq() {
+  return (serial_base[IER_OFFSET] & IER_RX) && rx_ready();
+}
+
+void serial_update() {
+  dev_set_ext_irq(EXT_IRQ_SERIAL, serial_irq());
 }
 
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
   assert(len == 1);
+  bool dlab = serial_base[LCR_OFFSET] & LCR_DLAB;
   switch (offset) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
+      if (dlab) break;
       if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      else {
+        serial_base[0] = serial_getc();
+        serial_update(); // the interrupt goes away with the last byte
+      }
       break;
-    default: panic("do not support offset = %d", offset);
+    case IER_OFFSET: if (is_write && !dlab) serial_update(); break;
+    case IIR_OFFSET: if (!is_write) serial_base[IIR_OFFSET] = serial_irq() ? IIR_RX : IIR_NONE; break;
+    case LSR_OFFSET: if (!is_write) serial_base[LSR_OFFSET] = serial_lsr(); break;
+    default: break; // LCR, MCR, MSR and SCR only keep what is written
   }
 }
 
+static const IOReg serial_regs[] = {
+  { CH_OFFSET, 1, IO_HOOK_R | IO_HOOK_W, serial_io_handler },
+  { IER_OFFSET, 1, IO_HOOK_W, serial_io_handler },
+  { IIR_OFFSET, 1, IO_HOOK_R, serial_io_handler },
+  { LSR_OFFSET, 1, IO_HOOK_R, serial_io_handler },
+};
+
 void init_serial() {
   serial_base = new_space(8);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("serial", CONFIG_SERIAL_PORT, serial_base, 8, serial_io_handler);
+  add_pio_bank ("serial", CONFIG_SERIAL_PORT, serial_base, 8, serial_regs, ARRLEN(serial_regs));
 #else
-  add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
+  add_mmio_bank("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_regs, ARRLEN(serial_regs));
 #endif
-
+  IFNDEF(CONFIG_TARGET_AM, init_serial_host());
 }
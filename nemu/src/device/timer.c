@@ -14,7 +14,6 @@
 ***************************************************************************************/
 
 #include <device/map.h>
-#include <device/alarm.h>
 #include <utils.h>
 
 static uint32_t *rtc_port_base = NULL;
@@ -28,21 +27,15 @@ static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
   }
 }
 
-#ifndef CONFIG_TARGET_AM
-static void timer_intr() {
-  if (nemu_state.state == NEMU_RUNNING) {
-    extern void dev_raise_intr();
-    dev_raise_intr();
-  }
-}
-#endif
+static const IOReg rtc_regs[] = {
+  { 4, 4, IO_HOOK_R, rtc_io_handler },
+};
 
 void init_timer() {
   rtc_port_base = (uint32_t *)new_space(8);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("rtc", CONFIG_RTC_PORT, rtc_port_base, 8, rtc_io_handler);
+  add_pio_bank ("rtc", CONFIG_RTC_PORT, rtc_port_base, 8, rtc_regs, ARRLEN(rtc_regs));
 #else
-  add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
+  add_mmio_bank("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_regs, ARRLEN(rtc_regs));
 #endif
-  IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
 }
@@ -0,0 +1,146 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <SDL2/SDL.h>
+
+/* Frames are copied into a small ring of slots on the CPU thread and
+ * encoded by a worker thread, so the guest only pays for the copy. The
+ * CPU thread waits for a free slot instead of dropping frames, which
+ * keeps the dump complete for regression tests.
+ */
+#define NR_SLOT 8
+
+static const char *dump_file = NULL;
+static FILE *fp = NULL;
+static bool is_ppm = false;
+static int width = 0, height = 0;
+static uint32_t *slot[NR_SLOT];
+static uint8_t *line = NULL;  // one encoded row of the worker
+static int slot_w = 0, slot_r = 0;
+static SDL_sem *nr_free = NULL, *nr_full = NULL;
+static SDL_Thread *worker = NULL;
+static uint64_t nr_frame = 0; // frames written by the worker
+
+// the name of a PPM file is made by snprintf() with `file' as the format, so it must take a single %d
+static bool is_ppm_pattern(const char *file) {
+  const char *p = strchr(file, '%');
+  if (p == NULL) return false;
+  for (p ++; *p >= '0' && *p <= '9'; p ++);
+  return *p == 'd' && strchr(p, '%') == NULL;
+}
+
+void vga_set_dump_file(const char *file) {
+  Assert(strchr(file, '%') == NULL || is_ppm_pattern(file),
+      "'%s' must have a single %%d pattern, such as frame%%05d.ppm", file);
+  dump_file = file;
+}
+
+// BT.601 with studio swing, as expected by most YUV4MPEG2 readers
+static inline uint8_t rgb2y(int r, int g, int b) { return 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8); }
+static inline uint8_t rgb2u(int r, int g, int b) { return 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8); }
+static inline uint8_t rgb2v(int r, int g, int b) { return 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8); }
+
+static void write_ppm(const uint32_t *pixels) {
+  char name[256];
+  snprintf(name, sizeof(name), dump_file, (int)nr_frame);
+  FILE *f = fopen(name, "wb");
+  Assert(f, "Can not open '%s'", name);
+  fprintf(f, "P6\n%d %d\n255\n", width, height);
+  int x, y;
+  for (y = 0; y < height; y ++) {
+    const uint32_t *p = pixels + y * width;
+    for (x = 0; x < width; x ++) {
+      line[x * 3 + 0] = p[x] >> 16;
+      line[x * 3 + 1] = p[x] >> 8;
+      line[x * 3 + 2] = p[x];
+    }
+    fwrite(line, 3, width, f);
+  }
+  fclose(f);
+}
+
+static void write_y4m(const uint32_t *pixels) {
+  fputs("FRAME\n", fp);
+  int plane, x, y;
+  for (plane = 0; plane < 3; plane ++) {
+    for (y = 0; y < height; y ++) {
+      const uint32_t *p = pixels + y * width;
+      for (x = 0; x < width; x ++) {
+        int r = (p[x] >> 16) & 0xff, g = (p[x] >> 8) & 0xff, b = p[x] & 0xff;
+        line[x] = (plane == 0 ? rgb2y(r, g, b) : plane == 1 ? rgb2u(r, g, b) : rgb2v(r, g, b));
+      }
+      fwrite(line, 1, width, fp);
+    }
+  }
+}
+
+static int dump_worker(void *arg) {
+  while (true) {
+    SDL_SemWait(nr_full);
+    uint32_t *pixels = slot[slot_r];
+    if (pixels == NULL) break; // posted by finish_dump()
+    if (is_ppm) write_ppm(pixels);
+    else write_y4m(pixels);
+    nr_frame ++;
+    slot_r = (slot_r + 1) % NR_SLOT;
+    SDL_SemPost(nr_free);
+  }
+  return 0;
+}
+
+void vga_dump_frame(const void *pixels) {
+  if (dump_file == NULL) return;
+  SDL_SemWait(nr_free);
+  memcpy(slot[slot_w], pixels, width * height * sizeof(uint32_t));
+  slot_w = (slot_w + 1) % NR_SLOT;
+  SDL_SemPost(nr_full);
+}
+
+// wait for the frames still in the ring when NEMU exits
+static void finish_dump() {
+  SDL_SemWait(nr_free);
+  free(slot[slot_w]);
+  slot[slot_w] = NULL;
+  SDL_SemPost(nr_full);
+  SDL_WaitThread(worker, NULL);
+  if (fp) fclose(fp);
+  Log("%" PRIu64 " frames of VGA dumped to %s", nr_frame, dump_file);
+}
+
+void init_vga_dump(int w, int h) {
+  if (dump_file == NULL) return;
+  width = w;
+  height = h;
+  is_ppm = (strchr(dump_file, '%') != NULL);
+  if (!is_ppm) {
+    fp = fopen(dump_file, "wb");
+    Assert(fp, "Can not open '%s'", dump_file);
+    fprintf(fp, "YUV4MPEG2 W%d H%d F60:%d Ip A1:1 C444\n", w, h, CONFIG_VGA_DUMP_INTERVAL);
+  }
+  int i;
+  for (i = 0; i < NR_SLOT; i ++) {
+    slot[i] = malloc(w * h * sizeof(uint32_t));
+    assert(slot[i]);
+  }
+  line = malloc(w * 3);
+  assert(line);
+  nr_free = SDL_CreateSemaphore(NR_SLOT);
+  nr_full = SDL_CreateSemaphore(0);
+  worker = SDL_CreateThread(dump_worker, "vga-dump", NULL);
+  Assert(nr_free && nr_full && worker, "cannot start the dump of VGA: %s", SDL_GetError());
+  atexit(finish_dump);
+  Log("Frames of VGA are dumped to %s as %s", dump_file, is_ppm ? "PPM files" : "YUV4MPEG2");
+}
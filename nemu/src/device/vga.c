@@ -35,6 +35,23 @@ static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
 #ifdef CONFIG_VGA_SHOW_SCREEN
+/* Writes to vmem mark the scanlines they touch, and a sync uploads
+ * only the runs of dirty scanlines. A sync after which nothing has
+ * changed presents nothing, so the cost follows what the guest draws
+ * instead of the size of the screen.
+ */
+static uint8_t *dirty = NULL; // one flag per scanline
+static uint32_t dirty_lo = UINT32_MAX, dirty_hi = 0; // bounds of the dirty scanlines, empty if lo > hi
+static uint32_t pitch = 0;
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  uint32_t y0 = offset / pitch, y1 = (offset + len - 1) / pitch;
+  uint32_t y;
+  for (y = y0; y <= y1; y ++) dirty[y] = 1;
+  if (y0 < dirty_lo) dirty_lo = y0;
+  if (y1 > dirty_hi) dirty_hi = y1;
+}
+
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 
@@ -55,8 +72,12 @@ static void init_screen() {
       SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static inline void upload_rows(const uint32_t *pixels, uint32_t y, uint32_t h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  SDL_UpdateTexture(texture, &rect, pixels + y * SCREEN_W, SCREEN_W * sizeof(uint32_t));
+}
+
+static inline void present() {
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -64,30 +85,215 @@ static inline void update_screen() {
 #else
 static void init_screen() {}
 
-static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+static inline void upload_rows(const uint32_t *pixels, uint32_t y, uint32_t h) {
+  io_write(AM_GPU_FBDRAW, 0, y, (void *)(pixels + y * screen_width()), screen_width(), h, false);
+}
+
+static inline void present() {
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+}
+#endif
+
+// upload the runs of flagged scanlines of `pixels' within [lo, hi], clearing the flags
+static void upload_runs(const uint32_t *pixels, uint8_t *rows, uint32_t lo, uint32_t hi) {
+  uint32_t y = lo;
+  while (y <= hi) {
+    if (!rows[y]) { y ++; continue; }
+    uint32_t y0 = y;
+    while (y <= hi && rows[y]) rows[y ++] = 0;
+    upload_rows(pixels, y0, y - y0);
+  }
+}
+
+#ifdef CONFIG_DISPLAY_THREAD
+#include <stdatomic.h>
+
+/* The screen belongs to the display thread in device.c, which gets
+ * frames through a triple buffer. The CPU thread brings `back' up to
+ * date with vmem and swaps it into `middle', and the display thread
+ * swaps a fresh `middle' with `front' to show it. Neither side waits
+ * for the other; a frame not taken in time is just replaced.
+ */
+#define FRESH 4
+static uint32_t *frame[3];
+static uint8_t *stale[3];       // scanlines where a frame is behind vmem, for the CPU thread
+static int back = 0, front = 1; // owned by the CPU and the display thread
+static _Atomic int middle = 2;  // | FRESH until taken by the display thread
+
+/* Scanlines changed by the published frames but not uploaded yet. The
+ * CPU thread adds them both before and after it publishes a frame: the
+ * display thread may take the previous frame in between and clear them,
+ * or take the new frame in between and upload them twice, but the frame
+ * it shows last always gets them.
+ */
+static _Atomic uint64_t *pending = NULL;
+
+static void add_pending(const uint64_t *rows) {
+  int i;
+  for (i = 0; i < (SCREEN_H + 63) / 64; i ++) {
+    if (rows[i]) atomic_fetch_or(&pending[i], rows[i]);
+  }
+}
+static uint8_t *to_upload = NULL; // for the display thread
+
+static void update_screen() {
+  if (dirty_lo > dirty_hi) return;
+  uint32_t y;
+  int k;
+  uint64_t rows[(SCREEN_H + 63) / 64] = {};
+  for (y = dirty_lo; y <= dirty_hi; y ++) {
+    if (dirty[y]) {
+      dirty[y] = 0;
+      rows[y / 64] |= 1ull << (y % 64);
+      for (k = 0; k < 3; k ++) stale[k][y] = 1;
+    }
+  }
+  for (y = 0; y < SCREEN_H; y ++) {
+    if (stale[back][y]) {
+      memcpy(frame[back] + y * SCREEN_W, (uint32_t *)vmem + y * SCREEN_W, pitch);
+      stale[back][y] = 0;
+    }
+  }
+  add_pending(rows);
+  back = atomic_exchange(&middle, back | FRESH) & ~FRESH;
+  add_pending(rows);
+  dirty_lo = UINT32_MAX;
+  dirty_hi = 0;
+}
+
+// the following run on the display thread
+void vga_init_display() {
+  init_screen();
+}
+
+void vga_present() {
+  if (!(atomic_load(&middle) & FRESH)) return;
+  front = atomic_exchange(&middle, front) & ~FRESH;
+  uint32_t y;
+  for (y = 0; y < SCREEN_H; y += 64) {
+    uint64_t bits = atomic_exchange(&pending[y / 64], 0);
+    for (; bits != 0; bits &= bits - 1) to_upload[y + __builtin_ctzll(bits)] = 1;
+  }
+  upload_runs(frame[front], to_upload, 0, SCREEN_H - 1);
+  present();
+}
+#else
+static void update_screen() {
+  if (dirty_lo > dirty_hi) return;
+  upload_runs(vmem, dirty, dirty_lo, dirty_hi);
+  dirty_lo = UINT32_MAX;
+  dirty_hi = 0;
+  present();
+}
+#endif
+#endif
+
+#ifdef CONFIG_VGA_DUMP
+void init_vga_dump(int w, int h);
+void vga_dump_frame(const void *pixels);
+#endif
+
+#ifdef CONFIG_VGA_SHM
+#include <device/vga-shm.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static VGAShm *shm = NULL;
+
+// viewers which have mapped the object keep it after NEMU exits
+static void finish_shm() {
+  shm_unlink(CONFIG_VGA_SHM_NAME);
+}
+
+static void init_shm() {
+  const char *name = CONFIG_VGA_SHM_NAME;
+  size_t size = VGA_SHM_FB_OFFSET + screen_size();
+  // another NEMU may be using the object, so it is never taken over
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  Assert(fd >= 0, "Can not create shared memory %s (%s), is another NEMU using it?", name, strerror(errno));
+  Assert(ftruncate(fd, size) == 0, "Can not set the size of shared memory %s", name);
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(p != MAP_FAILED, "Can not map shared memory %s", name);
+  close(fd);
+  atexit(finish_shm);
+  shm = p;
+  shm->width = screen_width();
+  shm->height = screen_height();
+  vgactl_port_base = shm->vgactl;
+  vmem = (uint8_t *)p + VGA_SHM_FB_OFFSET;
+  __atomic_store_n(&shm->magic, VGA_SHM_MAGIC, __ATOMIC_RELEASE);
+  Log("Frame buffer is exported as shared memory %s", name);
 }
 #endif
+
+// every sync of the guest, unlike vga_update_screen(), which merges those within 1/60 s
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!vgactl_port_base[1]) return;
+  IFDEF(CONFIG_VGA_SHM, __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE));
+#ifdef CONFIG_VGA_DUMP
+  static uint64_t nr_sync = 0;
+  if (nr_sync ++ % CONFIG_VGA_DUMP_INTERVAL == 0) vga_dump_frame(vmem);
 #endif
+}
+
+static const IOReg vgactl_regs[] = {
+  { 4, 4, IO_HOOK_W, vgactl_io_handler },
+};
 
 void vga_update_screen() {
   if (vgactl_port_base[1]) {
-    update_screen();
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
     vgactl_port_base[1] = 0;
   }
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
+#ifdef CONFIG_VGA_SHM
+  init_shm();
+#else
+  vgactl_port_base = (uint32_t *)new_space(12);
+  vmem = new_space(screen_size());
+#endif
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  // what the driver may use besides vmem: bit 0 the 2D accelerator, bit 1 the DMA engine
+  vgactl_port_base[2] = ISDEF(CONFIG_HAS_GPU) | (ISDEF(CONFIG_HAS_DMA) << 1);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_bank ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 12, vgactl_regs, ARRLEN(vgactl_regs));
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_bank("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 12, vgactl_regs, ARRLEN(vgactl_regs));
 #endif
 
-  vmem = new_space(screen_size());
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  // only writes are seen, so reading the frame buffer costs nothing
+  static IOReg vmem_reg = { .offset = 0, .flags = IO_HOOK_W, .hook = vmem_io_handler };
+  vmem_reg.size = screen_size();
+  add_mmio_bank("vmem", CONFIG_FB_ADDR, vmem, screen_size(), &vmem_reg, 1);
+#else
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+#endif
+  IFDEF(CONFIG_VGA_DUMP, init_vga_dump(screen_width(), screen_height()));
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  IFNDEF(CONFIG_DISPLAY_THREAD, init_screen());
+  memset(vmem, 0, screen_size());
+  // the first sync shows the whole screen
+  pitch = screen_width() * sizeof(uint32_t);
+  dirty = malloc(screen_height());
+  assert(dirty);
+  memset(dirty, 1, screen_height());
+  dirty_lo = 0;
+  dirty_hi = screen_height() - 1;
+#ifdef CONFIG_DISPLAY_THREAD
+  int k;
+  for (k = 0; k < 3; k ++) {
+    frame[k] = calloc(1, screen_size());
+    stale[k] = calloc(1, screen_height());
+    assert(frame[k] && stale[k]);
+  }
+  pending = calloc((screen_height() + 63) / 64, sizeof(*pending));
+  to_upload = calloc(1, screen_height());
+  assert(pending && to_upload);
+#endif
+#endif
 }
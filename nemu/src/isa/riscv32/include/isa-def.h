@@ -17,6 +17,9 @@
 #define __ISA_RISCV32_H__
 
 #include <common.h>
+#ifdef CONFIG_RVV
+#include <cpu/vector.h>
+#endif
 
 typedef struct {
   word_t gpr[32];
@@ -26,7 +29,30 @@ typedef struct {
   word_t mtvec;
   vaddr_t mepc;
   word_t mcause;
+  word_t mtval;
+  word_t mscratch;
+  word_t medeleg;
+  word_t mideleg;
+  word_t mie;
+  word_t mip;
+
+  word_t stvec;
+  vaddr_t sepc;
+  word_t scause;
+  word_t stval;
+  word_t sscratch;
+  word_t satp;
+
+#ifdef CONFIG_FPU
+  uint64_t fpr[32]; // single precision values are NaN-boxed
+  uint32_t fcsr;    // frm in [7:5], fflags in [4:0]
+#endif
+
+#ifdef CONFIG_RVV
+  VecState vec;
+#endif
 
+  int priv; // current privilege mode
 } riscv32_CPU_state;
 
 typedef struct {
@@ -65,21 +91,66 @@ typedef struct {
 
 
 #define CSR_MASK 0xfff
+#define CSR_FFLAGS_ADDR 0x001
+#define CSR_FRM_ADDR 0x002
+#define CSR_FCSR_ADDR 0x003
+#define CSR_VSTART_ADDR 0x008
+#define CSR_VXSAT_ADDR 0x009
+#define CSR_VXRM_ADDR 0x00a
+#define CSR_VCSR_ADDR 0x00f
+#define CSR_SSTATUS_ADDR 0x100
+#define CSR_SIE_ADDR 0x104
+#define CSR_STVEC_ADDR 0x105
+#define CSR_SSCRATCH_ADDR 0x140
+#define CSR_SEPC_ADDR 0x141
+#define CSR_SCAUSE_ADDR 0x142
+#define CSR_STVAL_ADDR 0x143
+#define CSR_SIP_ADDR 0x144
+#define CSR_SATP_ADDR 0x180
 #define CSR_MSTATUS_ADDR 0x300
+#define CSR_MISA_ADDR 0x301
+#define CSR_MEDELEG_ADDR 0x302
+#define CSR_MIDELEG_ADDR 0x303
+#define CSR_MIE_ADDR 0x304
 #define CSR_MTVEC_ADDR 0x305
+#define CSR_MSCRATCH_ADDR 0x340
 #define CSR_MEPC_ADDR 0x341
 #define CSR_MCAUSE_ADDR 0x342
+#define CSR_MTVAL_ADDR 0x343
+#define CSR_MIP_ADDR 0x344
+#define CSR_MVENDORID_ADDR 0xf11
+#define CSR_MARCHID_ADDR 0xf12
+#define CSR_MIMPID_ADDR 0xf13
+#define CSR_MHARTID_ADDR 0xf14
+#define CSR_MCYCLE_ADDR 0xb00
+#define CSR_MINSTRET_ADDR 0xb02
+#define CSR_MCYCLEH_ADDR 0xb80
+#define CSR_MINSTRETH_ADDR 0xb82
+#define CSR_CYCLE_ADDR 0xc00
+#define CSR_TIME_ADDR 0xc01
+#define CSR_INSTRET_ADDR 0xc02
+#define CSR_VL_ADDR 0xc20
+#define CSR_VTYPE_ADDR 0xc21
+#define CSR_VLENB_ADDR 0xc22
+#define CSR_CYCLEH_ADDR 0xc80
+#define CSR_TIMEH_ADDR 0xc81
+#define CSR_INSTRETH_ADDR 0xc82
 
-#define TRAP_MECALL 0xb
+enum { PRIV_U = 0, PRIV_S = 1, PRIV_M = 3 };
 
 
 // decode
 typedef struct {
   union {
     uint32_t val;
-  } inst;
+  } inst;       // a compressed instruction is expanded to its 32-bit form
+  uint32_t raw; // the instruction as fetched
 } riscv32_ISADecodeInfo;
 
-#define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+/* As the rest of the PA toolchain expects, translation is on whenever
+ * satp selects Sv32, including in M-mode where AM runs its kernel.
+ * For the same reason mstatus.MPRV has no effect on translation.
+ */
+#define isa_mmu_check(vaddr, len, type) ((cpu.satp >> 31) ? MMU_TRANSLATE : MMU_DIRECT)
 
 #endif
@@ -16,6 +16,7 @@
 #include <elf.h>
 #include <isa.h>
 #include <memory/paddr.h>
+#include <cpu/vector.h>
 
 // this is not consistent with uint8_t
 // but it is ok since we do not access the array directly
@@ -32,12 +33,19 @@ static void restart() {
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  /* vtype is illegal until the first vsetvl. */
+  IFDEF(CONFIG_RVV, cpu.vec.vtype = VTYPE_VILL);
+
+  cpu.priv = PRIV_M;
 }
 
 void init_isa() {
   /* Load built-in image. */
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
 
+  IFDEF(CONFIG_RVV, init_vector());
+
   /* Initialize this virtual computer system. */
   restart();
 }
@@ -14,14 +14,24 @@
 ***************************************************************************************/
 
 #include "local-include/reg.h"
+#include "local-include/priv.h"
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/timing.h>
+#include <cpu/fpu.h>
+#include <cpu/vector.h>
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
 
+#define branch(cond) do { \
+  bool taken = (cond); \
+  IFDEF(CONFIG_PERF, perf_branch[taken] ++); \
+  if (taken) s->dnpc = s->pc + imm; \
+} while (0)
+
 enum {
   TYPE_RR, TYPE_I, TYPE_S, TYPE_B, TYPE_U,  TYPE_J,
   TYPE_N, // none
@@ -53,22 +63,80 @@ static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, wor
   }
 }
 
+#define ILLEGAL() (s->dnpc = raise_trap(EXC_ILLEGAL_INST, s->pc, s->isa.raw))
+
+#define RS1 BITS(s->isa.inst.val, 19, 15)
+#define RS2 BITS(s->isa.inst.val, 24, 20)
+#define RS3 BITS(s->isa.inst.val, 31, 27)
+
+#ifdef CONFIG_FPU
+
+// a single precision operand that is not NaN-boxed reads as the canonical NaN
+#define F32(i) ((fpr(i) >> 32) == 0xffffffff ? (uint32_t)fpr(i) : F32_NAN)
+#define F64(i) fpr(i)
+#define F32W(i, val) (fpr(i) = 0xffffffff00000000ull | (uint32_t)(val))
+#define F64W(i, val) (fpr(i) = (val))
+
+#define Mr64(addr) ({ vaddr_t __a = (addr); Mr(__a, 4) | ((uint64_t)Mr(__a + 4, 4) << 32); })
+#define Mw64(addr, data) do { vaddr_t __a = (addr); uint64_t __d = (data); \
+  Mw(__a, 4, (uint32_t)__d); Mw(__a + 4, 4, __d >> 32); } while (0)
+
+/* The body of a floating-point instruction sees the accrued exceptions
+ * in `fflags', and in `rm' the rounding mode if FPRM is used. Every
+ * floating-point instruction marks mstatus.FS dirty.
+ */
+#define FP(...) do { \
+  if (unlikely((cpu.mstatus & MSTATUS_FS) == 0)) { ILLEGAL(); break; } \
+  uint32_t fflags = cpu.fcsr & 0x1f; \
+  __VA_ARGS__; \
+  cpu.fcsr = (cpu.fcsr & ~0x1f) | fflags; \
+  cpu.mstatus |= MSTATUS_FS; \
+} while (0)
+
+#define FPRM(...) FP( \
+  int rm = BITS(s->isa.inst.val, 14, 12); \
+  if (rm == FRM_DYN) rm = cpu.fcsr >> 5; \
+  if (unlikely(rm > FRM_RMM)) { ILLEGAL(); break; } \
+  __VA_ARGS__)
+#endif
+
+#ifdef CONFIG_RVV
+#define VM (BITS(s->isa.inst.val, 25, 25) == 0) // masked by v0
+
+/* A vector instruction that is illegal under the current vtype raises
+ * the exception. Every vector instruction marks mstatus.VS dirty.
+ */
+#define VEC(...) do { \
+  if (unlikely((cpu.mstatus & MSTATUS_VS) == 0 || !(__VA_ARGS__))) { ILLEGAL(); break; } \
+  cpu.mstatus |= MSTATUS_VS; \
+} while (0)
+
+#define VV(op) VEC(vec_op_vv(&cpu.vec, op, dest, RS2, RS1, VM))
+#define VX(op) VEC(vec_op_vx(&cpu.vec, op, dest, RS2, src1, VM))
+#define VI(op) VEC(vec_op_vx(&cpu.vec, op, dest, RS2, SEXT(RS1, 5), VM))
+
+// rs1 = x0 asks for VLMAX, or keeps vl if rd is x0 as well
+#define AVL(src1) (RS1 != 0 ? (src1) : dest != 0 ? (word_t)-1 : cpu.vec.vl)
+#define VSETVL(avl, vtype) VEC((R(dest) = vec_setvl(&cpu.vec, avl, vtype), true))
+#endif
+
 /* handler functions for complex instructions */
-static void csrrw_handler(int dest, word_t src1, word_t csr, Decode *s);
-static void csrrs_handler(int dest, word_t src1, word_t csr, Decode *s);
+static void csr_handler(int dest, word_t src1, word_t csr, int funct3, Decode *s);
 
-static int decode_exec(Decode *s) {
+static int decode_exec(Decode *s, const void **exec) {
   int dest = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
   s->dnpc = s->snpc;
 
 #define INSTPAT_INST(s) ((s)->isa.inst.val)
+#define INSTPAT_CACHE(label) (*exec = (label))
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
   decode_operand(s, &dest, &src1, &src2, &imm, concat(TYPE_, type)); \
   __VA_ARGS__ ; \
 }
 
   INSTPAT_START();
+  if (*exec != NULL) goto **exec;
   
   ///// RV32I
 
@@ -103,16 +171,16 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 001 ????? 01000 11", sh     , S, Mw(src1 + imm, 2, BITS(src2, 15, 0)));
   INSTPAT("??????? ????? ????? 010 ????? 01000 11", sw     , S, Mw(src1 + imm, 4, src2));
 
-  INSTPAT("??????? ????? ????? 000 ????? 11000 11", beq    , B, if (src1 == src2) s->dnpc = s->pc + imm);
-  INSTPAT("??????? ????? ????? 001 ????? 11000 11", bne    , B, if (src1 != src2) s->dnpc = s->pc + imm);
-  INSTPAT("??????? ????? ????? 100 ????? 11000 11", blt    , B, if ((sword_t)src1 < (sword_t)src2) s->dnpc = s->pc + imm);
-  INSTPAT("??????? ????? ????? 101 ????? 11000 11", bge    , B, if ((sword_t)src1 >= (sword_t)src2) s->dnpc = s->pc + imm);
-  INSTPAT("??????? ????? ????? 110 ????? 11000 11", bltu   , B, if (src1 < src2) s->dnpc = s->pc + imm);
-  INSTPAT("??????? ????? ????? 111 ????? 11000 11", bgeu   , B, if (src1 >= src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 000 ????? 11000 11", beq    , B, branch(src1 == src2));
+  INSTPAT("??????? ????? ????? 001 ????? 11000 11", bne    , B, branch(src1 != src2));
+  INSTPAT("??????? ????? ????? 100 ????? 11000 11", blt    , B, branch((sword_t)src1 < (sword_t)src2));
+  INSTPAT("??????? ????? ????? 101 ????? 11000 11", bge    , B, branch((sword_t)src1 >= (sword_t)src2));
+  INSTPAT("??????? ????? ????? 110 ????? 11000 11", bltu   , B, branch(src1 < src2));
+  INSTPAT("??????? ????? ????? 111 ????? 11000 11", bgeu   , B, branch(src1 >= src2));
 
   
   INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal    , J, R(dest) = s->snpc; s->dnpc = s->pc + imm);
-  INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr   , I, R(dest) = s->snpc; s->dnpc = src1 + imm);
+  INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr   , I, R(dest) = s->snpc; s->dnpc = (src1 + imm) & ~(word_t)1);
 
   INSTPAT("??????? ????? ????? ??? ????? 01101 11", lui    , U, R(dest) = imm);
   INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(dest) = s->pc + imm);
@@ -128,14 +196,120 @@ static int decode_exec(Decode *s) {
   INSTPAT("0000001 ????? ????? 110 ????? 01100 11", rem    , RR, R(dest) = (sword_t)src1 % (sword_t)src2);
   INSTPAT("0000001 ????? ????? 111 ????? 01100 11", remu   , RR, R(dest) = src1 % src2);
   
+#ifdef CONFIG_FPU
+  ///// RV32F
+
+  INSTPAT("??????? ????? ????? 010 ????? 00001 11", flw    , I, FP(F32W(dest, Mr(src1 + imm, 4))));
+  INSTPAT("??????? ????? ????? 010 ????? 01001 11", fsw    , S, FP(Mw(src1 + imm, 4, (uint32_t)F64(RS2))));
+
+  INSTPAT("?????00 ????? ????? ??? ????? 10000 11", fmadd.s , N, FPRM(F32W(dest, f32_fma(F32(RS1), F32(RS2), F32(RS3), rm, &fflags))));
+  INSTPAT("?????00 ????? ????? ??? ????? 10001 11", fmsub.s , N, FPRM(F32W(dest, f32_fma(F32(RS1), F32(RS2), F32(RS3) ^ F32_SIGN, rm, &fflags))));
+  INSTPAT("?????00 ????? ????? ??? ????? 10010 11", fnmsub.s, N, FPRM(F32W(dest, f32_fma(F32(RS1) ^ F32_SIGN, F32(RS2), F32(RS3), rm, &fflags))));
+  INSTPAT("?????00 ????? ????? ??? ????? 10011 11", fnmadd.s, N, FPRM(F32W(dest, f32_fma(F32(RS1) ^ F32_SIGN, F32(RS2), F32(RS3) ^ F32_SIGN, rm, &fflags))));
+
+  INSTPAT("0000000 ????? ????? ??? ????? 10100 11", fadd.s , N, FPRM(F32W(dest, f32_add(F32(RS1), F32(RS2), rm, &fflags))));
+  INSTPAT("0000100 ????? ????? ??? ????? 10100 11", fsub.s , N, FPRM(F32W(dest, f32_sub(F32(RS1), F32(RS2), rm, &fflags))));
+  INSTPAT("0001000 ????? ????? ??? ????? 10100 11", fmul.s , N, FPRM(F32W(dest, f32_mul(F32(RS1), F32(RS2), rm, &fflags))));
+  INSTPAT("0001100 ????? ????? ??? ????? 10100 11", fdiv.s , N, FPRM(F32W(dest, f32_div(F32(RS1), F32(RS2), rm, &fflags))));
+  INSTPAT("0101100 00000 ????? ??? ????? 10100 11", fsqrt.s, N, FPRM(F32W(dest, f32_sqrt(F32(RS1), rm, &fflags))));
+  INSTPAT("0010000 ????? ????? 000 ????? 10100 11", fsgnj.s, N, FP(F32W(dest, (F32(RS1) & ~F32_SIGN) | (F32(RS2) & F32_SIGN))));
+  INSTPAT("0010000 ????? ????? 001 ????? 10100 11", fsgnjn.s, N, FP(F32W(dest, (F32(RS1) & ~F32_SIGN) | (~F32(RS2) & F32_SIGN))));
+  INSTPAT("0010000 ????? ????? 010 ????? 10100 11", fsgnjx.s, N, FP(F32W(dest, F32(RS1) ^ (F32(RS2) & F32_SIGN))));
+  INSTPAT("0010100 ????? ????? 000 ????? 10100 11", fmin.s , N, FP(F32W(dest, f32_min(F32(RS1), F32(RS2), &fflags))));
+  INSTPAT("0010100 ????? ????? 001 ????? 10100 11", fmax.s , N, FP(F32W(dest, f32_max(F32(RS1), F32(RS2), &fflags))));
+  INSTPAT("1100000 00000 ????? ??? ????? 10100 11", fcvt.w.s, N, FPRM(R(dest) = f32_to_i32(F32(RS1), rm, &fflags)));
+  INSTPAT("1100000 00001 ????? ??? ????? 10100 11", fcvt.wu.s, N, FPRM(R(dest) = f32_to_u32(F32(RS1), rm, &fflags)));
+  INSTPAT("1110000 00000 ????? 000 ????? 10100 11", fmv.x.w, N, FP(R(dest) = (uint32_t)F64(RS1)));
+  INSTPAT("1010000 ????? ????? 010 ????? 10100 11", feq.s  , N, FP(R(dest) = f32_eq(F32(RS1), F32(RS2), &fflags)));
+  INSTPAT("1010000 ????? ????? 001 ????? 10100 11", flt.s  , N, FP(R(dest) = f32_lt(F32(RS1), F32(RS2), &fflags)));
+  INSTPAT("1010000 ????? ????? 000 ????? 10100 11", fle.s  , N, FP(R(dest) = f32_le(F32(RS1), F32(RS2), &fflags)));
+  INSTPAT("1110000 00000 ????? 001 ????? 10100 11", fclass.s, N, FP(R(dest) = f32_class(F32(RS1))));
+  INSTPAT("1101000 00000 ????? ??? ????? 10100 11", fcvt.s.w, I, FPRM(F32W(dest, i64_to_f32((sword_t)src1, rm, &fflags))));
+  INSTPAT("1101000 00001 ????? ??? ????? 10100 11", fcvt.s.wu, I, FPRM(F32W(dest, u64_to_f32(src1, rm, &fflags))));
+  INSTPAT("1111000 00000 ????? 000 ????? 10100 11", fmv.w.x, I, FP(F32W(dest, src1)));
+
+  ///// RV32D
+
+  INSTPAT("??????? ????? ????? 011 ????? 00001 11", fld    , I, FP(F64W(dest, Mr64(src1 + imm))));
+  INSTPAT("??????? ????? ????? 011 ????? 01001 11", fsd    , S, FP(Mw64(src1 + imm, F64(RS2))));
+
+  INSTPAT("?????01 ????? ????? ??? ????? 10000 11", fmadd.d , N, FPRM(F64W(dest, f64_fma(F64(RS1), F64(RS2), F64(RS3), rm, &fflags))));
+  INSTPAT("?????01 ????? ????? ??? ????? 10001 11", fmsub.d , N, FPRM(F64W(dest, f64_fma(F64(RS1), F64(RS2), F64(RS3) ^ F64_SIGN, rm, &fflags))));
+  INSTPAT("?????01 ????? ????? ??? ????? 10010 11", fnmsub.d, N, FPRM(F64W(dest, f64_fma(F64(RS1) ^ F64_SIGN, F64(RS2), F64(RS3), rm, &fflags))));
+  INSTPAT("?????01 ????? ????? ??? ????? 10011 11", fnmadd.d, N, FPRM(F64W(dest, f64_fma(F64(RS1) ^ F64_SIGN, F64(RS2), F64(RS3) ^ F64_SIGN, rm, &fflags))));
+
+  INSTPAT("0000001 ????? ????? ??? ????? 10100 11", fadd.d , N, FPRM(F64W(dest, f64_add(F64(RS1), F64(RS2), rm, &fflags))));
+  INSTPAT("0000101 ????? ????? ??? ????? 10100 11", fsub.d , N, FPRM(F64W(dest, f64_sub(F64(RS1), F64(RS2), rm, &fflags))));
+  INSTPAT("0001001 ????? ????? ??? ????? 10100 11", fmul.d , N, FPRM(F64W(dest, f64_mul(F64(RS1), F64(RS2), rm, &fflags))));
+  INSTPAT("0001101 ????? ????? ??? ????? 10100 11", fdiv.d , N, FPRM(F64W(dest, f64_div(F64(RS1), F64(RS2), rm, &fflags))));
+  INSTPAT("0101101 00000 ????? ??? ????? 10100 11", fsqrt.d, N, FPRM(F64W(dest, f64_sqrt(F64(RS1), rm, &fflags))));
+  INSTPAT("0010001 ????? ????? 000 ????? 10100 11", fsgnj.d, N, FP(F64W(dest, (F64(RS1) & ~F64_SIGN) | (F64(RS2) & F64_SIGN))));
+  INSTPAT("0010001 ????? ????? 001 ????? 10100 11", fsgnjn.d, N, FP(F64W(dest, (F64(RS1) & ~F64_SIGN) | (~F64(RS2) & F64_SIGN))));
+  INSTPAT("0010001 ????? ????? 010 ????? 10100 11", fsgnjx.d, N, FP(F64W(dest, F64(RS1) ^ (F64(RS2) & F64_SIGN))));
+  INSTPAT("0010101 ????? ????? 000 ????? 10100 11", fmin.d , N, FP(F64W(dest, f64_min(F64(RS1), F64(RS2), &fflags))));
+  INSTPAT("0010101 ????? ????? 001 ????? 10100 11", fmax.d , N, FP(F64W(dest, f64_max(F64(RS1), F64(RS2), &fflags))));
+  INSTPAT("0100000 00001 ????? ??? ????? 10100 11", fcvt.s.d, N, FPRM(F32W(dest, f64_to_f32(F64(RS1), rm, &fflags))));
+  INSTPAT("0100001 00000 ????? ??? ????? 10100 11", fcvt.d.s, N, FPRM(F64W(dest, f32_to_f64(F32(RS1), &fflags))));
+  INSTPAT("1010001 ????? ????? 010 ????? 10100 11", feq.d  , N, FP(R(dest) = f64_eq(F64(RS1), F64(RS2), &fflags)));
+  INSTPAT("1010001 ????? ????? 001 ????? 10100 11", flt.d  , N, FP(R(dest) = f64_lt(F64(RS1), F64(RS2), &fflags)));
+  INSTPAT("1010001 ????? ????? 000 ????? 10100 11", fle.d  , N, FP(R(dest) = f64_le(F64(RS1), F64(RS2), &fflags)));
+  INSTPAT("1110001 00000 ????? 001 ????? 10100 11", fclass.d, N, FP(R(dest) = f64_class(F64(RS1))));
+  INSTPAT("1100001 00000 ????? ??? ????? 10100 11", fcvt.w.d, N, FPRM(R(dest) = f64_to_i32(F64(RS1), rm, &fflags)));
+  INSTPAT("1100001 00001 ????? ??? ????? 10100 11", fcvt.wu.d, N, FPRM(R(dest) = f64_to_u32(F64(RS1), rm, &fflags)));
+  INSTPAT("1101001 00000 ????? ??? ????? 10100 11", fcvt.d.w, I, FPRM(F64W(dest, i64_to_f64((sword_t)src1, rm, &fflags))));
+  INSTPAT("1101001 00001 ????? ??? ????? 10100 11", fcvt.d.wu, I, FPRM(F64W(dest, u64_to_f64(src1, rm, &fflags))));
+#endif
+
+#ifdef CONFIG_RVV
+  ///// V, the subset of Zve32x in cpu/vector.h
+
+  INSTPAT("0?????? ????? ????? 111 ????? 10101 11", vsetvli , I, VSETVL(AVL(src1), BITS(imm, 10, 0)));
+  INSTPAT("11????? ????? ????? 111 ????? 10101 11", vsetivli, N, VSETVL(RS1, BITS(s->isa.inst.val, 29, 20)));
+  INSTPAT("1000000 ????? ????? 111 ????? 10101 11", vsetvl  , RR, VSETVL(AVL(src1), src2));
+
+  INSTPAT("000000? 00000 ????? 000 ????? 00001 11", vle8.v  , I, VEC(vec_load(&cpu.vec, dest, src1, 0, VM)));
+  INSTPAT("000000? 00000 ????? 101 ????? 00001 11", vle16.v , I, VEC(vec_load(&cpu.vec, dest, src1, 1, VM)));
+  INSTPAT("000000? 00000 ????? 110 ????? 00001 11", vle32.v , I, VEC(vec_load(&cpu.vec, dest, src1, 2, VM)));
+  INSTPAT("000000? 00000 ????? 000 ????? 01001 11", vse8.v  , I, VEC(vec_store(&cpu.vec, dest, src1, 0, VM)));
+  INSTPAT("000000? 00000 ????? 101 ????? 01001 11", vse16.v , I, VEC(vec_store(&cpu.vec, dest, src1, 1, VM)));
+  INSTPAT("000000? 00000 ????? 110 ????? 01001 11", vse32.v , I, VEC(vec_store(&cpu.vec, dest, src1, 2, VM)));
+
+  INSTPAT("000000? ????? ????? 000 ????? 10101 11", vadd.vv , N, VV(VOP_ADD));
+  INSTPAT("000000? ????? ????? 100 ????? 10101 11", vadd.vx , I, VX(VOP_ADD));
+  INSTPAT("000000? ????? ????? 011 ????? 10101 11", vadd.vi , N, VI(VOP_ADD));
+  INSTPAT("000010? ????? ????? 000 ????? 10101 11", vsub.vv , N, VV(VOP_SUB));
+  INSTPAT("000010? ????? ????? 100 ????? 10101 11", vsub.vx , I, VX(VOP_SUB));
+  INSTPAT("000011? ????? ????? 100 ????? 10101 11", vrsub.vx, I, VX(VOP_RSUB));
+  INSTPAT("000011? ????? ????? 011 ????? 10101 11", vrsub.vi, N, VI(VOP_RSUB));
+  INSTPAT("001001? ????? ????? 000 ????? 10101 11", vand.vv , N, VV(VOP_AND));
+  INSTPAT("001001? ????? ????? 100 ????? 10101 11", vand.vx , I, VX(VOP_AND));
+  INSTPAT("001001? ????? ????? 011 ????? 10101 11", vand.vi , N, VI(VOP_AND));
+  INSTPAT("001010? ????? ????? 000 ????? 10101 11", vor.vv  , N, VV(VOP_OR));
+  INSTPAT("001010? ????? ????? 100 ????? 10101 11", vor.vx  , I, VX(VOP_OR));
+  INSTPAT("001010? ????? ????? 011 ????? 10101 11", vor.vi  , N, VI(VOP_OR));
+  INSTPAT("001011? ????? ????? 000 ????? 10101 11", vxor.vv , N, VV(VOP_XOR));
+  INSTPAT("001011? ????? ????? 100 ????? 10101 11", vxor.vx , I, VX(VOP_XOR));
+  INSTPAT("001011? ????? ????? 011 ????? 10101 11", vxor.vi , N, VI(VOP_XOR));
+  INSTPAT("100101? ????? ????? 010 ????? 10101 11", vmul.vv , N, VV(VOP_MUL));
+  INSTPAT("100101? ????? ????? 110 ????? 10101 11", vmul.vx , I, VX(VOP_MUL));
+  INSTPAT("0101111 00000 ????? 000 ????? 10101 11", vmv.v.v , N, VV(VOP_MV));
+  INSTPAT("0101111 00000 ????? 100 ????? 10101 11", vmv.v.x , I, VX(VOP_MV));
+  INSTPAT("0101111 00000 ????? 011 ????? 10101 11", vmv.v.i , N, VI(VOP_MV));
+#endif
+
   ///// Special
-  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, csrrw_handler(dest, src1, imm & CSR_MASK, s));
-  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, csrrs_handler(dest, src1, imm & CSR_MASK, s));
-  
-  
-  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = isa_raise_intr(TRAP_MECALL, s->pc));
-  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = cpu.mepc);
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, csr_handler(dest, src1, imm & CSR_MASK, 1, s));
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, csr_handler(dest, src1, imm & CSR_MASK, 2, s));
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc  , I, csr_handler(dest, src1, imm & CSR_MASK, 3, s));
+  INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi , I, csr_handler(dest, BITS(s->isa.inst.val, 19, 15), imm & CSR_MASK, 5, s));
+  INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi , I, csr_handler(dest, BITS(s->isa.inst.val, 19, 15), imm & CSR_MASK, 6, s));
+  INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci , I, csr_handler(dest, BITS(s->isa.inst.val, 19, 15), imm & CSR_MASK, 7, s));
 
+  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = raise_trap(EXC_ECALL_U + cpu.priv, s->pc, 0));
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, if (cpu.priv == PRIV_M) s->dnpc = trap_return_m(); else ILLEGAL());
+  INSTPAT("0001000 00010 00000 000 00000 11100 11", sret   , N, if (cpu.priv >= PRIV_S) s->dnpc = trap_return_s(); else ILLEGAL());
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi    , N, );
+  INSTPAT("0001001 ????? ????? 000 00000 11100 11", sfence.vma, N, if (cpu.priv >= PRIV_S) mmu_flush(); else ILLEGAL());
 
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
@@ -147,32 +321,212 @@ static int decode_exec(Decode *s) {
   return 0;
 }
 
-int isa_exec_once(Decode *s) {
-  s->isa.inst.val = inst_fetch(&s->snpc, 4);
-  return decode_exec(s);
-}
+#ifdef CONFIG_RVC
+#define C_RD      BITS(c, 11, 7)
+#define C_RS2     BITS(c, 6, 2)
+#define C_RDP     (BITS(c, 4, 2) + 8)  // rd' and rs2'
+#define C_RS1P    (BITS(c, 9, 7) + 8)  // rs1' and rd'
+#define C_IMM6    SEXT((BITS(c, 12, 12) << 5) | BITS(c, 6, 2), 6)
 
-/* handler functions for complex instructions */
+// encoders for the 32-bit formats, taking the immediate as a whole
+#define ENC_R(f7, rs2, rs1, f3, rd, op) (((f7) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define ENC_I(imm, rs1, f3, rd, op) ((BITS(imm, 11, 0) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define ENC_S(imm, rs2, rs1, f3, op) ((BITS(imm, 11, 5) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | \
+    (BITS(imm, 4, 0) << 7) | (op))
+#define ENC_B(imm, rs2, rs1, f3) ((BITS(imm, 12, 12) << 31) | (BITS(imm, 10, 5) << 25) | ((rs2) << 20) | ((rs1) << 15) | \
+    ((f3) << 12) | (BITS(imm, 4, 1) << 8) | (BITS(imm, 11, 11) << 7) | 0x63)
+#define ENC_U(imm, rd, op) ((BITS(imm, 31, 12) << 12) | ((rd) << 7) | (op))
+#define ENC_J(imm, rd) ((BITS(imm, 20, 20) << 31) | (BITS(imm, 10, 1) << 21) | (BITS(imm, 11, 11) << 20) | \
+    (BITS(imm, 19, 12) << 12) | ((rd) << 7) | 0x6f)
 
-#define CSRRW(csr) gpr(dest) = cpu.csr; cpu.csr = src1
+#define OP_LOAD 0x03
+#define OP_LOAD_FP 0x07
+#define OP_IMM 0x13
+#define OP_STORE 0x23
+#define OP_STORE_FP 0x27
+#define OP_REG 0x33
+#define OP_LUI 0x37
+#define OP_JALR 0x67
 
-static void csrrw_handler(int dest, word_t src1, word_t csr, Decode *s) {
-  switch (csr) {
-    case CSR_MTVEC_ADDR:      CSRRW(mtvec);       break;
-    case CSR_MSTATUS_ADDR:    CSRRW(mstatus);     break;
-    case CSR_MEPC_ADDR:       CSRRW(mepc);        break;
-    default: INV(s->pc);
+/* Expand a 16-bit instruction to the 32-bit instruction it stands for.
+ * Reserved encodings become 0, which is not a valid instruction
+ * either, so the decoder reports both the same way.
+ */
+static uint32_t rvc_expand(uint32_t c) {
+  uint32_t imm;
+  switch ((BITS(c, 15, 13) << 2) | BITS(c, 1, 0)) {
+    // quadrant 0
+    case 000: // c.addi4spn
+      imm = (BITS(c, 12, 11) << 4) | (BITS(c, 10, 7) << 6) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 3);
+      return imm == 0 ? 0 : ENC_I(imm, 2, 0, C_RDP, OP_IMM);
+    case 004: // c.fld
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 5) << 6);
+      return ENC_I(imm, C_RS1P, 3, C_RDP, OP_LOAD_FP);
+    case 010: case 014: // c.lw, c.flw
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 6);
+      return ENC_I(imm, C_RS1P, 2, C_RDP, BITS(c, 13, 13) ? OP_LOAD_FP : OP_LOAD);
+    case 024: // c.fsd
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 5) << 6);
+      return ENC_S(imm, C_RDP, C_RS1P, 3, OP_STORE_FP);
+    case 030: case 034: // c.sw, c.fsw
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2) | (BITS(c, 5, 5) << 6);
+      return ENC_S(imm, C_RDP, C_RS1P, 2, BITS(c, 13, 13) ? OP_STORE_FP : OP_STORE);
+
+    // quadrant 1
+    case 001: // c.addi, c.nop
+      return ENC_I(C_IMM6, C_RD, 0, C_RD, OP_IMM);
+    case 005: case 025: // c.jal, c.j
+      imm = SEXT((BITS(c, 12, 12) << 11) | (BITS(c, 11, 11) << 4) | (BITS(c, 10, 9) << 8) | (BITS(c, 8, 8) << 10) |
+          (BITS(c, 7, 7) << 6) | (BITS(c, 6, 6) << 7) | (BITS(c, 5, 3) << 1) | (BITS(c, 2, 2) << 5), 12);
+      return ENC_J(imm, BITS(c, 15, 15) ? 0 : 1);
+    case 011: // c.li
+      return ENC_I(C_IMM6, 0, 0, C_RD, OP_IMM);
+    case 015:
+      if (C_RD == 2) { // c.addi16sp
+        imm = SEXT((BITS(c, 12, 12) << 9) | (BITS(c, 6, 6) << 4) | (BITS(c, 5, 5) << 6) |
+            (BITS(c, 4, 3) << 7) | (BITS(c, 2, 2) << 5), 10);
+        return imm == 0 ? 0 : ENC_I(imm, 2, 0, 2, OP_IMM);
+      }
+      // c.lui
+      imm = C_IMM6 << 12;
+      return imm == 0 ? 0 : ENC_U(imm, C_RD, OP_LUI);
+    case 021:
+      switch (BITS(c, 11, 10)) {
+        case 0: case 1: // c.srli, c.srai, where shamt[5] must be 0 for RV32
+          if (BITS(c, 12, 12)) return 0;
+          return ENC_R(BITS(c, 10, 10) << 5, C_RS2, C_RS1P, 5, C_RS1P, OP_IMM);
+        case 2: // c.andi
+          return ENC_I(C_IMM6, C_RS1P, 7, C_RS1P, OP_IMM);
+        default: { // c.sub, c.xor, c.or, c.and
+          static const uint32_t f3[] = { 0, 4, 6, 7 };
+          if (BITS(c, 12, 12)) return 0;
+          int op = BITS(c, 6, 5);
+          return ENC_R(op == 0 ? 0x20 : 0, C_RDP, C_RS1P, f3[op], C_RS1P, OP_REG);
+        }
+      }
+    case 031: case 035: // c.beqz, c.bnez
+      imm = SEXT((BITS(c, 12, 12) << 8) | (BITS(c, 11, 10) << 3) | (BITS(c, 6, 5) << 6) |
+          (BITS(c, 4, 3) << 1) | (BITS(c, 2, 2) << 5), 9);
+      return ENC_B(imm, 0, C_RS1P, BITS(c, 13, 13));
+
+    // quadrant 2
+    case 002: // c.slli
+      if (BITS(c, 12, 12)) return 0;
+      return ENC_R(0, C_RS2, C_RD, 1, C_RD, OP_IMM);
+    case 006: // c.fldsp
+      imm = (BITS(c, 12, 12) << 5) | (BITS(c, 6, 5) << 3) | (BITS(c, 4, 2) << 6);
+      return ENC_I(imm, 2, 3, C_RD, OP_LOAD_FP);
+    case 012: case 016: // c.lwsp, c.flwsp
+      if (C_RD == 0 && !BITS(c, 13, 13)) return 0;
+      imm = (BITS(c, 12, 12) << 5) | (BITS(c, 6, 4) << 2) | (BITS(c, 3, 2) << 6);
+      return ENC_I(imm, 2, 2, C_RD, BITS(c, 13, 13) ? OP_LOAD_FP : OP_LOAD);
+    case 022:
+      if (!BITS(c, 12, 12)) {
+        if (C_RS2 != 0) return ENC_R(0, C_RS2, 0, 0, C_RD, OP_REG);  // c.mv
+        return C_RD == 0 ? 0 : ENC_I(0, C_RD, 0, 0, OP_JALR);       // c.jr
+      }
+      if (C_RS2 != 0) return ENC_R(0, C_RS2, C_RD, 0, C_RD, OP_REG);  // c.add
+      if (C_RD == 0) return 0x00100073;                               // c.ebreak
+      return ENC_I(0, C_RD, 0, 1, OP_JALR);                           // c.jalr
+    case 026: // c.fsdsp
+      imm = (BITS(c, 12, 10) << 3) | (BITS(c, 9, 7) << 6);
+      return ENC_S(imm, C_RS2, 2, 3, OP_STORE_FP);
+    case 032: case 036: // c.swsp, c.fswsp
+      imm = (BITS(c, 12, 9) << 2) | (BITS(c, 8, 7) << 6);
+      return ENC_S(imm, C_RS2, 2, 2, BITS(c, 13, 13) ? OP_STORE_FP : OP_STORE);
+    default: return 0;
+  }
+}
+
+/* A 4-byte fetch from a 4-byte aligned pc never crosses a page, so it
+ * is safe to do even if only the lower half is an instruction. This
+ * keeps uncompressed code at one fetch per instruction.
+ */
+static uint32_t rvc_fetch(Decode *s) {
+  uint32_t raw;
+  if ((s->pc & 0x3) == 0) {
+    raw = inst_fetch(&s->snpc, 4);
+    if (BITS(raw, 1, 0) != 0x3) { raw &= 0xffff; s->snpc -= 2; }
+  } else {
+    raw = inst_fetch(&s->snpc, 2);
+    if (BITS(raw, 1, 0) == 0x3) raw |= inst_fetch(&s->snpc, 2) << 16;
   }
+  return raw;
 }
+#endif
+
+/* The decode cache is indexed by pc and remembers, for the instruction
+ * bits last fetched there, the 32-bit form and the INSTPAT it matched.
+ * An entry is only used when the bits fetched this time are the same,
+ * so self-modifying code and remapped pages need no invalidation.
+ */
+#define DCACHE_SIZE 4096
+#define DCACHE_SHIFT MUXDEF(CONFIG_RVC, 1, 2)
 
-#define CSRRS(csr) gpr(dest) = cpu.csr; cpu.csr = cpu.csr | src1
+typedef struct {
+  uint32_t raw;
+  uint32_t inst;
+  const void *exec;
+} DecodeCacheEntry;
 
-static void csrrs_handler(int dest, word_t src1, word_t csr, Decode *s) {
-  switch (csr) {
-    case CSR_MCAUSE_ADDR:     CSRRS(mcause);      break;
-    case CSR_MSTATUS_ADDR:    CSRRS(mstatus);     break;
-    case CSR_MEPC_ADDR:       CSRRS(mepc);        break;
-    default: INV(s->pc); 
+static DecodeCacheEntry dcache[DCACHE_SIZE];
+
+int isa_exec_once(Decode *s) {
+  uint32_t raw = MUXDEF(CONFIG_RVC, rvc_fetch(s), inst_fetch(&s->snpc, 4));
+  s->isa.raw = raw;
+  DecodeCacheEntry *e = &dcache[(s->pc >> DCACHE_SHIFT) % DCACHE_SIZE];
+  if (likely(e->exec != NULL && e->raw == raw)) {
+    s->isa.inst.val = e->inst;
+    return decode_exec(s, &e->exec);
   }
+
+  const void *exec = NULL;
+  s->isa.inst.val = MUXDEF(CONFIG_RVC, BITS(raw, 1, 0) != 0x3 ? rvc_expand(raw) : raw, raw);
+  int ret = decode_exec(s, &exec);
+  e->raw = raw;
+  e->inst = s->isa.inst.val;
+  e->exec = exec;
+  return ret;
 }
 
+#ifdef CONFIG_TIMING
+int isa_inst_class(Decode *s) {
+  uint32_t i = s->isa.inst.val;
+  switch (BITS(i, 6, 0)) {
+    case 0x03: case 0x07: return INST_LOAD;
+    case 0x23: case 0x27: return INST_STORE;
+    case 0x63: return INST_BRANCH;
+    case 0x6f: return INST_JUMP;
+    case 0x67: return INST_IJUMP;
+    case 0x73: return INST_SYSTEM;
+    case 0x33:
+      // funct7 = 1 selects RV32M, where funct3 >= 4 are div/rem
+      if (BITS(i, 31, 25) == 1) return BITS(i, 14, 14) ? INST_DIV : INST_MUL;
+      return INST_ALU;
+    // fused multiply-adds, and fdiv and fsqrt
+    case 0x43: case 0x47: case 0x4b: case 0x4f: return INST_MUL;
+    case 0x53: return (BITS(i, 31, 27) == 0x03 || BITS(i, 31, 27) == 0x0b) ? INST_DIV : INST_ALU;
+    // vmul, in OPMVV or OPMVX
+    case 0x57: return (BITS(i, 31, 26) == 0x25 && BITS(i, 13, 12) == 2) ? INST_MUL : INST_ALU;
+    default: return INST_ALU;
+  }
+}
+#endif
+
+/* handler functions for complex instructions */
+
+/* funct3 selects the operation: 1/5 write, 2/6 set, 3/7 clear bits,
+ * where the latter take a 5-bit immediate in place of src1. A set or
+ * clear with rs1 (or the immediate) being zero does not write the CSR.
+ * An unknown CSR, or a write to a read-only one, is an illegal instruction.
+ */
+static void csr_handler(int dest, word_t src1, word_t csr, int funct3, Decode *s) {
+  bool is_write = (funct3 & 3) == 1 || BITS(s->isa.inst.val, 19, 15) != 0;
+  word_t old;
+  if (!csr_permit(csr, is_write) || !csr_read(csr, &old)) { ILLEGAL(); return; }
+  if (is_write) {
+    word_t val = (funct3 & 3) == 1 ? src1 : (funct3 & 3) == 2 ? old | src1 : old & ~src1;
+    if (!csr_write(csr, val)) { ILLEGAL(); return; }
+  }
+  R(dest) = old;
+}
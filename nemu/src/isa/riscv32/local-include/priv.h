@@ -0,0 +1,64 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __RISCV32_PRIV_H__
+#define __RISCV32_PRIV_H__
+
+#include <isa.h>
+#include <cpu/cpu.h>
+
+#define MSTATUS_SIE  (1u << 1)
+#define MSTATUS_MIE  (1u << 3)
+#define MSTATUS_SPIE (1u << 5)
+#define MSTATUS_MPIE (1u << 7)
+#define MSTATUS_SPP  (1u << 8)
+#define MSTATUS_MPP  (3u << 11)
+#define MSTATUS_VS   (3u << 9)
+#define MSTATUS_FS   (3u << 13)
+#define MSTATUS_MPRV (1u << 17)
+#define MSTATUS_SUM  (1u << 18)
+#define MSTATUS_MXR  (1u << 19)
+#define MSTATUS_SD   (1u << 31)
+
+#define MSTATUS_MPP_SHIFT 11
+
+enum {
+  EXC_INST_MISALIGNED, EXC_INST_ACCESS, EXC_ILLEGAL_INST, EXC_BREAKPOINT,
+  EXC_LOAD_MISALIGNED, EXC_LOAD_ACCESS, EXC_STORE_MISALIGNED, EXC_STORE_ACCESS,
+  EXC_ECALL_U, EXC_ECALL_S, EXC_ECALL_M = 11,
+  EXC_INST_PAGE_FAULT, EXC_LOAD_PAGE_FAULT, EXC_STORE_PAGE_FAULT = 15,
+};
+
+#define INTR_BIT (1u << 31)
+
+/* Take the trap `NO' at `epc' in M-mode, or in S-mode if it is
+ * delegated, and return the address of the trap handler.
+ */
+vaddr_t raise_trap(word_t NO, vaddr_t epc, word_t tval);
+vaddr_t trap_return_m();
+vaddr_t trap_return_s();
+
+bool csr_permit(word_t csr, bool is_write);
+bool csr_read(word_t csr, word_t *val);
+bool csr_write(word_t csr, word_t val);
+
+void mmu_flush();
+
+// a pending interrupt may have become enabled after a change of the mode or CSRs
+static inline void intr_recheck() {
+  if (cpu.mip & cpu.mie) cpu_schedule_event(0);
+}
+
+#endif
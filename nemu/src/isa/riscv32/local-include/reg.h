@@ -24,6 +24,7 @@ static inline int check_reg_idx(int idx) {
 }
 
 #define gpr(idx) cpu.gpr[check_reg_idx(idx)]
+#define fpr(idx) cpu.fpr[check_reg_idx(idx)]
 
 static inline const char* reg_name(int idx, int width) {
   extern const char* regs[];
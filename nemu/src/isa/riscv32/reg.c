@@ -23,6 +23,15 @@ const char *regs[] = {
   "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
 };
 
+#ifdef CONFIG_FPU
+static const char *fregs[] = {
+  "ft0", "ft1", "ft2", "ft3", "ft4", "ft5", "ft6", "ft7",
+  "fs0", "fs1", "fa0", "fa1", "fa2", "fa3", "fa4", "fa5",
+  "fa6", "fa7", "fs2", "fs3", "fs4", "fs5", "fs6", "fs7",
+  "fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft10", "ft11"
+};
+#endif
+
 void isa_reg_display() {
   int i;
   printf("RISC-V 32 Regfile\n----------------------------------------------------------------\n");
@@ -32,20 +41,59 @@ void isa_reg_display() {
   for (i = 0; i < 32; i++) {
     printf("%-10s%#-20x%-20u%-20d\n", regs[i], cpu.gpr[i], cpu.gpr[i], cpu.gpr[i]);
   }
+#ifdef CONFIG_FPU
+  // NaN-boxed values are shown as single precision ones
+  for (i = 0; i < 32; i++) {
+    union { uint64_t u; double f; struct { float lo; uint32_t hi; }; } v = { .u = cpu.fpr[i] };
+    printf("%-10s%#-20" PRIx64 "%-20g\n", fregs[i], v.u, v.hi == 0xffffffff ? v.lo : v.f);
+  }
+  printf("%-10s%#-20x\n", "fcsr", cpu.fcsr);
+#endif
+#ifdef CONFIG_RVV
+  printf("%-10s%#-20" PRIx64 "\n", "vl", (uint64_t)cpu.vec.vl);
+  printf("%-10s%#-20" PRIx64 "\n", "vtype", (uint64_t)cpu.vec.vtype);
+  printf("%-10s%#-20" PRIx64 "\n", "vstart", (uint64_t)cpu.vec.vstart);
+  // in words, with element 0 at the right
+  for (i = 0; i < 32; i++) {
+    char name[8];
+    snprintf(name, sizeof(name), "v%d", i);
+    printf("%-10s", name);
+    int j;
+    for (j = VLENB - 4; j >= 0; j -= 4) {
+      uint32_t word;
+      memcpy(&word, VREG(&cpu.vec, i) + j, 4);
+      printf("%08x%s", word, j == 0 ? "\n" : " ");
+    }
+  }
+#endif
   printf("----------------------------------------------------------------\n");
 }
 
-word_t isa_reg_str2val(const char *s, bool *success) {
+int isa_reg_str2idx(const char *s) {
   if (strcmp(s, "pc") == 0) {
-    return cpu.pc;
+    return 32;
   }
   int i;
   for (i = 0; i < 32; i++) {
     if (strcmp(s, regs[i]) == 0) {
-      return cpu.gpr[i];
+      return i;
     }
   }
-  *success = false;
-  printf("No register named %s\n", s);
-  return 0;
+  return -1;
+}
+
+word_t isa_reg_str2val(const char *s, bool *success) {
+  int idx = isa_reg_str2idx(s);
+  if (idx == -1) {
+    *success = false;
+    printf("No register named %s\n", s);
+    return 0;
+  }
+  return *isa_reg_ptr(idx);
+}
+
+word_t *isa_reg_ptr(int idx) {
+  if (idx >= 0 && idx < 32) return &cpu.gpr[idx];
+  if (idx == 32) return &cpu.pc;
+  return NULL;
 }
@@ -0,0 +1,174 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/timing.h>
+#include "../local-include/priv.h"
+
+#define SSTATUS_MASK (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SUM | MSTATUS_MXR | \
+    MUXDEF(CONFIG_FPU, MSTATUS_FS, 0) | MUXDEF(CONFIG_RVV, MSTATUS_VS, 0))
+#define MSTATUS_MASK (SSTATUS_MASK | MSTATUS_MIE | MSTATUS_MPIE | MSTATUS_MPP | MSTATUS_MPRV)
+
+// SSIP/STIP/SEIP, the interrupts that can be delegated to S-mode
+#define SIP_MASK ((1u << 1) | (1u << 5) | (1u << 9))
+#define MIP_MASK (SIP_MASK | (1u << 3) | (1u << 7) | (1u << 11))
+
+// MXL = 1 (32-bit), with extensions I, M, S, U and maybe C, F and D
+#define MISA_VALUE ((1u << 30) | (1u << ('I' - 'A')) | (1u << ('M' - 'A')) | \
+    (1u << ('S' - 'A')) | (1u << ('U' - 'A')) | MUXDEF(CONFIG_RVC, 1u << ('C' - 'A'), 0) | \
+    MUXDEF(CONFIG_FPU, (1u << ('F' - 'A')) | (1u << ('D' - 'A')), 0))
+
+/* The counters are derived from g_nr_guest_inst, or from the cycles
+ * estimated by the timing model, when they are read, so nothing is
+ * updated per instruction. A write to mcycle or minstret only
+ * moves the bias added to the derived value.
+ */
+extern uint64_t g_nr_guest_inst;
+static uint64_t mcycle_bias = 0, minstret_bias = 0;
+
+static inline uint64_t get_mcycle() {
+  return MUXDEF(CONFIG_TIMING, g_nr_guest_cycle, g_nr_guest_inst * CONFIG_CYCLES_PER_INST) + mcycle_bias;
+}
+static inline uint64_t get_minstret() { return g_nr_guest_inst + minstret_bias; }
+
+// `time' shadows mtime of the CLINT when there is one
+#ifdef CONFIG_HAS_CLINT
+uint64_t clint_mtime();
+#define get_mtime() clint_mtime()
+#else
+#define get_mtime() get_time()
+#endif
+
+// SD summarizes that FS or VS is dirty
+static inline word_t read_mstatus() {
+  bool dirty = (cpu.mstatus & MSTATUS_FS) == MSTATUS_FS || (cpu.mstatus & MSTATUS_VS) == MSTATUS_VS;
+  return cpu.mstatus | (dirty ? MSTATUS_SD : 0);
+}
+
+static void write_mstatus(word_t val) {
+  word_t old = cpu.mstatus;
+  cpu.mstatus = val;
+  // cached translations have passed the permission check under the old bits
+  if ((old ^ val) & (MSTATUS_SUM | MSTATUS_MXR)) mmu_flush();
+}
+
+#define IS_VEC_CSR(csr) (((csr) >= CSR_VSTART_ADDR && (csr) <= CSR_VCSR_ADDR) || \
+    ((csr) >= CSR_VL_ADDR && (csr) <= CSR_VLENB_ADDR))
+
+/* csr[9:8] is the lowest privilege mode allowed to access the CSR,
+ * and csr[11:10] = 3 marks it read-only. The floating-point and the
+ * vector CSRs are not accessible while mstatus.FS or VS is off.
+ */
+bool csr_permit(word_t csr, bool is_write) {
+  if (cpu.priv < BITS(csr, 9, 8)) return false;
+  if (csr <= CSR_FCSR_ADDR && (cpu.mstatus & MSTATUS_FS) == 0) return false;
+  if (IS_VEC_CSR(csr) && (cpu.mstatus & MSTATUS_VS) == 0) return false;
+  return !(is_write && BITS(csr, 11, 10) == 3);
+}
+
+bool csr_read(word_t csr, word_t *val) {
+  switch (csr) {
+    case CSR_SSTATUS_ADDR:   *val = read_mstatus() & (SSTATUS_MASK | MSTATUS_SD); break;
+    case CSR_SIE_ADDR:       *val = cpu.mie & cpu.mideleg; break;
+    case CSR_STVEC_ADDR:     *val = cpu.stvec; break;
+    case CSR_SSCRATCH_ADDR:  *val = cpu.sscratch; break;
+    case CSR_SEPC_ADDR:      *val = cpu.sepc; break;
+    case CSR_SCAUSE_ADDR:    *val = cpu.scause; break;
+    case CSR_STVAL_ADDR:     *val = cpu.stval; break;
+    case CSR_SIP_ADDR:       *val = cpu.mip & cpu.mideleg; break;
+    case CSR_SATP_ADDR:      *val = cpu.satp; break;
+    case CSR_MSTATUS_ADDR:   *val = read_mstatus(); break;
+    case CSR_MISA_ADDR:      *val = MISA_VALUE; break;
+    case CSR_MEDELEG_ADDR:   *val = cpu.medeleg; break;
+    case CSR_MIDELEG_ADDR:   *val = cpu.mideleg; break;
+    case CSR_MIE_ADDR:       *val = cpu.mie; break;
+    case CSR_MTVEC_ADDR:     *val = cpu.mtvec; break;
+    case CSR_MSCRATCH_ADDR:  *val = cpu.mscratch; break;
+    case CSR_MEPC_ADDR:      *val = cpu.mepc; break;
+    case CSR_MCAUSE_ADDR:    *val = cpu.mcause; break;
+    case CSR_MTVAL_ADDR:     *val = cpu.mtval; break;
+    case CSR_MIP_ADDR:       *val = cpu.mip; break;
+    case CSR_MVENDORID_ADDR: case CSR_MARCHID_ADDR:
+    case CSR_MIMPID_ADDR:    case CSR_MHARTID_ADDR: *val = 0; break;
+    case CSR_MCYCLE_ADDR:    case CSR_CYCLE_ADDR:    *val = get_mcycle(); break;
+    case CSR_MCYCLEH_ADDR:   case CSR_CYCLEH_ADDR:   *val = get_mcycle() >> 32; break;
+    case CSR_MINSTRET_ADDR:  case CSR_INSTRET_ADDR:  *val = get_minstret(); break;
+    case CSR_MINSTRETH_ADDR: case CSR_INSTRETH_ADDR: *val = get_minstret() >> 32; break;
+    case CSR_TIME_ADDR:      *val = get_mtime(); break;
+    case CSR_TIMEH_ADDR:     *val = get_mtime() >> 32; break;
+#ifdef CONFIG_FPU
+    case CSR_FFLAGS_ADDR:    *val = cpu.fcsr & 0x1f; break;
+    case CSR_FRM_ADDR:       *val = cpu.fcsr >> 5; break;
+    case CSR_FCSR_ADDR:      *val = cpu.fcsr; break;
+#endif
+#ifdef CONFIG_RVV
+    case CSR_VSTART_ADDR:    *val = cpu.vec.vstart; break;
+    case CSR_VXSAT_ADDR:     *val = cpu.vec.vcsr & 1; break;
+    case CSR_VXRM_ADDR:      *val = cpu.vec.vcsr >> 1; break;
+    case CSR_VCSR_ADDR:      *val = cpu.vec.vcsr; break;
+    case CSR_VL_ADDR:        *val = cpu.vec.vl; break;
+    case CSR_VTYPE_ADDR:     *val = cpu.vec.vtype; break;
+    case CSR_VLENB_ADDR:     *val = VLENB; break;
+#endif
+    default: return false;
+  }
+  return true;
+}
+
+bool csr_write(word_t csr, word_t val) {
+  uint64_t cycle = get_mcycle(), instret = get_minstret();
+  switch (csr) {
+    case CSR_SSTATUS_ADDR:  write_mstatus((cpu.mstatus & ~SSTATUS_MASK) | (val & SSTATUS_MASK)); break;
+    case CSR_SIE_ADDR:      cpu.mie = (cpu.mie & ~cpu.mideleg) | (val & cpu.mideleg); break;
+    case CSR_STVEC_ADDR:    cpu.stvec = val; break;
+    case CSR_SSCRATCH_ADDR: cpu.sscratch = val; break;
+    case CSR_SEPC_ADDR:     cpu.sepc = val; break;
+    case CSR_SCAUSE_ADDR:   cpu.scause = val; break;
+    case CSR_STVAL_ADDR:    cpu.stval = val; break;
+    // only SSIP can be set by software in S-mode
+    case CSR_SIP_ADDR:      cpu.mip = (cpu.mip & ~(cpu.mideleg & 2)) | (val & cpu.mideleg & 2); break;
+    case CSR_SATP_ADDR:     cpu.satp = val; mmu_flush(); break;
+    case CSR_MSTATUS_ADDR:  write_mstatus((cpu.mstatus & ~MSTATUS_MASK) | (val & MSTATUS_MASK)); break;
+    case CSR_MISA_ADDR:     break;
+    case CSR_MEDELEG_ADDR:  cpu.medeleg = val & ~(1u << EXC_ECALL_M); break;
+    case CSR_MIDELEG_ADDR:  cpu.mideleg = val & SIP_MASK; break;
+    case CSR_MIE_ADDR:      cpu.mie = val & MIP_MASK; break;
+    case CSR_MTVEC_ADDR:    cpu.mtvec = val; break;
+    case CSR_MSCRATCH_ADDR: cpu.mscratch = val; break;
+    case CSR_MEPC_ADDR:     cpu.mepc = val; break;
+    case CSR_MCAUSE_ADDR:   cpu.mcause = val; break;
+    case CSR_MTVAL_ADDR:    cpu.mtval = val; break;
+    // the M-mode bits are driven by the devices
+    case CSR_MIP_ADDR:      cpu.mip = (cpu.mip & ~SIP_MASK) | (val & SIP_MASK); break;
+    case CSR_MCYCLE_ADDR:    mcycle_bias += ((cycle & ~0xffffffffull) | val) - cycle; break;
+    case CSR_MCYCLEH_ADDR:   mcycle_bias += (((uint64_t)val << 32) | (uint32_t)cycle) - cycle; break;
+    case CSR_MINSTRET_ADDR:  minstret_bias += ((instret & ~0xffffffffull) | val) - instret; break;
+    case CSR_MINSTRETH_ADDR: minstret_bias += (((uint64_t)val << 32) | (uint32_t)instret) - instret; break;
+#ifdef CONFIG_FPU
+    case CSR_FFLAGS_ADDR:    cpu.fcsr = (cpu.fcsr & ~0x1f) | (val & 0x1f); cpu.mstatus |= MSTATUS_FS; break;
+    case CSR_FRM_ADDR:       cpu.fcsr = (cpu.fcsr & 0x1f) | ((val & 0x7) << 5); cpu.mstatus |= MSTATUS_FS; break;
+    case CSR_FCSR_ADDR:      cpu.fcsr = val & 0xff; cpu.mstatus |= MSTATUS_FS; break;
+#endif
+#ifdef CONFIG_RVV
+    case CSR_VSTART_ADDR:    cpu.vec.vstart = val & (CONFIG_RVV_VLEN - 1); cpu.mstatus |= MSTATUS_VS; break;
+    case CSR_VXSAT_ADDR:     cpu.vec.vcsr = (cpu.vec.vcsr & ~1) | (val & 1); cpu.mstatus |= MSTATUS_VS; break;
+    case CSR_VXRM_ADDR:      cpu.vec.vcsr = (cpu.vec.vcsr & 1) | ((val & 3) << 1); cpu.mstatus |= MSTATUS_VS; break;
+    case CSR_VCSR_ADDR:      cpu.vec.vcsr = val & 7; cpu.mstatus |= MSTATUS_VS; break;
+#endif
+    default: return false;
+  }
+  intr_recheck();
+  return true;
+}
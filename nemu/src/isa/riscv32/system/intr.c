@@ -14,18 +14,98 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/perf.h>
+#include "../local-include/priv.h"
 
 IFDEF(CONFIG_ETRACE, void etrace_add(vaddr_t pc, word_t code);)
 
-word_t isa_raise_intr(word_t NO, vaddr_t epc) {
+// in vectored mode, interrupts jump to base + 4 * cause
+static inline vaddr_t trap_vector(word_t tvec, word_t NO) {
+  vaddr_t base = tvec & ~(word_t)3;
+  return ((tvec & 3) == 1 && (NO & INTR_BIT)) ? base + 4 * (NO & ~INTR_BIT) : base;
+}
+
+vaddr_t raise_trap(word_t NO, vaddr_t epc, word_t tval) {
   IFDEF(CONFIG_ETRACE, etrace_add(epc, NO));
+  IFDEF(CONFIG_PERF, perf_trap(NO));
+  word_t code = NO & ~INTR_BIT;
+  word_t deleg = (NO & INTR_BIT) ? cpu.mideleg : cpu.medeleg;
+  word_t s = cpu.mstatus;
+  if (cpu.priv <= PRIV_S && code < 32 && ((deleg >> code) & 1)) {
+    cpu.sepc = epc;
+    cpu.scause = NO;
+    cpu.stval = tval;
+    s &= ~(MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SIE);
+    if (cpu.mstatus & MSTATUS_SIE) s |= MSTATUS_SPIE;
+    if (cpu.priv == PRIV_S) s |= MSTATUS_SPP;
+    cpu.mstatus = s;
+    cpu.priv = PRIV_S;
+    return trap_vector(cpu.stvec, NO);
+  }
   cpu.mepc = epc;
   cpu.mcause = NO;
-  cpu.mstatus = 0x1800;
-  return cpu.mtvec;
+  cpu.mtval = tval;
+  s &= ~(MSTATUS_MPIE | MSTATUS_MPP | MSTATUS_MIE);
+  if (cpu.mstatus & MSTATUS_MIE) s |= MSTATUS_MPIE;
+  s |= (word_t)cpu.priv << MSTATUS_MPP_SHIFT;
+  cpu.mstatus = s;
+  cpu.priv = PRIV_M;
+  return trap_vector(cpu.mtvec, NO);
 }
 
+/* MPRV is cleared when leaving to a mode other than M; since
+ * translation does not honor MPRV (see isa-def.h), this only keeps
+ * the visible state architectural.
+ */
+vaddr_t trap_return_m() {
+  word_t s = cpu.mstatus;
+  int mpp = (s & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT;
+  s &= ~(MSTATUS_MIE | MSTATUS_MPP);
+  if (cpu.mstatus & MSTATUS_MPIE) s |= MSTATUS_MIE;
+  s |= MSTATUS_MPIE;
+  if (mpp != PRIV_M) s &= ~MSTATUS_MPRV;
+  cpu.mstatus = s;
+  cpu.priv = mpp;
+  intr_recheck();
+  return cpu.mepc;
+}
+
+vaddr_t trap_return_s() {
+  word_t s = cpu.mstatus;
+  int spp = (s & MSTATUS_SPP) ? PRIV_S : PRIV_U;
+  s &= ~(MSTATUS_SIE | MSTATUS_SPP | MSTATUS_MPRV);
+  if (cpu.mstatus & MSTATUS_SPIE) s |= MSTATUS_SIE;
+  s |= MSTATUS_SPIE;
+  cpu.mstatus = s;
+  cpu.priv = spp;
+  intr_recheck();
+  return cpu.sepc;
+}
+
+word_t isa_raise_intr(word_t NO, vaddr_t epc) {
+  return raise_trap(NO, epc, 0);
+}
+
+/* An interrupt pending in mip and enabled in mie is taken by M-mode
+ * when running below M or with MIE set, or by S-mode if delegated and
+ * running below S or in S with SIE set.
+ */
 word_t isa_query_intr() {
+  word_t pending = cpu.mip & cpu.mie;
+  if (pending == 0) return INTR_EMPTY;
+  bool m_enable = cpu.priv < PRIV_M || (cpu.mstatus & MSTATUS_MIE);
+  bool s_enable = cpu.priv < PRIV_S || (cpu.priv == PRIV_S && (cpu.mstatus & MSTATUS_SIE));
+  word_t enabled = (m_enable ? pending & ~cpu.mideleg : 0) | (s_enable ? pending & cpu.mideleg : 0);
+  // MEI, MSI, MTI, SEI, SSI, STI in order of priority
+  static const int order[] = { 11, 3, 7, 9, 1, 5 };
+  int i;
+  for (i = 0; i < ARRLEN(order); i ++) {
+    if ((enabled >> order[i]) & 1) return INTR_BIT | order[i];
+  }
   return INTR_EMPTY;
 }
 
+void isa_set_irq(int irq, bool level) {
+  if (level) cpu.mip |= 1u << irq;
+  else cpu.mip &= ~(1u << irq);
+}
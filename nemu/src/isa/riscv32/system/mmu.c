@@ -16,7 +16,102 @@
 #include <isa.h>
 #include <memory/paddr.h>
 #include <memory/vaddr.h>
+#include "../local-include/priv.h"
+
+#define PTE_V 0x01
+#define PTE_R 0x02
+#define PTE_W 0x04
+#define PTE_X 0x08
+#define PTE_U 0x10
+#define PTE_A 0x40
+#define PTE_D 0x80
+#define PTE_PPN(pte) ((pte) >> 10)
+
+#define VPN(vaddr, level) (((vaddr) >> (PAGE_SHIFT + 10 * (level))) & 0x3ff)
+#define SATP_PPN(satp) ((satp) & 0x3fffff)
+
+/* A direct-mapped translation cache per access type. An entry is only
+ * filled after the page walk has checked the permission for its type
+ * and set the A/D bits, so a hit needs no further check. The tag holds
+ * the page number and the privilege mode plus one, so that a zeroed
+ * entry never hits. It is flushed by sfence.vma, a write to satp and a
+ * change of mstatus.SUM/MXR.
+ */
+#define TLB_SIZE 256
+#define TLB_TAG(vaddr, priv) (((vaddr) & ~(vaddr_t)PAGE_MASK) | ((priv) + 1))
+
+typedef struct {
+  vaddr_t tag;
+  paddr_t page;
+} TLBEntry;
+
+static TLBEntry tlb[3][TLB_SIZE];
+
+void mmu_flush() {
+  memset(tlb, 0, sizeof(tlb));
+}
+
+static bool check_perm(word_t pte, int type, int priv) {
+  if (pte & PTE_U) {
+    // S-mode never executes user pages, and accesses them only with SUM
+    if (priv == PRIV_S && (type == MEM_TYPE_IFETCH || !(cpu.mstatus & MSTATUS_SUM))) return false;
+  } else if (priv == PRIV_U) return false;
+  switch (type) {
+    case MEM_TYPE_IFETCH: return pte & PTE_X;
+    case MEM_TYPE_READ:   return (pte & PTE_R) || ((cpu.mstatus & MSTATUS_MXR) && (pte & PTE_X));
+    default:              return pte & PTE_W;
+  }
+}
+
+// with `debug', the A/D bits are left as they are
+static bool page_walk(vaddr_t vaddr, int type, int priv, bool debug, paddr_t *page) {
+  paddr_t pt = (paddr_t)SATP_PPN(cpu.satp) << PAGE_SHIFT;
+  paddr_t pte_addr;
+  word_t pte;
+  int level;
+  for (level = 1; ; level --) {
+    pte_addr = pt + VPN(vaddr, level) * 4;
+    if (!in_pmem(pte_addr)) return false;
+    pte = paddr_read(pte_addr, 4);
+    if (!(pte & PTE_V) || ((pte & PTE_W) && !(pte & PTE_R))) return false;
+    if (pte & (PTE_R | PTE_X)) break; // leaf
+    if (level == 0) return false;
+    pt = PTE_PPN(pte) << PAGE_SHIFT;
+  }
+  if (!check_perm(pte, type, priv)) return false;
+  // a superpage must be aligned to 4MiB
+  if (level == 1 && (PTE_PPN(pte) & 0x3ff)) return false;
+
+  word_t ad = PTE_A | (type == MEM_TYPE_WRITE ? PTE_D : 0);
+  if (!debug && (pte & ad) != ad) paddr_write(pte_addr, 4, pte | ad);
+
+  word_t ppn = PTE_PPN(pte);
+  if (level == 1) ppn |= VPN(vaddr, 0);
+  *page = ppn << PAGE_SHIFT;
+  return true;
+}
 
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
-  return MEM_RET_FAIL;
+  TLBEntry *e = &tlb[type][(vaddr >> PAGE_SHIFT) % TLB_SIZE];
+  vaddr_t tag = TLB_TAG(vaddr, cpu.priv);
+  if (likely(e->tag == tag)) return e->page | MEM_RET_OK;
+  paddr_t page;
+  if (!page_walk(vaddr, type, cpu.priv, false, &page)) return MEM_RET_FAIL;
+  e->tag = tag;
+  e->page = page;
+  return page | MEM_RET_OK;
+}
+
+paddr_t isa_mmu_debug_translate(vaddr_t vaddr, int type) {
+  paddr_t page;
+  return page_walk(vaddr, type, cpu.priv, true, &page) ? page | MEM_RET_OK : MEM_RET_FAIL;
+}
+
+void isa_mmu_fault(vaddr_t vaddr, int type) {
+  static const word_t cause[] = {
+    [MEM_TYPE_IFETCH] = EXC_INST_PAGE_FAULT,
+    [MEM_TYPE_READ]   = EXC_LOAD_PAGE_FAULT,
+    [MEM_TYPE_WRITE]  = EXC_STORE_PAGE_FAULT,
+  };
+  cpu.pc = raise_trap(cause[type], cpu.pc, vaddr);
 }
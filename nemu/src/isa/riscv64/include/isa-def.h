@@ -17,12 +17,63 @@
 #define __ISA_RISCV64_H__
 
 #include <common.h>
+#ifdef CONFIG_RVV
+#include <cpu/vector.h>
+#endif
 
 typedef struct {
   word_t gpr[32];
   vaddr_t pc;
+
+  word_t mstatus;
+  word_t mtvec;
+  vaddr_t mepc;
+  word_t mcause;
+  word_t mtval;
+  word_t mscratch;
+  word_t mie;
+  word_t mip;
+
+#ifdef CONFIG_FPU
+  uint64_t fpr[32]; // single precision values are NaN-boxed
+  uint32_t fcsr;    // frm in [7:5], fflags in [4:0]
+#endif
+
+#ifdef CONFIG_RVV
+  VecState vec;
+#endif
 } riscv64_CPU_state;
 
+#define CSR_MASK 0xfff
+#define CSR_FFLAGS_ADDR 0x001
+#define CSR_FRM_ADDR 0x002
+#define CSR_FCSR_ADDR 0x003
+#define CSR_VSTART_ADDR 0x008
+#define CSR_VXSAT_ADDR 0x009
+#define CSR_VXRM_ADDR 0x00a
+#define CSR_VCSR_ADDR 0x00f
+#define CSR_MSTATUS_ADDR 0x300
+#define CSR_MISA_ADDR 0x301
+#define CSR_MIE_ADDR 0x304
+#define CSR_MTVEC_ADDR 0x305
+#define CSR_MSCRATCH_ADDR 0x340
+#define CSR_MEPC_ADDR 0x341
+#define CSR_MCAUSE_ADDR 0x342
+#define CSR_MTVAL_ADDR 0x343
+#define CSR_MIP_ADDR 0x344
+#define CSR_MVENDORID_ADDR 0xf11
+#define CSR_MARCHID_ADDR 0xf12
+#define CSR_MIMPID_ADDR 0xf13
+#define CSR_MHARTID_ADDR 0xf14
+#define CSR_MCYCLE_ADDR 0xb00
+#define CSR_MINSTRET_ADDR 0xb02
+#define CSR_CYCLE_ADDR 0xc00
+#define CSR_TIME_ADDR 0xc01
+#define CSR_INSTRET_ADDR 0xc02
+#define CSR_VL_ADDR 0xc20
+#define CSR_VTYPE_ADDR 0xc21
+#define CSR_VLENB_ADDR 0xc22
+
 // decode
 typedef struct {
   union {
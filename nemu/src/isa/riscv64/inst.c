@@ -14,24 +14,87 @@
 ***************************************************************************************/
 
 #include "local-include/reg.h"
+#include "local-include/priv.h"
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/timing.h>
+#include <cpu/fpu.h>
+#include <cpu/vector.h>
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
 
+#define branch(cond) do { \
+  bool taken = (cond); \
+  IFDEF(CONFIG_PERF, perf_branch[taken] ++); \
+  if (taken) s->dnpc = s->pc + imm; \
+} while (0)
+
+#define ILLEGAL() (s->dnpc = raise_trap(EXC_ILLEGAL_INST, s->pc, s->isa.inst.val))
+
+// the result of a 32-bit operation is sign-extended to 64 bits
+#define W(x) SEXT((uint32_t)(x), 32)
+
+#define RS1 BITS(s->isa.inst.val, 19, 15)
+#define RS2 BITS(s->isa.inst.val, 24, 20)
+#define RS3 BITS(s->isa.inst.val, 31, 27)
+
+#ifdef CONFIG_FPU
+
+// a single precision operand that is not NaN-boxed reads as the canonical NaN
+#define F32(i) ((fpr(i) >> 32) == 0xffffffff ? (uint32_t)fpr(i) : F32_NAN)
+#define F64(i) fpr(i)
+#define F32W(i, val) (fpr(i) = 0xffffffff00000000ull | (uint32_t)(val))
+#define F64W(i, val) (fpr(i) = (val))
+
+// as on riscv32, see there
+#define FP(...) do { \
+  if (unlikely((cpu.mstatus & MSTATUS_FS) == 0)) { ILLEGAL(); break; } \
+  uint32_t fflags = cpu.fcsr & 0x1f; \
+  __VA_ARGS__; \
+  cpu.fcsr = (cpu.fcsr & ~0x1f) | fflags; \
+  cpu.mstatus |= MSTATUS_FS; \
+} while (0)
+
+#define FPRM(...) FP( \
+  int rm = BITS(s->isa.inst.val, 14, 12); \
+  if (rm == FRM_DYN) rm = cpu.fcsr >> 5; \
+  if (unlikely(rm > FRM_RMM)) { ILLEGAL(); break; } \
+  __VA_ARGS__)
+#endif
+
+#ifdef CONFIG_RVV
+#define VM (BITS(s->isa.inst.val, 25, 25) == 0) // masked by v0
+
+// as on riscv32, see there
+#define VEC(...) do { \
+  if (unlikely((cpu.mstatus & MSTATUS_VS) == 0 || !(__VA_ARGS__))) { ILLEGAL(); break; } \
+  cpu.mstatus |= MSTATUS_VS; \
+} while (0)
+
+#define VV(op) VEC(vec_op_vv(&cpu.vec, op, dest, RS2, RS1, VM))
+#define VX(op) VEC(vec_op_vx(&cpu.vec, op, dest, RS2, src1, VM))
+#define VI(op) VEC(vec_op_vx(&cpu.vec, op, dest, RS2, SEXT(RS1, 5), VM))
+
+#define AVL(src1) (RS1 != 0 ? (src1) : dest != 0 ? (word_t)-1 : cpu.vec.vl)
+#define VSETVL(avl, vtype) VEC((R(dest) = vec_setvl(&cpu.vec, avl, vtype), true))
+#endif
+
 enum {
-  TYPE_I, TYPE_U, TYPE_S,
+  TYPE_RR, TYPE_I, TYPE_S, TYPE_B, TYPE_U,  TYPE_J,
   TYPE_N, // none
 };
 
 #define src1R() do { *src1 = R(rs1); } while (0)
 #define src2R() do { *src2 = R(rs2); } while (0)
+
 #define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
-#define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
 #define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define immB() do { *imm = (SEXT(BITS(i, 31, 31), 1) << 12) | (BITS(i, 7, 7) << 11) | (BITS(i, 30, 25) << 5) | (BITS(i, 11, 8) << 1); } while(0)
+#define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
+#define immJ() do { *imm = (SEXT(BITS(i, 31, 31), 1) << 20) | (BITS(i, 19, 12) << 12) | (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1); } while(0)
 
 static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, word_t *imm, int type) {
   uint32_t i = s->isa.inst.val;
@@ -40,28 +103,314 @@ static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, wor
   int rs2 = BITS(i, 24, 20);
   *dest = rd;
   switch (type) {
+    case TYPE_RR: src1R(); src2R();        break;
     case TYPE_I: src1R();          immI(); break;
-    case TYPE_U:                   immU(); break;
     case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_B: src1R(); src2R(); immB(); break;
+    case TYPE_U:                   immU(); break;
+    case TYPE_J:                   immJ(); break;
   }
 }
 
+/* Division by zero and the overflowing signed division give the
+ * results defined by the ISA instead of trapping on the host.
+ */
+static inline word_t divs(int64_t a, int64_t b) {
+  return b == 0 ? -1 : (b == -1 ? -(uint64_t)a : a / b);
+}
+static inline word_t rems(int64_t a, int64_t b) {
+  return b == 0 ? a : (b == -1 ? 0 : a % b);
+}
+static inline word_t divu(uint64_t a, uint64_t b) { return b == 0 ? -1 : a / b; }
+static inline word_t remu(uint64_t a, uint64_t b) { return b == 0 ? a : a % b; }
+
+static inline word_t divsw(int32_t a, int32_t b) {
+  return W(b == 0 ? -1 : (b == -1 ? -(uint32_t)a : a / b));
+}
+static inline word_t remsw(int32_t a, int32_t b) {
+  return W(b == 0 ? a : (b == -1 ? 0 : a % b));
+}
+static inline word_t divuw(uint32_t a, uint32_t b) { return W(b == 0 ? -1 : a / b); }
+static inline word_t remuw(uint32_t a, uint32_t b) { return W(b == 0 ? a : a % b); }
+
+/* handler functions for complex instructions */
+static void csr_handler(int dest, word_t src1, word_t csr, int funct3, Decode *s);
+
+/* LR/SC: a single reservation, dropped by any SC. */
+static vaddr_t reserve_addr = 0;
+static bool reserve_valid = false;
+
+#define LR(len) do { \
+  R(dest) = SEXT(Mr(src1, len), len * 8); \
+  reserve_addr = src1; reserve_valid = true; \
+} while (0)
+
+#define SC(len) do { \
+  bool ok = reserve_valid && reserve_addr == src1; \
+  reserve_valid = false; \
+  if (ok) Mw(src1, len, src2); \
+  R(dest) = !ok; \
+} while (0)
+
+// the old value is only written back after the store, which may fault
+#define AMO(len, op) do { \
+  word_t t = SEXT(Mr(src1, len), len * 8); \
+  word_t a = t, b = src2; \
+  (void)a; \
+  Mw(src1, len, op); \
+  R(dest) = t; \
+} while (0)
+
+#define MINW(a, b) ((int32_t)(a) < (int32_t)(b) ? (a) : (b))
+#define MAXW(a, b) ((int32_t)(a) > (int32_t)(b) ? (a) : (b))
+#define MINUW(a, b) ((uint32_t)(a) < (uint32_t)(b) ? (a) : (b))
+#define MAXUW(a, b) ((uint32_t)(a) > (uint32_t)(b) ? (a) : (b))
+#define MIND(a, b) ((int64_t)(a) < (int64_t)(b) ? (a) : (b))
+#define MAXD(a, b) ((int64_t)(a) > (int64_t)(b) ? (a) : (b))
+#define MINUD(a, b) ((a) < (b) ? (a) : (b))
+#define MAXUD(a, b) ((a) > (b) ? (a) : (b))
+
 static int decode_exec(Decode *s) {
   int dest = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
   s->dnpc = s->snpc;
 
 #define INSTPAT_INST(s) ((s)->isa.inst.val)
+#define INSTPAT_CACHE(label)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
   decode_operand(s, &dest, &src1, &src2, &imm, concat(TYPE_, type)); \
   __VA_ARGS__ ; \
 }
 
   INSTPAT_START();
-  INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(dest) = s->pc + imm);
+
+  ///// RV64I
+
+  INSTPAT("0000000 ????? ????? 000 ????? 01100 11", add    , RR, R(dest) = src1 + src2);
+  INSTPAT("0100000 ????? ????? 000 ????? 01100 11", sub    , RR, R(dest) = src1 - src2);
+  INSTPAT("0000000 ????? ????? 100 ????? 01100 11", xor    , RR, R(dest) = src1 ^ src2);
+  INSTPAT("0000000 ????? ????? 110 ????? 01100 11", or     , RR, R(dest) = src1 | src2);
+  INSTPAT("0000000 ????? ????? 111 ????? 01100 11", and    , RR, R(dest) = src1 & src2);
+  INSTPAT("0000000 ????? ????? 001 ????? 01100 11", sll    , RR, R(dest) = src1 << BITS(src2, 5, 0));
+  INSTPAT("0000000 ????? ????? 101 ????? 01100 11", srl    , RR, R(dest) = src1 >> BITS(src2, 5, 0));
+  INSTPAT("0100000 ????? ????? 101 ????? 01100 11", sra    , RR, R(dest) = (sword_t)src1 >> BITS(src2, 5, 0));
+  INSTPAT("0000000 ????? ????? 010 ????? 01100 11", slt    , RR, R(dest) = (sword_t)src1 < (sword_t)src2);
+  INSTPAT("0000000 ????? ????? 011 ????? 01100 11", sltu   , RR, R(dest) = src1 < src2);
+
+  INSTPAT("??????? ????? ????? 000 ????? 00100 11", addi   , I, R(dest) = src1 + imm);
+  INSTPAT("??????? ????? ????? 100 ????? 00100 11", xori   , I, R(dest) = src1 ^ imm);
+  INSTPAT("??????? ????? ????? 110 ????? 00100 11", ori    , I, R(dest) = src1 | imm);
+  INSTPAT("??????? ????? ????? 111 ????? 00100 11", andi   , I, R(dest) = src1 & imm);
+  INSTPAT("000000? ????? ????? 001 ????? 00100 11", slli   , I, R(dest) = src1 << BITS(imm, 5, 0));
+  INSTPAT("000000? ????? ????? 101 ????? 00100 11", srli   , I, R(dest) = src1 >> BITS(imm, 5, 0));
+  INSTPAT("010000? ????? ????? 101 ????? 00100 11", srai   , I, R(dest) = (sword_t)src1 >> BITS(imm, 5, 0));
+  INSTPAT("??????? ????? ????? 010 ????? 00100 11", slti   , I, R(dest) = (sword_t)src1 < (sword_t)imm);
+  INSTPAT("??????? ????? ????? 011 ????? 00100 11", sltiu  , I, R(dest) = src1 < imm);
+
+  INSTPAT("0000000 ????? ????? 000 ????? 01110 11", addw   , RR, R(dest) = W(src1 + src2));
+  INSTPAT("0100000 ????? ????? 000 ????? 01110 11", subw   , RR, R(dest) = W(src1 - src2));
+  INSTPAT("0000000 ????? ????? 001 ????? 01110 11", sllw   , RR, R(dest) = W((uint32_t)src1 << BITS(src2, 4, 0)));
+  INSTPAT("0000000 ????? ????? 101 ????? 01110 11", srlw   , RR, R(dest) = W((uint32_t)src1 >> BITS(src2, 4, 0)));
+  INSTPAT("0100000 ????? ????? 101 ????? 01110 11", sraw   , RR, R(dest) = W((int32_t)src1 >> BITS(src2, 4, 0)));
+  INSTPAT("??????? ????? ????? 000 ????? 00110 11", addiw  , I, R(dest) = W(src1 + imm));
+  INSTPAT("0000000 ????? ????? 001 ????? 00110 11", slliw  , I, R(dest) = W((uint32_t)src1 << BITS(imm, 4, 0)));
+  INSTPAT("0000000 ????? ????? 101 ????? 00110 11", srliw  , I, R(dest) = W((uint32_t)src1 >> BITS(imm, 4, 0)));
+  INSTPAT("0100000 ????? ????? 101 ????? 00110 11", sraiw  , I, R(dest) = W((int32_t)src1 >> BITS(imm, 4, 0)));
+
+  INSTPAT("??????? ????? ????? 000 ????? 00000 11", lb     , I, R(dest) = SEXT(Mr(src1 + imm, 1), 8));
+  INSTPAT("??????? ????? ????? 001 ????? 00000 11", lh     , I, R(dest) = SEXT(Mr(src1 + imm, 2), 16));
+  INSTPAT("??????? ????? ????? 010 ????? 00000 11", lw     , I, R(dest) = SEXT(Mr(src1 + imm, 4), 32));
   INSTPAT("??????? ????? ????? 011 ????? 00000 11", ld     , I, R(dest) = Mr(src1 + imm, 8));
+  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(dest) = Mr(src1 + imm, 1));
+  INSTPAT("??????? ????? ????? 101 ????? 00000 11", lhu    , I, R(dest) = Mr(src1 + imm, 2));
+  INSTPAT("??????? ????? ????? 110 ????? 00000 11", lwu    , I, R(dest) = Mr(src1 + imm, 4));
+
+  INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, BITS(src2, 7, 0)));
+  INSTPAT("??????? ????? ????? 001 ????? 01000 11", sh     , S, Mw(src1 + imm, 2, BITS(src2, 15, 0)));
+  INSTPAT("??????? ????? ????? 010 ????? 01000 11", sw     , S, Mw(src1 + imm, 4, BITS(src2, 31, 0)));
   INSTPAT("??????? ????? ????? 011 ????? 01000 11", sd     , S, Mw(src1 + imm, 8, src2));
 
+  INSTPAT("??????? ????? ????? 000 ????? 11000 11", beq    , B, branch(src1 == src2));
+  INSTPAT("??????? ????? ????? 001 ????? 11000 11", bne    , B, branch(src1 != src2));
+  INSTPAT("??????? ????? ????? 100 ????? 11000 11", blt    , B, branch((sword_t)src1 < (sword_t)src2));
+  INSTPAT("??????? ????? ????? 101 ????? 11000 11", bge    , B, branch((sword_t)src1 >= (sword_t)src2));
+  INSTPAT("??????? ????? ????? 110 ????? 11000 11", bltu   , B, branch(src1 < src2));
+  INSTPAT("??????? ????? ????? 111 ????? 11000 11", bgeu   , B, branch(src1 >= src2));
+
+  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal    , J, R(dest) = s->snpc; s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr   , I, R(dest) = s->snpc; s->dnpc = (src1 + imm) & ~(word_t)1);
+
+  INSTPAT("??????? ????? ????? ??? ????? 01101 11", lui    , U, R(dest) = imm);
+  INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(dest) = s->pc + imm);
+
+  INSTPAT("??????? ????? ????? 000 ????? 00011 11", fence  , N, );
+  INSTPAT("??????? ????? ????? 001 ????? 00011 11", fence.i, N, );
+
+  ///// RV64M
+
+  INSTPAT("0000001 ????? ????? 000 ????? 01100 11", mul    , RR, R(dest) = src1 * src2);
+  INSTPAT("0000001 ????? ????? 001 ????? 01100 11", mulh   , RR, R(dest) = ((__int128)(sword_t)src1 * (__int128)(sword_t)src2) >> 64);
+  INSTPAT("0000001 ????? ????? 010 ????? 01100 11", mulhsu , RR, R(dest) = ((__int128)(sword_t)src1 * (__int128)src2) >> 64);
+  INSTPAT("0000001 ????? ????? 011 ????? 01100 11", mulhu  , RR, R(dest) = ((unsigned __int128)src1 * src2) >> 64);
+  INSTPAT("0000001 ????? ????? 100 ????? 01100 11", div    , RR, R(dest) = divs(src1, src2));
+  INSTPAT("0000001 ????? ????? 101 ????? 01100 11", divu   , RR, R(dest) = divu(src1, src2));
+  INSTPAT("0000001 ????? ????? 110 ????? 01100 11", rem    , RR, R(dest) = rems(src1, src2));
+  INSTPAT("0000001 ????? ????? 111 ????? 01100 11", remu   , RR, R(dest) = remu(src1, src2));
+  INSTPAT("0000001 ????? ????? 000 ????? 01110 11", mulw   , RR, R(dest) = W(src1 * src2));
+  INSTPAT("0000001 ????? ????? 100 ????? 01110 11", divw   , RR, R(dest) = divsw(src1, src2));
+  INSTPAT("0000001 ????? ????? 101 ????? 01110 11", divuw  , RR, R(dest) = divuw(src1, src2));
+  INSTPAT("0000001 ????? ????? 110 ????? 01110 11", remw   , RR, R(dest) = remsw(src1, src2));
+  INSTPAT("0000001 ????? ????? 111 ????? 01110 11", remuw  , RR, R(dest) = remuw(src1, src2));
+
+  ///// RV64A
+
+  INSTPAT("00010?? 00000 ????? 010 ????? 01011 11", lr.w     , RR, LR(4));
+  INSTPAT("00011?? ????? ????? 010 ????? 01011 11", sc.w     , RR, SC(4));
+  INSTPAT("00001?? ????? ????? 010 ????? 01011 11", amoswap.w, RR, AMO(4, b));
+  INSTPAT("00000?? ????? ????? 010 ????? 01011 11", amoadd.w , RR, AMO(4, a + b));
+  INSTPAT("00100?? ????? ????? 010 ????? 01011 11", amoxor.w , RR, AMO(4, a ^ b));
+  INSTPAT("01100?? ????? ????? 010 ????? 01011 11", amoand.w , RR, AMO(4, a & b));
+  INSTPAT("01000?? ????? ????? 010 ????? 01011 11", amoor.w  , RR, AMO(4, a | b));
+  INSTPAT("10000?? ????? ????? 010 ????? 01011 11", amomin.w , RR, AMO(4, MINW(a, b)));
+  INSTPAT("10100?? ????? ????? 010 ????? 01011 11", amomax.w , RR, AMO(4, MAXW(a, b)));
+  INSTPAT("11000?? ????? ????? 010 ????? 01011 11", amominu.w, RR, AMO(4, MINUW(a, b)));
+  INSTPAT("11100?? ????? ????? 010 ????? 01011 11", amomaxu.w, RR, AMO(4, MAXUW(a, b)));
+  INSTPAT("00010?? 00000 ????? 011 ????? 01011 11", lr.d     , RR, LR(8));
+  INSTPAT("00011?? ????? ????? 011 ????? 01011 11", sc.d     , RR, SC(8));
+  INSTPAT("00001?? ????? ????? 011 ????? 01011 11", amoswap.d, RR, AMO(8, b));
+  INSTPAT("00000?? ????? ????? 011 ????? 01011 11", amoadd.d , RR, AMO(8, a + b));
+  INSTPAT("00100?? ????? ????? 011 ????? 01011 11", amoxor.d , RR, AMO(8, a ^ b));
+  INSTPAT("01100?? ????? ????? 011 ????? 01011 11", amoand.d , RR, AMO(8, a & b));
+  INSTPAT("01000?? ????? ????? 011 ????? 01011 11", amoor.d  , RR, AMO(8, a | b));
+  INSTPAT("10000?? ????? ????? 011 ????? 01011 11", amomin.d , RR, AMO(8, MIND(a, b)));
+  INSTPAT("10100?? ????? ????? 011 ????? 01011 11", amomax.d , RR, AMO(8, MAXD(a, b)));
+  INSTPAT("11000?? ????? ????? 011 ????? 01011 11", amominu.d, RR, AMO(8, MINUD(a, b)));
+  INSTPAT("11100?? ????? ????? 011 ????? 01011 11", amomaxu.d, RR, AMO(8, MAXUD(a, b)));
+
+#ifdef CONFIG_FPU
+  ///// RV64F
+
+  INSTPAT("??????? ????? ????? 010 ????? 00001 11", flw    , I, FP(F32W(dest, Mr(src1 + imm, 4))));
+  INSTPAT("??????? ????? ????? 010 ????? 01001 11", fsw    , S, FP(Mw(src1 + imm, 4, (uint32_t)F64(RS2))));
+
+  INSTPAT("?????00 ????? ????? ??? ????? 10000 11", fmadd.s , N, FPRM(F32W(dest, f32_fma(F32(RS1), F32(RS2), F32(RS3), rm, &fflags))));
+  INSTPAT("?????00 ????? ????? ??? ????? 10001 11", fmsub.s , N, FPRM(F32W(dest, f32_fma(F32(RS1), F32(RS2), F32(RS3) ^ F32_SIGN, rm, &fflags))));
+  INSTPAT("?????00 ????? ????? ??? ????? 10010 11", fnmsub.s, N, FPRM(F32W(dest, f32_fma(F32(RS1) ^ F32_SIGN, F32(RS2), F32(RS3), rm, &fflags))));
+  INSTPAT("?????00 ????? ????? ??? ????? 10011 11", fnmadd.s, N, FPRM(F32W(dest, f32_fma(F32(RS1) ^ F32_SIGN, F32(RS2), F32(RS3) ^ F32_SIGN, rm, &fflags))));
+
+  INSTPAT("0000000 ????? ????? ??? ????? 10100 11", fadd.s , N, FPRM(F32W(dest, f32_add(F32(RS1), F32(RS2), rm, &fflags))));
+  INSTPAT("0000100 ????? ????? ??? ????? 10100 11", fsub.s , N, FPRM(F32W(dest, f32_sub(F32(RS1), F32(RS2), rm, &fflags))));
+  INSTPAT("0001000 ????? ????? ??? ????? 10100 11", fmul.s , N, FPRM(F32W(dest, f32_mul(F32(RS1), F32(RS2), rm, &fflags))));
+  INSTPAT("0001100 ????? ????? ??? ????? 10100 11", fdiv.s , N, FPRM(F32W(dest, f32_div(F32(RS1), F32(RS2), rm, &fflags))));
+  INSTPAT("0101100 00000 ????? ??? ????? 10100 11", fsqrt.s, N, FPRM(F32W(dest, f32_sqrt(F32(RS1), rm, &fflags))));
+  INSTPAT("0010000 ????? ????? 000 ????? 10100 11", fsgnj.s, N, FP(F32W(dest, (F32(RS1) & ~F32_SIGN) | (F32(RS2) & F32_SIGN))));
+  INSTPAT("0010000 ????? ????? 001 ????? 10100 11", fsgnjn.s, N, FP(F32W(dest, (F32(RS1) & ~F32_SIGN) | (~F32(RS2) & F32_SIGN))));
+  INSTPAT("0010000 ????? ????? 010 ????? 10100 11", fsgnjx.s, N, FP(F32W(dest, F32(RS1) ^ (F32(RS2) & F32_SIGN))));
+  INSTPAT("0010100 ????? ????? 000 ????? 10100 11", fmin.s , N, FP(F32W(dest, f32_min(F32(RS1), F32(RS2), &fflags))));
+  INSTPAT("0010100 ????? ????? 001 ????? 10100 11", fmax.s , N, FP(F32W(dest, f32_max(F32(RS1), F32(RS2), &fflags))));
+  INSTPAT("1100000 00000 ????? ??? ????? 10100 11", fcvt.w.s, N, FPRM(R(dest) = W(f32_to_i32(F32(RS1), rm, &fflags))));
+  INSTPAT("1100000 00001 ????? ??? ????? 10100 11", fcvt.wu.s, N, FPRM(R(dest) = W(f32_to_u32(F32(RS1), rm, &fflags))));
+  INSTPAT("1100000 00010 ????? ??? ????? 10100 11", fcvt.l.s, N, FPRM(R(dest) = f32_to_i64(F32(RS1), rm, &fflags)));
+  INSTPAT("1100000 00011 ????? ??? ????? 10100 11", fcvt.lu.s, N, FPRM(R(dest) = f32_to_u64(F32(RS1), rm, &fflags)));
+  INSTPAT("1110000 00000 ????? 000 ????? 10100 11", fmv.x.w, N, FP(R(dest) = W(F64(RS1))));
+  INSTPAT("1010000 ????? ????? 010 ????? 10100 11", feq.s  , N, FP(R(dest) = f32_eq(F32(RS1), F32(RS2), &fflags)));
+  INSTPAT("1010000 ????? ????? 001 ????? 10100 11", flt.s  , N, FP(R(dest) = f32_lt(F32(RS1), F32(RS2), &fflags)));
+  INSTPAT("1010000 ????? ????? 000 ????? 10100 11", fle.s  , N, FP(R(dest) = f32_le(F32(RS1), F32(RS2), &fflags)));
+  INSTPAT("1110000 00000 ????? 001 ????? 10100 11", fclass.s, N, FP(R(dest) = f32_class(F32(RS1))));
+  INSTPAT("1101000 00000 ????? ??? ????? 10100 11", fcvt.s.w, I, FPRM(F32W(dest, i64_to_f32((int32_t)src1, rm, &fflags))));
+  INSTPAT("1101000 00001 ????? ??? ????? 10100 11", fcvt.s.wu, I, FPRM(F32W(dest, u64_to_f32((uint32_t)src1, rm, &fflags))));
+  INSTPAT("1101000 00010 ????? ??? ????? 10100 11", fcvt.s.l, I, FPRM(F32W(dest, i64_to_f32(src1, rm, &fflags))));
+  INSTPAT("1101000 00011 ????? ??? ????? 10100 11", fcvt.s.lu, I, FPRM(F32W(dest, u64_to_f32(src1, rm, &fflags))));
+  INSTPAT("1111000 00000 ????? 000 ????? 10100 11", fmv.w.x, I, FP(F32W(dest, src1)));
+
+  ///// RV64D
+
+  INSTPAT("??????? ????? ????? 011 ????? 00001 11", fld    , I, FP(F64W(dest, Mr(src1 + imm, 8))));
+  INSTPAT("??????? ????? ????? 011 ????? 01001 11", fsd    , S, FP(Mw(src1 + imm, 8, F64(RS2))));
+
+  INSTPAT("?????01 ????? ????? ??? ????? 10000 11", fmadd.d , N, FPRM(F64W(dest, f64_fma(F64(RS1), F64(RS2), F64(RS3), rm, &fflags))));
+  INSTPAT("?????01 ????? ????? ??? ????? 10001 11", fmsub.d , N, FPRM(F64W(dest, f64_fma(F64(RS1), F64(RS2), F64(RS3) ^ F64_SIGN, rm, &fflags))));
+  INSTPAT("?????01 ????? ????? ??? ????? 10010 11", fnmsub.d, N, FPRM(F64W(dest, f64_fma(F64(RS1) ^ F64_SIGN, F64(RS2), F64(RS3), rm, &fflags))));
+  INSTPAT("?????01 ????? ????? ??? ????? 10011 11", fnmadd.d, N, FPRM(F64W(dest, f64_fma(F64(RS1) ^ F64_SIGN, F64(RS2), F64(RS3) ^ F64_SIGN, rm, &fflags))));
+
+  INSTPAT("0000001 ????? ????? ??? ????? 10100 11", fadd.d , N, FPRM(F64W(dest, f64_add(F64(RS1), F64(RS2), rm, &fflags))));
+  INSTPAT("0000101 ????? ????? ??? ????? 10100 11", fsub.d , N, FPRM(F64W(dest, f64_sub(F64(RS1), F64(RS2), rm, &fflags))));
+  INSTPAT("0001001 ????? ????? ??? ????? 10100 11", fmul.d , N, FPRM(F64W(dest, f64_mul(F64(RS1), F64(RS2), rm, &fflags))));
+  INSTPAT("0001101 ????? ????? ??? ????? 10100 11", fdiv.d , N, FPRM(F64W(dest, f64_div(F64(RS1), F64(RS2), rm, &fflags))));
+  INSTPAT("0101101 00000 ????? ??? ????? 10100 11", fsqrt.d, N, FPRM(F64W(dest, f64_sqrt(F64(RS1), rm, &fflags))));
+  INSTPAT("0010001 ????? ????? 000 ????? 10100 11", fsgnj.d, N, FP(F64W(dest, (F64(RS1) & ~F64_SIGN) | (F64(RS2) & F64_SIGN))));
+  INSTPAT("0010001 ????? ????? 001 ????? 10100 11", fsgnjn.d, N, FP(F64W(dest, (F64(RS1) & ~F64_SIGN) | (~F64(RS2) & F64_SIGN))));
+  INSTPAT("0010001 ????? ????? 010 ????? 10100 11", fsgnjx.d, N, FP(F64W(dest, F64(RS1) ^ (F64(RS2) & F64_SIGN))));
+  INSTPAT("0010101 ????? ????? 000 ????? 10100 11", fmin.d , N, FP(F64W(dest, f64_min(F64(RS1), F64(RS2), &fflags))));
+  INSTPAT("0010101 ????? ????? 001 ????? 10100 11", fmax.d , N, FP(F64W(dest, f64_max(F64(RS1), F64(RS2), &fflags))));
+  INSTPAT("0100000 00001 ????? ??? ????? 10100 11", fcvt.s.d, N, FPRM(F32W(dest, f64_to_f32(F64(RS1), rm, &fflags))));
+  INSTPAT("0100001 00000 ????? ??? ????? 10100 11", fcvt.d.s, N, FPRM(F64W(dest, f32_to_f64(F32(RS1), &fflags))));
+  INSTPAT("1010001 ????? ????? 010 ????? 10100 11", feq.d  , N, FP(R(dest) = f64_eq(F64(RS1), F64(RS2), &fflags)));
+  INSTPAT("1010001 ????? ????? 001 ????? 10100 11", flt.d  , N, FP(R(dest) = f64_lt(F64(RS1), F64(RS2), &fflags)));
+  INSTPAT("1010001 ????? ????? 000 ????? 10100 11", fle.d  , N, FP(R(dest) = f64_le(F64(RS1), F64(RS2), &fflags)));
+  INSTPAT("1110001 00000 ????? 001 ????? 10100 11", fclass.d, N, FP(R(dest) = f64_class(F64(RS1))));
+  INSTPAT("1100001 00000 ????? ??? ????? 10100 11", fcvt.w.d, N, FPRM(R(dest) = W(f64_to_i32(F64(RS1), rm, &fflags))));
+  INSTPAT("1100001 00001 ????? ??? ????? 10100 11", fcvt.wu.d, N, FPRM(R(dest) = W(f64_to_u32(F64(RS1), rm, &fflags))));
+  INSTPAT("1100001 00010 ????? ??? ????? 10100 11", fcvt.l.d, N, FPRM(R(dest) = f64_to_i64(F64(RS1), rm, &fflags)));
+  INSTPAT("1100001 00011 ????? ??? ????? 10100 11", fcvt.lu.d, N, FPRM(R(dest) = f64_to_u64(F64(RS1), rm, &fflags)));
+  INSTPAT("1110001 00000 ????? 000 ????? 10100 11", fmv.x.d, N, FP(R(dest) = F64(RS1)));
+  INSTPAT("1101001 00000 ????? ??? ????? 10100 11", fcvt.d.w, I, FPRM(F64W(dest, i64_to_f64((int32_t)src1, rm, &fflags))));
+  INSTPAT("1101001 00001 ????? ??? ????? 10100 11", fcvt.d.wu, I, FPRM(F64W(dest, u64_to_f64((uint32_t)src1, rm, &fflags))));
+  INSTPAT("1101001 00010 ????? ??? ????? 10100 11", fcvt.d.l, I, FPRM(F64W(dest, i64_to_f64(src1, rm, &fflags))));
+  INSTPAT("1101001 00011 ????? ??? ????? 10100 11", fcvt.d.lu, I, FPRM(F64W(dest, u64_to_f64(src1, rm, &fflags))));
+  INSTPAT("1111001 00000 ????? 000 ????? 10100 11", fmv.d.x, I, FP(F64W(dest, src1)));
+#endif
+
+#ifdef CONFIG_RVV
+  ///// V, the subset of Zve32x in cpu/vector.h
+
+  INSTPAT("0?????? ????? ????? 111 ????? 10101 11", vsetvli , I, VSETVL(AVL(src1), BITS(imm, 10, 0)));
+  INSTPAT("11????? ????? ????? 111 ????? 10101 11", vsetivli, N, VSETVL(RS1, BITS(s->isa.inst.val, 29, 20)));
+  INSTPAT("1000000 ????? ????? 111 ????? 10101 11", vsetvl  , RR, VSETVL(AVL(src1), src2));
+
+  INSTPAT("000000? 00000 ????? 000 ????? 00001 11", vle8.v  , I, VEC(vec_load(&cpu.vec, dest, src1, 0, VM)));
+  INSTPAT("000000? 00000 ????? 101 ????? 00001 11", vle16.v , I, VEC(vec_load(&cpu.vec, dest, src1, 1, VM)));
+  INSTPAT("000000? 00000 ????? 110 ????? 00001 11", vle32.v , I, VEC(vec_load(&cpu.vec, dest, src1, 2, VM)));
+  INSTPAT("000000? 00000 ????? 000 ????? 01001 11", vse8.v  , I, VEC(vec_store(&cpu.vec, dest, src1, 0, VM)));
+  INSTPAT("000000? 00000 ????? 101 ????? 01001 11", vse16.v , I, VEC(vec_store(&cpu.vec, dest, src1, 1, VM)));
+  INSTPAT("000000? 00000 ????? 110 ????? 01001 11", vse32.v , I, VEC(vec_store(&cpu.vec, dest, src1, 2, VM)));
+
+  INSTPAT("000000? ????? ????? 000 ????? 10101 11", vadd.vv , N, VV(VOP_ADD));
+  INSTPAT("000000? ????? ????? 100 ????? 10101 11", vadd.vx , I, VX(VOP_ADD));
+  INSTPAT("000000? ????? ????? 011 ????? 10101 11", vadd.vi , N, VI(VOP_ADD));
+  INSTPAT("000010? ????? ????? 000 ????? 10101 11", vsub.vv , N, VV(VOP_SUB));
+  INSTPAT("000010? ????? ????? 100 ????? 10101 11", vsub.vx , I, VX(VOP_SUB));
+  INSTPAT("000011? ????? ????? 100 ????? 10101 11", vrsub.vx, I, VX(VOP_RSUB));
+  INSTPAT("000011? ????? ????? 011 ????? 10101 11", vrsub.vi, N, VI(VOP_RSUB));
+  INSTPAT("001001? ????? ????? 000 ????? 10101 11", vand.vv , N, VV(VOP_AND));
+  INSTPAT("001001? ????? ????? 100 ????? 10101 11", vand.vx , I, VX(VOP_AND));
+  INSTPAT("001001? ????? ????? 011 ????? 10101 11", vand.vi , N, VI(VOP_AND));
+  INSTPAT("001010? ????? ????? 000 ????? 10101 11", vor.vv  , N, VV(VOP_OR));
+  INSTPAT("001010? ????? ????? 100 ????? 10101 11", vor.vx  , I, VX(VOP_OR));
+  INSTPAT("001010? ????? ????? 011 ????? 10101 11", vor.vi  , N, VI(VOP_OR));
+  INSTPAT("001011? ????? ????? 000 ????? 10101 11", vxor.vv , N, VV(VOP_XOR));
+  INSTPAT("001011? ????? ????? 100 ????? 10101 11", vxor.vx , I, VX(VOP_XOR));
+  INSTPAT("001011? ????? ????? 011 ????? 10101 11", vxor.vi , N, VI(VOP_XOR));
+  INSTPAT("100101? ????? ????? 010 ????? 10101 11", vmul.vv , N, VV(VOP_MUL));
+  INSTPAT("100101? ????? ????? 110 ????? 10101 11", vmul.vx , I, VX(VOP_MUL));
+  INSTPAT("0101111 00000 ????? 000 ????? 10101 11", vmv.v.v , N, VV(VOP_MV));
+  INSTPAT("0101111 00000 ????? 100 ????? 10101 11", vmv.v.x , I, VX(VOP_MV));
+  INSTPAT("0101111 00000 ????? 011 ????? 10101 11", vmv.v.i , N, VI(VOP_MV));
+#endif
+
+  ///// Special
+
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw  , I, csr_handler(dest, src1, imm & CSR_MASK, 1, s));
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs  , I, csr_handler(dest, src1, imm & CSR_MASK, 2, s));
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc  , I, csr_handler(dest, src1, imm & CSR_MASK, 3, s));
+  INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi , I, csr_handler(dest, BITS(s->isa.inst.val, 19, 15), imm & CSR_MASK, 5, s));
+  INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi , I, csr_handler(dest, BITS(s->isa.inst.val, 19, 15), imm & CSR_MASK, 6, s));
+  INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci , I, csr_handler(dest, BITS(s->isa.inst.val, 19, 15), imm & CSR_MASK, 7, s));
+
+  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall  , N, s->dnpc = raise_trap(EXC_ECALL_M, s->pc, 0));
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret   , N, s->dnpc = trap_return_m());
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi    , N, );
+
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
@@ -75,3 +424,46 @@ int isa_exec_once(Decode *s) {
   s->isa.inst.val = inst_fetch(&s->snpc, 4);
   return decode_exec(s);
 }
+
+#ifdef CONFIG_TIMING
+int isa_inst_class(Decode *s) {
+  uint32_t i = s->isa.inst.val;
+  switch (BITS(i, 6, 0)) {
+    case 0x03: case 0x07: return INST_LOAD;
+    case 0x2f: return INST_LOAD; // AMOs are charged as loads
+    case 0x23: case 0x27: return INST_STORE;
+    case 0x63: return INST_BRANCH;
+    case 0x6f: return INST_JUMP;
+    case 0x67: return INST_IJUMP;
+    case 0x73: return INST_SYSTEM;
+    case 0x33: case 0x3b:
+      // funct7 = 1 selects RV64M, where funct3 >= 4 are div/rem
+      if (BITS(i, 31, 25) == 1) return BITS(i, 14, 14) ? INST_DIV : INST_MUL;
+      return INST_ALU;
+    // fused multiply-adds, and fdiv and fsqrt
+    case 0x43: case 0x47: case 0x4b: case 0x4f: return INST_MUL;
+    case 0x53: return (BITS(i, 31, 27) == 0x03 || BITS(i, 31, 27) == 0x0b) ? INST_DIV : INST_ALU;
+    // vmul, in OPMVV or OPMVX
+    case 0x57: return (BITS(i, 31, 26) == 0x25 && BITS(i, 13, 12) == 2) ? INST_MUL : INST_ALU;
+    default: return INST_ALU;
+  }
+}
+#endif
+
+/* handler functions for complex instructions */
+
+/* funct3 selects the operation: 1/5 write, 2/6 set, 3/7 clear bits,
+ * where the latter take a 5-bit immediate in place of src1. A set or
+ * clear with rs1 (or the immediate) being zero does not write the CSR.
+ * An unknown CSR, or a write to a read-only one, is an illegal instruction.
+ */
+static void csr_handler(int dest, word_t src1, word_t csr, int funct3, Decode *s) {
+  bool is_write = (funct3 & 3) == 1 || BITS(s->isa.inst.val, 19, 15) != 0;
+  word_t old;
+  if (!csr_permit(csr, is_write) || !csr_read(csr, &old)) { ILLEGAL(); return; }
+  if (is_write) {
+    word_t val = (funct3 & 3) == 1 ? src1 : (funct3 & 3) == 2 ? old | src1 : old & ~src1;
+    if (!csr_write(csr, val)) { ILLEGAL(); return; }
+  }
+  R(dest) = old;
+}
@@ -0,0 +1,52 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __RISCV64_PRIV_H__
+#define __RISCV64_PRIV_H__
+
+#include <isa.h>
+#include <cpu/cpu.h>
+
+/* Only M-mode is implemented, so MPP always reads as M and there are
+ * no delegation or S-mode registers.
+ */
+#define MSTATUS_MIE  (1ull << 3)
+#define MSTATUS_MPIE (1ull << 7)
+#define MSTATUS_MPP  (3ull << 11)
+#define MSTATUS_VS   (3ull << 9)
+#define MSTATUS_FS   (3ull << 13)
+#define MSTATUS_SD   (1ull << 63)
+
+enum {
+  EXC_INST_MISALIGNED, EXC_INST_ACCESS, EXC_ILLEGAL_INST, EXC_BREAKPOINT,
+  EXC_LOAD_MISALIGNED, EXC_LOAD_ACCESS, EXC_STORE_MISALIGNED, EXC_STORE_ACCESS,
+  EXC_ECALL_M = 11,
+};
+
+#define INTR_BIT (1ull << 63)
+
+vaddr_t raise_trap(word_t NO, vaddr_t epc, word_t tval);
+vaddr_t trap_return_m();
+
+bool csr_permit(word_t csr, bool is_write);
+bool csr_read(word_t csr, word_t *val);
+bool csr_write(word_t csr, word_t val);
+
+// a pending interrupt may have become enabled after a change of the CSRs
+static inline void intr_recheck() {
+  if (cpu.mip & cpu.mie) cpu_schedule_event(0);
+}
+
+#endif
@@ -0,0 +1,126 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/timing.h>
+#include "../local-include/priv.h"
+
+#define MSTATUS_MASK (MSTATUS_MIE | MSTATUS_MPIE | MUXDEF(CONFIG_FPU, MSTATUS_FS, 0) | \
+    MUXDEF(CONFIG_RVV, MSTATUS_VS, 0))
+
+// MSIP/MTIP/MEIP
+#define MIP_MASK ((1ull << 3) | (1ull << 7) | (1ull << 11))
+
+// MXL = 2 (64-bit), with extensions I, M, A and maybe F and D
+#define MISA_VALUE ((2ull << 62) | (1ull << ('I' - 'A')) | (1ull << ('M' - 'A')) | (1ull << ('A' - 'A')) | \
+    MUXDEF(CONFIG_FPU, (1ull << ('F' - 'A')) | (1ull << ('D' - 'A')), 0))
+
+/* As on riscv32, the counters are derived from g_nr_guest_inst, or
+ * from the cycles of the timing model, and writes move a bias.
+ */
+extern uint64_t g_nr_guest_inst;
+static uint64_t mcycle_bias = 0, minstret_bias = 0;
+
+static inline uint64_t get_mcycle() {
+  return MUXDEF(CONFIG_TIMING, g_nr_guest_cycle, g_nr_guest_inst * CONFIG_CYCLES_PER_INST) + mcycle_bias;
+}
+static inline uint64_t get_minstret() { return g_nr_guest_inst + minstret_bias; }
+
+#ifdef CONFIG_HAS_CLINT
+uint64_t clint_mtime();
+#define get_mtime() clint_mtime()
+#else
+#define get_mtime() get_time()
+#endif
+
+#define IS_VEC_CSR(csr) (((csr) >= CSR_VSTART_ADDR && (csr) <= CSR_VCSR_ADDR) || \
+    ((csr) >= CSR_VL_ADDR && (csr) <= CSR_VLENB_ADDR))
+
+/* csr[11:10] = 3 marks a read-only CSR. The floating-point and the
+ * vector CSRs are not accessible while mstatus.FS or VS is off.
+ */
+bool csr_permit(word_t csr, bool is_write) {
+  if (csr <= CSR_FCSR_ADDR && (cpu.mstatus & MSTATUS_FS) == 0) return false;
+  if (IS_VEC_CSR(csr) && (cpu.mstatus & MSTATUS_VS) == 0) return false;
+  return !(is_write && BITS(csr, 11, 10) == 3);
+}
+
+bool csr_read(word_t csr, word_t *val) {
+  switch (csr) {
+    case CSR_MSTATUS_ADDR:   *val = cpu.mstatus | MSTATUS_MPP |
+                                 ((cpu.mstatus & MSTATUS_FS) == MSTATUS_FS ||
+                                  (cpu.mstatus & MSTATUS_VS) == MSTATUS_VS ? MSTATUS_SD : 0); break;
+    case CSR_MISA_ADDR:      *val = MISA_VALUE; break;
+    case CSR_MIE_ADDR:       *val = cpu.mie; break;
+    case CSR_MTVEC_ADDR:     *val = cpu.mtvec; break;
+    case CSR_MSCRATCH_ADDR:  *val = cpu.mscratch; break;
+    case CSR_MEPC_ADDR:      *val = cpu.mepc; break;
+    case CSR_MCAUSE_ADDR:    *val = cpu.mcause; break;
+    case CSR_MTVAL_ADDR:     *val = cpu.mtval; break;
+    case CSR_MIP_ADDR:       *val = cpu.mip; break;
+    case CSR_MVENDORID_ADDR: case CSR_MARCHID_ADDR:
+    case CSR_MIMPID_ADDR:    case CSR_MHARTID_ADDR: *val = 0; break;
+    case CSR_MCYCLE_ADDR:    case CSR_CYCLE_ADDR:   *val = get_mcycle(); break;
+    case CSR_MINSTRET_ADDR:  case CSR_INSTRET_ADDR: *val = get_minstret(); break;
+    case CSR_TIME_ADDR:      *val = get_mtime(); break;
+#ifdef CONFIG_FPU
+    case CSR_FFLAGS_ADDR:    *val = cpu.fcsr & 0x1f; break;
+    case CSR_FRM_ADDR:       *val = cpu.fcsr >> 5; break;
+    case CSR_FCSR_ADDR:      *val = cpu.fcsr; break;
+#endif
+#ifdef CONFIG_RVV
+    case CSR_VSTART_ADDR:    *val = cpu.vec.vstart; break;
+    case CSR_VXSAT_ADDR:     *val = cpu.vec.vcsr & 1; break;
+    case CSR_VXRM_ADDR:      *val = cpu.vec.vcsr >> 1; break;
+    case CSR_VCSR_ADDR:      *val = cpu.vec.vcsr; break;
+    case CSR_VL_ADDR:        *val = cpu.vec.vl; break;
+    case CSR_VTYPE_ADDR:     *val = cpu.vec.vtype; break;
+    case CSR_VLENB_ADDR:     *val = VLENB; break;
+#endif
+    default: return false;
+  }
+  return true;
+}
+
+bool csr_write(word_t csr, word_t val) {
+  switch (csr) {
+    case CSR_MSTATUS_ADDR:  cpu.mstatus = val & MSTATUS_MASK; break;
+    case CSR_MISA_ADDR:     break;
+    case CSR_MIE_ADDR:      cpu.mie = val & MIP_MASK; break;
+    case CSR_MTVEC_ADDR:    cpu.mtvec = val; break;
+    case CSR_MSCRATCH_ADDR: cpu.mscratch = val; break;
+    case CSR_MEPC_ADDR:     cpu.mepc = val; break;
+    case CSR_MCAUSE_ADDR:   cpu.mcause = val; break;
+    case CSR_MTVAL_ADDR:    cpu.mtval = val; break;
+    // the interrupt lines are driven by the devices
+    case CSR_MIP_ADDR:      break;
+    case CSR_MCYCLE_ADDR:   mcycle_bias += val - get_mcycle(); break;
+    case CSR_MINSTRET_ADDR: minstret_bias += val - get_minstret(); break;
+#ifdef CONFIG_FPU
+    case CSR_FFLAGS_ADDR:   cpu.fcsr = (cpu.fcsr & ~0x1f) | (val & 0x1f); cpu.mstatus |= MSTATUS_FS; break;
+    case CSR_FRM_ADDR:      cpu.fcsr = (cpu.fcsr & 0x1f) | ((val & 0x7) << 5); cpu.mstatus |= MSTATUS_FS; break;
+    case CSR_FCSR_ADDR:     cpu.fcsr = val & 0xff; cpu.mstatus |= MSTATUS_FS; break;
+#endif
+#ifdef CONFIG_RVV
+    case CSR_VSTART_ADDR:   cpu.vec.vstart = val & (CONFIG_RVV_VLEN - 1); cpu.mstatus |= MSTATUS_VS; break;
+    case CSR_VXSAT_ADDR:    cpu.vec.vcsr = (cpu.vec.vcsr & ~1) | (val & 1); cpu.mstatus |= MSTATUS_VS; break;
+    case CSR_VXRM_ADDR:     cpu.vec.vcsr = (cpu.vec.vcsr & 1) | ((val & 3) << 1); cpu.mstatus |= MSTATUS_VS; break;
+    case CSR_VCSR_ADDR:     cpu.vec.vcsr = val & 7; cpu.mstatus |= MSTATUS_VS; break;
+#endif
+    default: return false;
+  }
+  intr_recheck();
+  return true;
+}
@@ -14,15 +14,50 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/perf.h>
+#include "../local-include/priv.h"
 
-word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
-   */
+IFDEF(CONFIG_ETRACE, void etrace_add(vaddr_t pc, word_t code);)
+
+vaddr_t raise_trap(word_t NO, vaddr_t epc, word_t tval) {
+  IFDEF(CONFIG_ETRACE, etrace_add(epc, NO));
+  IFDEF(CONFIG_PERF, perf_trap(NO));
+  cpu.mepc = epc;
+  cpu.mcause = NO;
+  cpu.mtval = tval;
+  word_t s = cpu.mstatus & ~(MSTATUS_MPIE | MSTATUS_MIE);
+  if (cpu.mstatus & MSTATUS_MIE) s |= MSTATUS_MPIE;
+  cpu.mstatus = s;
+  vaddr_t base = cpu.mtvec & ~(word_t)3;
+  // in vectored mode, interrupts jump to base + 4 * cause
+  return ((cpu.mtvec & 3) == 1 && (NO & INTR_BIT)) ? base + 4 * (NO & ~INTR_BIT) : base;
+}
+
+vaddr_t trap_return_m() {
+  word_t s = cpu.mstatus & ~MSTATUS_MIE;
+  if (cpu.mstatus & MSTATUS_MPIE) s |= MSTATUS_MIE;
+  cpu.mstatus = s | MSTATUS_MPIE;
+  intr_recheck();
+  return cpu.mepc;
+}
 
-  return 0;
+word_t isa_raise_intr(word_t NO, vaddr_t epc) {
+  return raise_trap(NO, epc, 0);
 }
 
 word_t isa_query_intr() {
+  word_t pending = cpu.mip & cpu.mie;
+  if (pending == 0 || !(cpu.mstatus & MSTATUS_MIE)) return INTR_EMPTY;
+  // MEI, MSI, MTI in order of priority
+  static const int order[] = { 11, 3, 7 };
+  int i;
+  for (i = 0; i < ARRLEN(order); i ++) {
+    if ((pending >> order[i]) & 1) return INTR_BIT | order[i];
+  }
   return INTR_EMPTY;
 }
+
+void isa_set_irq(int irq, bool level) {
+  if (level) cpu.mip |= 1ull << irq;
+  else cpu.mip &= ~(1ull << irq);
+}
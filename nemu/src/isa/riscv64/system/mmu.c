@@ -20,3 +20,11 @@
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
   return MEM_RET_FAIL;
 }
+
+paddr_t isa_mmu_debug_translate(vaddr_t vaddr, int type) {
+  return MEM_RET_FAIL;
+}
+
+void isa_mmu_fault(vaddr_t vaddr, int type) {
+  panic("page fault at " FMT_WORD " without an MMU", vaddr);
+}
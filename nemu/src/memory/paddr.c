@@ -17,6 +17,7 @@
 #include <memory/paddr.h>
 #include <device/mmio.h>
 #include <isa.h>
+#include <cpu/difftest.h>
 
 #if   defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
@@ -77,3 +78,18 @@ void paddr_write(paddr_t addr, int len, word_t data) {
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
+
+uint8_t* paddr_dma_ptr(paddr_t addr, uint32_t len, bool is_write) {
+  if (len == 0) return NULL;
+  if (in_pmem(addr)) return (len - 1 <= PMEM_RIGHT - addr ? guest_to_host(addr) : NULL);
+  IFDEF(CONFIG_DEVICE, return mmio_dma_ptr(addr, len, is_write));
+  return NULL;
+}
+
+void paddr_dma_sync(paddr_t addr, uint32_t len) {
+#ifdef CONFIG_DIFFTEST
+  if (len > 0 && in_pmem(addr) && ref_difftest_memcpy != NULL) {
+    ref_difftest_memcpy(addr, guest_to_host(addr), len, DIFFTEST_TO_REF);
+  }
+#endif
+}
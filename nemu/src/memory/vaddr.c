@@ -15,15 +15,182 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <cpu/cpu.h>
+#include <cpu/perf.h>
+#include <cpu/timing.h>
+
+#ifdef CONFIG_WATCHPOINT
+extern vaddr_t wp_lo, wp_hi;
+void mem_wp_hit(vaddr_t addr, int len, int type);
+
+// only accesses overlapping the range of some watch point reach the pool
+#define check_mem_wp(addr, len, type) do { \
+  if (unlikely((addr) <= wp_hi && (addr) + (len) - 1 >= wp_lo)) mem_wp_hit(addr, len, type); \
+} while (0)
+#endif
+
+#define CROSS_PAGE(addr, len) (((addr) & PAGE_MASK) + (len) > PAGE_SIZE)
+
+/* Translate an access of the guest. On a page fault the ISA takes the
+ * exception and the current instruction is abandoned, so this only
+ * returns with a valid address.
+ */
+static inline paddr_t translate(vaddr_t addr, int len, int type) {
+  if (likely(isa_mmu_check(addr, len, type) == MMU_DIRECT)) return addr;
+  paddr_t pg = isa_mmu_translate(addr, len, type);
+  if (likely((pg & PAGE_MASK) == MEM_RET_OK)) return pg | (addr & PAGE_MASK);
+  Assert(nemu_state.state == NEMU_RUNNING,
+      "page fault at " FMT_WORD " outside guest execution", addr);
+  isa_mmu_fault(addr, type);
+  longjmp_exception();
+  return 0;
+}
+
+// an access across a page boundary is split into bytes
+static inline bool split_access(vaddr_t addr, int len, int type) {
+  return unlikely(CROSS_PAGE(addr, len)) && isa_mmu_check(addr, len, type) == MMU_TRANSLATE;
+}
+
+#ifdef CONFIG_TIMING
+// the bytes on either page are contiguous, so each page is one data access
+static void timing_split(vaddr_t addr, const paddr_t *paddr, int len, bool is_write) {
+  int len0 = PAGE_SIZE - (addr & PAGE_MASK);
+  timing_mem(paddr[0], len0, is_write);
+  timing_mem(paddr[len0], len - len0, is_write);
+}
+#endif
+
+// translate every byte first, so that a fault leaves memory unchanged
+static void translate_split(vaddr_t addr, paddr_t *paddr, int len, int type) {
+  int i;
+  for (i = 0; i < len; i ++) paddr[i] = translate(addr + i, 1, type);
+}
+
+static word_t read_split(vaddr_t addr, int len, int type) {
+  paddr_t paddr[8];
+  translate_split(addr, paddr, len, type);
+  IFDEF(CONFIG_TIMING, if (type == MEM_TYPE_READ) timing_split(addr, paddr, len, false));
+  word_t data = 0;
+  int i;
+  for (i = 0; i < len; i ++) data |= paddr_read(paddr[i], 1) << (i * 8);
+  return data;
+}
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  if (split_access(addr, len, MEM_TYPE_IFETCH)) return read_split(addr, len, MEM_TYPE_IFETCH);
+  return paddr_read(translate(addr, len, MEM_TYPE_IFETCH), len);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  IFDEF(CONFIG_WATCHPOINT, check_mem_wp(addr, len, MEM_TYPE_READ));
+  IFDEF(CONFIG_PERF, perf_load[len] ++);
+  if (split_access(addr, len, MEM_TYPE_READ)) return read_split(addr, len, MEM_TYPE_READ);
+  paddr_t paddr = translate(addr, len, MEM_TYPE_READ);
+  IFDEF(CONFIG_TIMING, timing_mem(paddr, len, false));
+  return paddr_read(paddr, len);
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+  IFDEF(CONFIG_PERF, perf_store[len] ++);
+  if (split_access(addr, len, MEM_TYPE_WRITE)) {
+    paddr_t paddr[8];
+    translate_split(addr, paddr, len, MEM_TYPE_WRITE);
+    IFDEF(CONFIG_TIMING, timing_split(addr, paddr, len, true));
+    int i;
+    for (i = 0; i < len; i ++) paddr_write(paddr[i], 1, (data >> (i * 8)) & 0xff);
+  } else {
+    paddr_t paddr = translate(addr, len, MEM_TYPE_WRITE);
+    IFDEF(CONFIG_TIMING, timing_mem(paddr, len, true));
+    paddr_write(paddr, len, data);
+  }
+  IFDEF(CONFIG_WATCHPOINT, check_mem_wp(addr, len, MEM_TYPE_WRITE));
+}
+
+/* A burst moves `n' elements of `esz' bytes between the guest and
+ * `buf', within at most two pages. Both pages are translated before
+ * any element moves, so a fault leaves no side effect. A page in pmem
+ * is copied as a whole; elsewhere, as with MMIO, every element is a
+ * separate access of its own size.
+ */
+static void burst(vaddr_t addr, uint8_t *buf, int esz, int n, int type) {
+  int len = esz * n;
+  if (len == 0) return;
+  Assert(len <= PAGE_SIZE, "burst of %d bytes at " FMT_WORD " is too long", len, addr);
+  int len0 = CROSS_PAGE(addr, len) ? PAGE_SIZE - (addr & PAGE_MASK) : len;
+  paddr_t pa0 = translate(addr, len0, type);
+  paddr_t pa1 = len0 < len ? translate(addr + len0, len - len0, type) : 0;
+  bool is_write = (type == MEM_TYPE_WRITE);
+#ifdef CONFIG_TIMING
+  timing_mem(pa0, len0, is_write);
+  if (len0 < len) timing_mem(pa1, len - len0, is_write);
+#endif
+
+  bool fast = !ISDEF(CONFIG_MTRACE) && in_pmem(pa0) && in_pmem(pa0 + len0 - 1) &&
+    (len0 == len || (in_pmem(pa1) && in_pmem(pa1 + len - len0 - 1)));
+  if (fast) {
+    if (is_write) {
+      memcpy(guest_to_host(pa0), buf, len0);
+      if (len0 < len) memcpy(guest_to_host(pa1), buf + len0, len - len0);
+    } else {
+      memcpy(buf, guest_to_host(pa0), len0);
+      if (len0 < len) memcpy(buf + len0, guest_to_host(pa1), len - len0);
+    }
+    return;
+  }
+
+  int off;
+  for (off = 0; off < len; off += esz) {
+    int sz = (off < len0 && off + esz > len0) ? 1 : esz; // split at the page boundary
+    int k;
+    for (k = 0; k < esz; k += sz) {
+      paddr_t pa = off + k < len0 ? pa0 + off + k : pa1 + off + k - len0;
+      if (is_write) {
+        word_t data = 0;
+        memcpy(&data, buf + off + k, sz);
+        paddr_write(pa, sz, data);
+      } else {
+        word_t data = paddr_read(pa, sz);
+        memcpy(buf + off + k, &data, sz);
+      }
+    }
+  }
+}
+
+void vaddr_read_burst(vaddr_t addr, void *buf, int esz, int n) {
+  IFDEF(CONFIG_WATCHPOINT, check_mem_wp(addr, esz * n, MEM_TYPE_READ));
+  IFDEF(CONFIG_PERF, perf_load[esz] += n);
+  burst(addr, buf, esz, n, MEM_TYPE_READ);
+}
+
+void vaddr_write_burst(vaddr_t addr, const void *buf, int esz, int n) {
+  IFDEF(CONFIG_PERF, perf_store[esz] += n);
+  burst(addr, (uint8_t *)buf, esz, n, MEM_TYPE_WRITE);
+  IFDEF(CONFIG_WATCHPOINT, check_mem_wp(addr, esz * n, MEM_TYPE_WRITE));
+}
+
+bool vaddr_debug_translate(vaddr_t addr, paddr_t *paddr) {
+  if (isa_mmu_check(addr, 1, MEM_TYPE_READ) == MMU_DIRECT) {
+    *paddr = addr;
+    return true;
+  }
+  paddr_t pg = isa_mmu_debug_translate(addr, MEM_TYPE_READ);
+  if ((pg & PAGE_MASK) != MEM_RET_OK) return false;
+  *paddr = pg | (addr & PAGE_MASK);
+  return true;
+}
+
+// only pmem is read, as an access to MMIO would run the hooks of the device
+word_t vaddr_debug_read(vaddr_t addr, int len, bool *success) {
+  word_t data = 0;
+  int i;
+  for (i = 0; i < len; i ++) {
+    paddr_t paddr;
+    if (!vaddr_debug_translate(addr + i, &paddr) || !in_pmem(paddr)) {
+      *success = false;
+      return 0;
+    }
+    data |= (word_t)*guest_to_host(paddr) << (i * 8);
+  }
+  return data;
 }
@@ -23,6 +23,7 @@ void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
 void init_sdb();
 void init_disasm(const char *triple);
+IFDEF(CONFIG_TIMING, void init_timing();)
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
@@ -35,6 +36,7 @@ static void welcome() {
   Log("Device Trace: %s", MUXDEF(CONFIG_DTRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
   Log("Exception Trace: %s", MUXDEF(CONFIG_ETRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
   Log("Watch Point: %s", MUXDEF(CONFIG_WATCHPOINT, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
+  Log("GDB Stub: %s", MUXDEF(CONFIG_GDBSTUB, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
   Log("Build time: %s, %s", __TIME__, __DATE__);
   printf("Welcome to %s-NEMU!\n", ANSI_FMT(str(__GUEST_ISA__), ANSI_FG_YELLOW ANSI_BG_RED));
   printf("For help, type \"help\"\n");
@@ -46,6 +48,11 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void sdb_set_gdb_mode(int port);
+IFDEF(CONFIG_VGA_DUMP, void vga_set_dump_file(const char *file);)
+IFDEF(CONFIG_HAS_SERIAL, void serial_set_stdin_input();)
+IFDEF(CONFIG_KEY_REPLAY, void keyboard_set_replay(const char *file);)
+IFDEF(CONFIG_KEY_REPLAY, void keyboard_set_record(const char *file);)
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
@@ -83,24 +90,44 @@ static int parse_args(int argc, char *argv[]) {
     {"port"     , required_argument, NULL, 'p'},
     {"help"     , no_argument      , NULL, 'h'},
     {"elf"      , required_argument, NULL, 'e'},
+    {"gdb"      , required_argument, NULL, 'g'},
+#ifdef CONFIG_VGA_DUMP
+    {"vga-dump" , required_argument, NULL, 'v'},
+#endif
+#ifdef CONFIG_KEY_REPLAY
+    {"key-replay", required_argument, NULL, 'k'},
+    {"key-record", required_argument, NULL, 'r'},
+#endif
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:g:" MUXDEF(CONFIG_VGA_DUMP, "v:", "") MUXDEF(CONFIG_KEY_REPLAY, "k:r:", ""), table, NULL)) != -1) {
     switch (o) {
-      case 'b': sdb_set_batch_mode(); break;
+      case 'b': sdb_set_batch_mode(); IFDEF(CONFIG_HAS_SERIAL, serial_set_stdin_input()); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
       case 'e': elf_file = optarg; break;
+      case 'g': sdb_set_gdb_mode(atoi(optarg)); break;
+#ifdef CONFIG_VGA_DUMP
+      case 'v': vga_set_dump_file(optarg); break;
+#endif
+#ifdef CONFIG_KEY_REPLAY
+      case 'k': keyboard_set_replay(optarg); break;
+      case 'r': keyboard_set_record(optarg); break;
+#endif
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
-        printf("\t-b,--batch              run with batch mode\n");
+        printf("\t-b,--batch              run with batch mode, reading serial input from stdin\n");
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
         printf("\t-e,--elf=FILE           read elf-file for symbol resolution\n");
+        printf("\t-g,--gdb=PORT           wait for gdb to attach on PORT\n");
+        IFDEF(CONFIG_VGA_DUMP, printf("\t-v,--vga-dump=FILE      dump the frames of VGA to FILE\n"));
+        IFDEF(CONFIG_KEY_REPLAY, printf("\t-k,--key-replay=FILE    replay the key events in FILE\n"));
+        IFDEF(CONFIG_KEY_REPLAY, printf("\t-r,--key-record=FILE    record the key events read by the guest to FILE\n"));
         printf("\n");
         exit(0);
     }
@@ -138,6 +165,9 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
+  /* Initialize the timing model. */
+  IFDEF(CONFIG_TIMING, init_timing());
+
   /* Initialize the simple debugger. */
   init_sdb();
 
@@ -166,6 +196,7 @@ void am_init_monitor() {
   init_isa();
   load_img();
   IFDEF(CONFIG_DEVICE, init_device());
+  IFDEF(CONFIG_TIMING, init_timing());
   welcome();
 }
 #endif
@@ -198,116 +198,257 @@ static bool make_token(char *e) {
 }
 
 
-static word_t eval(int p, int q, bool *success);
+/* An expression is compiled once into a postfix program which is run on
+ * a small value stack. Numbers and symbols become immediates, registers
+ * are bound to their storage, and every operator whose operands are all
+ * immediates is folded at compile time. A program stays small enough to
+ * be run after every instruction by the watch points.
+ */
+typedef struct {
+  int type; // TK_DEC_NUM for an immediate, TK_REG for a register, otherwise the operator
+  union {
+    word_t imm;
+    word_t *reg;
+  };
+} ExprInst;
+
+struct ExprProg {
+  int nr_inst;
+  bool has_mem; // the program dereferences memory
+  ExprInst inst[];
+};
+
+static ExprInst code[MAX_TOKEN_NUM] = {};
+static int nr_code = 0;
+static bool code_has_mem = false;
+
+static void compile(int p, int q, bool *success);
 static bool check_parentheses(int p, int q, bool *success);
 static int dominant_operator(int p, int q);
 
-word_t expr(char *e, bool *success) {
+ExprProg *expr_compile(char *e, bool *success) {
   if (!make_token(e)) {
     *success = false;
-    return 0;
+    return NULL;
+  }
+  nr_code = 0;
+  code_has_mem = false;
+  compile(0, nr_token - 1, success);
+  if (!*success) {
+    return NULL;
+  }
+  ExprProg *prog = (ExprProg *)malloc(sizeof(ExprProg) + sizeof(ExprInst) * nr_code);
+  prog->nr_inst = nr_code;
+  prog->has_mem = code_has_mem;
+  memcpy(prog->inst, code, sizeof(ExprInst) * nr_code);
+  return prog;
+}
+
+void expr_free(ExprProg *prog) {
+  free(prog);
+}
+
+bool expr_is_const(const ExprProg *prog, word_t *val) {
+  if (prog->nr_inst != 1 || prog->inst[0].type != TK_DEC_NUM) {
+    return false;
   }
-  return eval(0, nr_token - 1, success);
+  *val = prog->inst[0].imm;
+  return true;
 }
 
+static word_t unary_op(int op, word_t val) {
+  switch (op) {
+    case TK_NEG: return -val;
+    case '!': return !val;
+    case '~': return ~val;
+    default: panic("unknown unary operation %d", op);
+  }
+}
 
-static word_t eval(int p, int q, bool *success) {
+static word_t binary_op(int op, word_t val1, word_t val2, bool *success) {
+  switch (op) {
+    case TK_OR: return val1 || val2;
+    case TK_AND: return val1 && val2;
+    case TK_EQ: return val1 == val2;
+    case TK_NE: return val1 != val2;
+    case TK_LE: return val1 <= val2;
+    case TK_GE: return val1 >= val2;
+    case '<': return val1 < val2;
+    case '>': return val1 > val2;
+    case TK_SHIFT_L: return val1 << val2;
+    case TK_SHIFT_R: return val1 >> val2;
+    case '+': return val1 + val2;
+    case '-': return val1 - val2;
+    case '%':
+      if (val2 == 0) {
+        printf("Moded by zero.\n");
+        *success = false;
+        return 0;
+      }
+      return val1 % val2;
+    case '*': return val1 * val2;
+    case '/':
+      if (val2 == 0) {
+        printf("Divided by zero.\n");
+        *success = false;
+        return 0;
+      }
+      return val1 / val2;
+    case '^': return val1 ^ val2;
+    case '|': return val1 | val2;
+    case '&': return val1 & val2;
+    default: panic("unknown binary operation %d", op);
+  }
+}
+
+static void emit_imm(word_t imm) {
+  code[nr_code].type = TK_DEC_NUM;
+  code[nr_code ++].imm = imm;
+}
+
+static void emit_op(int op, bool *success) {
+  bool binary = (get_priority(op) != UNARY_OPERATOR);
+  // a constant subexpression always compiles to a single immediate
+  if (op != TK_DE_REF && code[nr_code - 1].type == TK_DEC_NUM &&
+      (!binary || code[nr_code - 2].type == TK_DEC_NUM)) {
+    word_t val;
+    if (binary) {
+      val = binary_op(op, code[nr_code - 2].imm, code[nr_code - 1].imm, success);
+      nr_code -= 2;
+    } else {
+      val = unary_op(op, code[nr_code - 1].imm);
+      nr_code -= 1;
+    }
+    emit_imm(val);
+    return;
+  }
+  if (op == TK_DE_REF) {
+    code_has_mem = true;
+  }
+  code[nr_code ++].type = op;
+}
+
+static void compile(int p, int q, bool *success) {
   if (p > q) {
     *success = false;
     printf("Empty subexpression at the %dth token.\n", p);
-    return 0;
+    return;
   }
-  word_t result;
   if (p == q) {
+    int idx;
+    word_t val;
     switch (tokens[p].type) {
       case TK_DEC_NUM: case TK_HEX_NUM:
-        result = strtoul(tokens[p].str, NULL, 0);
+        emit_imm(strtoul(tokens[p].str, NULL, 0));
         break;
       case TK_REG:
-        result = isa_reg_str2val(tokens[p].str + 1, success);
+        idx = isa_reg_str2idx(tokens[p].str + 1);
+        if (idx == -1) {
+          printf("No register named %s\n", tokens[p].str + 1);
+          *success = false;
+          return;
+        }
+        code[nr_code].type = TK_REG;
+        code[nr_code ++].reg = isa_reg_ptr(idx);
         break;
       case TK_SYMBOL:
-        result = isa_lookup_symtab_by_name(tokens[p].str, success);
+        val = isa_lookup_symtab_by_name(tokens[p].str, success);
+        if (*success) {
+          emit_imm(val);
+        }
         break;
       default:
         printf("Unknown primitive type.\n");
         *success = false;
-        result = 0;
     }
-    return result;
+    return;
   }
   if (check_parentheses(p, q, success)) {
-    return eval(p + 1, q - 1, success);
+    compile(p + 1, q - 1, success);
+    return;
   }
   if (!*success) {
-    return 0;
+    return;
   }
   int op = dominant_operator(p, q);
-  word_t val1, val2;
   if (op != -1) {
-    val1 = eval(p, op - 1, success);
+    compile(p, op - 1, success);
     if (!*success) {
-      return 0;
+      return;
     }
-    val2 = eval(op + 1, q, success);
+    compile(op + 1, q, success);
     if (!*success) {
-      return 0;
-    }
-    switch (tokens[op].type) {
-      case TK_OR: return val1 || val2;
-      case TK_AND: return val1 && val2;
-      case TK_EQ: return val1 == val2;
-      case TK_NE: return val1 != val2;
-      case TK_LE: return val1 <= val2;
-      case TK_GE: return val1 >= val2;
-      case '<': return val1 < val2;
-      case '>': return val1 > val2;
-      case TK_SHIFT_L: return val1 << val2;
-      case TK_SHIFT_R: return val1 >> val2;
-      case '+': return val1 + val2;
-      case '-': return val1 - val2;
-      case '%':
-        if (val2 == 0) {
-          printf("Moded by zero.\n");
-          *success = false;
-          return 0;
-        }
-        return val1 % val2;
-      case '*': return val1 * val2;
-      case '/':
-        if (val2 == 0) {
-          printf("Divided by zero.\n");
-          *success = false;
-          return 0;
-        }
-        return val1 / val2;
-      case '^': return val1 ^ val2;
-      case '|': return val1 | val2;
-      case '&': return val1 & val2;
-      default:
-        printf("Unknown bianry operation.\n");
-        *success = false;
-        return 0;
+      return;
     }
+    emit_op(tokens[op].type, success);
+    return;
   }
-  vaddr_t vaddr;
   switch (tokens[p].type) {
-    case TK_NEG: return -eval(p + 1, q, success);
-    case TK_DE_REF:
-      vaddr = eval(p + 1, q, success);
-      if (!*success) {
-        return 0;
+    case TK_NEG: case TK_DE_REF: case '!': case '~':
+      compile(p + 1, q, success);
+      if (*success) {
+        emit_op(tokens[p].type, success);
       }
-      return vaddr_read(vaddr, 4);
-    case '!': return !eval(p + 1, q, success);
-    case '~': return ~eval(p + 1, q, success);
+      return;
     default:
       printf("Unknown unary operation %c.\n", tokens[p].type);
       *success = false;
-      return 0;
   }
 }
 
+/* `has_mem' is a constant at both call sites, so the compiler produces a
+ * separate copy for register-only programs without the memory path.
+ */
+static inline __attribute__((always_inline))
+word_t run(const ExprProg *prog, bool has_mem, bool *success) {
+  word_t stack[MAX_TOKEN_NUM];
+  int top = 0;
+  int i;
+  for (i = 0; i < prog->nr_inst; i ++) {
+    const ExprInst *inst = &prog->inst[i];
+    switch (inst->type) {
+      case TK_DEC_NUM: stack[top ++] = inst->imm; break;
+      case TK_REG: stack[top ++] = *inst->reg; break;
+      case TK_DE_REF:
+        if (has_mem) {
+          stack[top - 1] = vaddr_debug_read(stack[top - 1], 4, success);
+          if (!*success) {
+            return 0;
+          }
+        }
+        break;
+      case TK_NEG: case '!': case '~':
+        stack[top - 1] = unary_op(inst->type, stack[top - 1]);
+        break;
+      default:
+        top --;
+        stack[top - 1] = binary_op(inst->type, stack[top - 1], stack[top], success);
+        if (!*success) {
+          return 0;
+        }
+    }
+  }
+  return stack[0];
+}
+
+word_t expr_run(const ExprProg *prog, bool *success) {
+  word_t val;
+  if (expr_is_const(prog, &val)) {
+    return val;
+  }
+  return prog->has_mem ? run(prog, true, success) : run(prog, false, success);
+}
+
+word_t expr(char *e, bool *success) {
+  ExprProg *prog = expr_compile(e, success);
+  if (prog == NULL) {
+    return 0;
+  }
+  word_t val = expr_run(prog, success);
+  expr_free(prog);
+  return val;
+}
+
 static bool check_parentheses(int p, int q, bool *success) {
   if (tokens[p].type != '(' || tokens[q].type != ')') {
     return false;
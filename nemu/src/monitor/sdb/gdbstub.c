@@ -0,0 +1,399 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include "sdb.h"
+
+#ifdef CONFIG_GDBSTUB
+
+/* A stub speaking the gdb remote serial protocol (RSP), see
+ * https://sourceware.org/gdb/onlinedocs/gdb/Remote-Protocol.html
+ * Only the all-stop subset needed by a single-threaded target is
+ * supported: registers, memory, step/continue, breakpoints and
+ * hardware-style watchpoints (Z0 - Z4).
+ */
+
+#define GDB_BUF_SIZE 4096
+// number of instructions executed between two checks of the interrupt (Ctrl-C) from gdb
+#define GDB_EXEC_CHUNK 65536
+
+static int gdb_fd = -1;
+static bool gdb_closed = false;
+static char in_buf[GDB_BUF_SIZE];
+static char out_buf[GDB_BUF_SIZE];
+
+static uint8_t rx_buf[256];
+static int rx_pos = 0, rx_len = 0;
+
+static int gdb_getc() {
+  if (rx_pos == rx_len) {
+    int ret = recv(gdb_fd, rx_buf, sizeof(rx_buf), 0);
+    if (ret <= 0) return -1;
+    rx_pos = 0;
+    rx_len = ret;
+  }
+  return rx_buf[rx_pos ++];
+}
+
+static bool gdb_write(const char *buf, int len) {
+  while (len > 0) {
+    int ret = send(gdb_fd, buf, len, 0);
+    if (ret <= 0) return false;
+    buf += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_val(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static uint64_t parse_hex(const char **p) {
+  uint64_t val = 0;
+  int d;
+  while ((d = hex_val(**p)) != -1) {
+    val = (val << 4) | d;
+    (*p) ++;
+  }
+  return val;
+}
+
+// registers and memory are transferred as little-endian byte sequences
+static char *put_bytes(char *p, const uint8_t *buf, int len) {
+  int i;
+  for (i = 0; i < len; i ++) {
+    *p ++ = hex_digits[buf[i] >> 4];
+    *p ++ = hex_digits[buf[i] & 0xf];
+  }
+  *p = '\0';
+  return p;
+}
+
+static bool get_bytes(const char **p, uint8_t *buf, int len) {
+  int i;
+  for (i = 0; i < len; i ++) {
+    int hi = hex_val((*p)[0]), lo = (hi == -1 ? -1 : hex_val((*p)[1]));
+    if (lo == -1) return false;
+    buf[i] = (hi << 4) | lo;
+    (*p) += 2;
+  }
+  return true;
+}
+
+/* Receive a packet `$data#cs' and acknowledge it. Return false if
+ * the connection is closed.
+ */
+static bool gdb_recv_packet() {
+  while (true) {
+    int c;
+    do {
+      c = gdb_getc();
+      if (c == -1) return false;
+    } while (c != '$');
+
+    int len = 0;
+    uint8_t sum = 0;
+    while ((c = gdb_getc()) != '#') {
+      if (c == -1) return false;
+      if (len < GDB_BUF_SIZE - 1) in_buf[len ++] = c;
+      sum += c;
+    }
+    in_buf[len] = '\0';
+
+    int hi = gdb_getc(), lo = gdb_getc();
+    if (hi == -1 || lo == -1) return false;
+    if (hex_val(hi) != -1 && hex_val(lo) != -1 && ((hex_val(hi) << 4) | hex_val(lo)) == sum) {
+      return gdb_write("+", 1);
+    }
+    if (!gdb_write("-", 1)) return false;
+  }
+}
+
+static bool gdb_send_packet(const char *data) {
+  static char pkt[GDB_BUF_SIZE + 4];
+  int len = strlen(data);
+  uint8_t sum = 0;
+  int i;
+  for (i = 0; i < len; i ++) sum += data[i];
+  pkt[0] = '$';
+  memcpy(pkt + 1, data, len);
+  pkt[len + 1] = '#';
+  pkt[len + 2] = hex_digits[sum >> 4];
+  pkt[len + 3] = hex_digits[sum & 0xf];
+
+  while (true) {
+    if (!gdb_write(pkt, len + 4)) return false;
+    int c = gdb_getc();
+    if (c == -1) return false;
+    if (c != '-') return true;
+  }
+}
+
+/* Check whether gdb asks to interrupt the running guest.
+ * Any data other than the interrupt character is dropped, since
+ * gdb does not send packets to a running target in all-stop mode.
+ * A closed connection is a detach rather than an interrupt.
+ */
+static bool gdb_interrupted() {
+  if (rx_pos == rx_len) {
+    struct pollfd pfd = { .fd = gdb_fd, .events = POLLIN };
+    if (poll(&pfd, 1, 0) <= 0) return false;
+  }
+  int c = gdb_getc();
+  if (c == -1) gdb_closed = true;
+  return c == 0x03;
+}
+
+static void gdb_stop_reply(bool interrupted) {
+  int type;
+  vaddr_t addr;
+  switch (nemu_state.state) {
+    case NEMU_END:   sprintf(out_buf, "W%02x", nemu_state.halt_ret & 0xff); return;
+    case NEMU_ABORT: sprintf(out_buf, "X%02x", SIGABRT); return;
+    case NEMU_QUIT:  sprintf(out_buf, "X%02x", SIGKILL); return;
+  }
+  if (!interrupted && query_wp_hit(&type, &addr) && type != WP_BREAK && type != WP_EXPR) {
+    const char *reason = (type == WP_WRITE ? "watch" : type == WP_READ ? "rwatch" : "awatch");
+    sprintf(out_buf, "T%02x%s:%" PRIx64 ";", SIGTRAP, reason, (uint64_t)addr);
+    return;
+  }
+  sprintf(out_buf, "S%02x", interrupted ? SIGINT : SIGTRAP);
+}
+
+static bool gdb_running() {
+  return nemu_state.state != NEMU_END && nemu_state.state != NEMU_ABORT &&
+    nemu_state.state != NEMU_QUIT;
+}
+
+static void gdb_step() {
+  clear_wp_hit();
+  cpu_exec_quiet(1);
+  gdb_stop_reply(false);
+}
+
+static void gdb_continue() {
+  int type;
+  vaddr_t addr;
+  clear_wp_hit();
+  while (true) {
+    cpu_exec(GDB_EXEC_CHUNK);
+    if (!gdb_running() || query_wp_hit(&type, &addr)) break;
+    if (gdb_interrupted() || gdb_closed) {
+      gdb_stop_reply(true);
+      return;
+    }
+  }
+  gdb_stop_reply(false);
+}
+
+static word_t *gdb_reg(int idx) {
+  return isa_reg_ptr(idx);
+}
+
+static void gdb_read_regs() {
+  char *p = out_buf;
+  int i;
+  word_t *r;
+  for (i = 0; (r = gdb_reg(i)) != NULL; i ++) {
+    p = put_bytes(p, (uint8_t *)r, sizeof(word_t));
+  }
+}
+
+static void gdb_write_regs(const char *p) {
+  int i;
+  word_t *r;
+  for (i = 0; (r = gdb_reg(i)) != NULL && *p != '\0'; i ++) {
+    word_t val;
+    if (!get_bytes(&p, (uint8_t *)&val, sizeof(word_t))) break;
+    *r = val;
+  }
+  strcpy(out_buf, "OK");
+}
+
+static void gdb_read_reg(const char *p) {
+  word_t *r = gdb_reg(parse_hex(&p));
+  if (r == NULL) { strcpy(out_buf, "E01"); return; }
+  put_bytes(out_buf, (uint8_t *)r, sizeof(word_t));
+}
+
+static void gdb_write_reg(const char *p) {
+  word_t *r = gdb_reg(parse_hex(&p));
+  word_t val;
+  if (r == NULL || *p ++ != '=' || !get_bytes(&p, (uint8_t *)&val, sizeof(word_t))) {
+    strcpy(out_buf, "E01");
+    return;
+  }
+  *r = val;
+  strcpy(out_buf, "OK");
+}
+
+/* Memory is accessed through the host pointer, so that neither devices
+ * nor watch points are disturbed by the debugger. A range must map to
+ * contiguous physical memory.
+ */
+static uint8_t *gdb_mem(vaddr_t addr, int len) {
+  paddr_t paddr, last;
+  if (len <= 0 || !vaddr_debug_translate(addr, &paddr) ||
+      !vaddr_debug_translate(addr + len - 1, &last) || last - paddr != len - 1) return NULL;
+  if (!in_pmem(paddr) || !in_pmem(last)) return NULL;
+  return guest_to_host(paddr);
+}
+
+static void gdb_read_mem(const char *p) {
+  vaddr_t addr = parse_hex(&p);
+  int len = (*p == ',' ? (p ++, parse_hex(&p)) : 0);
+  if (len > (GDB_BUF_SIZE - 1) / 2) len = (GDB_BUF_SIZE - 1) / 2;
+  uint8_t *host = gdb_mem(addr, len);
+  if (host == NULL) { strcpy(out_buf, "E14"); return; }
+  put_bytes(out_buf, host, len);
+}
+
+static void gdb_write_mem(const char *p) {
+  vaddr_t addr = parse_hex(&p);
+  int len = (*p == ',' ? (p ++, parse_hex(&p)) : -1);
+  uint8_t *host = gdb_mem(addr, len);
+  if (len == 0) { strcpy(out_buf, "OK"); return; }
+  if (host == NULL || *p ++ != ':' || !get_bytes(&p, host, len)) {
+    strcpy(out_buf, "E14");
+    return;
+  }
+  strcpy(out_buf, "OK");
+}
+
+static void gdb_point(const char *p, bool insert) {
+  static const int type_map[] = { WP_BREAK, WP_BREAK, WP_WRITE, WP_READ, WP_ACCESS };
+  int z = parse_hex(&p);
+  if (z >= ARRLEN(type_map) || *p ++ != ',') { out_buf[0] = '\0'; return; }
+  vaddr_t addr = parse_hex(&p);
+  int len = (*p == ',' ? (p ++, parse_hex(&p)) : 0);
+  int type = type_map[z];
+  if (type != WP_BREAK && len != 1 && len != 2 && len != 4 && len != sizeof(word_t)) {
+    // let gdb fall back to software watchpoints
+    out_buf[0] = '\0';
+    return;
+  }
+  bool success = true;
+  if (insert) add_gdb_wp(type, addr, len, &success);
+  else delete_gdb_wp(type, addr, len, &success);
+  strcpy(out_buf, success ? "OK" : "E0e");
+}
+
+static void gdb_query(const char *p) {
+  if (strncmp(p, "Supported", 9) == 0) sprintf(out_buf, "PacketSize=%x", GDB_BUF_SIZE);
+  else if (strcmp(p, "Attached") == 0) strcpy(out_buf, "1");
+  else if (strcmp(p, "C") == 0) strcpy(out_buf, "QC1");
+  else if (strcmp(p, "fThreadInfo") == 0) strcpy(out_buf, "m1");
+  else if (strcmp(p, "sThreadInfo") == 0) strcpy(out_buf, "l");
+  else out_buf[0] = '\0';
+}
+
+/* Serve one packet. Return false if the session is over. */
+static bool gdb_handle_packet() {
+  const char *p = in_buf + 1;
+  out_buf[0] = '\0';
+  switch (in_buf[0]) {
+    case '?': gdb_stop_reply(false); break;
+    case 'g': gdb_read_regs(); break;
+    case 'G': gdb_write_regs(p); break;
+    case 'p': gdb_read_reg(p); break;
+    case 'P': gdb_write_reg(p); break;
+    case 'm': gdb_read_mem(p); break;
+    case 'M': gdb_write_mem(p); break;
+    case 'Z': gdb_point(p, true); break;
+    case 'z': gdb_point(p, false); break;
+    case 'q': gdb_query(p); break;
+    case 'H': case 'T': strcpy(out_buf, "OK"); break;
+    case 'c': case 's':
+      if (*p != '\0') cpu.pc = parse_hex(&p);
+      if (!gdb_running()) { gdb_stop_reply(false); break; }
+      if (in_buf[0] == 'c') gdb_continue();
+      else gdb_step();
+      if (gdb_closed) return false;
+      break;
+    case 'D':
+      gdb_send_packet("OK");
+      return false;
+    case 'k':
+      nemu_state.state = NEMU_QUIT;
+      return false;
+    case 'v':
+      if (strcmp(p, "Kill") == 0 || strncmp(p, "Kill;", 5) == 0) {
+        nemu_state.state = NEMU_QUIT;
+        gdb_send_packet("OK");
+        return false;
+      }
+      break;
+  }
+  return gdb_send_packet(out_buf);
+}
+
+static int gdb_accept(int port) {
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+  Assert(lfd >= 0, "Can not create socket for gdb");
+  int on = 1;
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int ret = bind(lfd, (struct sockaddr *)&addr, sizeof(addr));
+  Assert(ret == 0, "Can not bind to port %d for gdb", port);
+  ret = listen(lfd, 1);
+  Assert(ret == 0, "Can not listen on port %d for gdb", port);
+
+  Log("Waiting for gdb to connect on localhost:%d ...", port);
+  int fd = accept(lfd, NULL, NULL);
+  Assert(fd >= 0, "Can not accept connection from gdb");
+  close(lfd);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  Log("gdb is connected");
+  return fd;
+}
+
+void gdbstub_mainloop(int port) {
+  gdb_fd = gdb_accept(port);
+  gdb_closed = false;
+  rx_pos = rx_len = 0;
+
+  while (gdb_recv_packet()) {
+    if (!gdb_handle_packet()) break;
+  }
+
+  close(gdb_fd);
+  gdb_fd = -1;
+  Log("gdb is disconnected");
+
+  // keep running the guest after gdb detaches
+  if (gdb_running()) cpu_exec(-1);
+}
+
+#endif
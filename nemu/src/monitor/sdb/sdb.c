@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/perf.h>
 #include <memory/vaddr.h>
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -22,6 +23,7 @@
 
 
 static int is_batch_mode = false;
+IFDEF(CONFIG_GDBSTUB, static int gdb_port = 0);
 
 /* We use the `readline' library to provide more flexibility to read from stdin. */
 static char* rl_gets() {
@@ -51,6 +53,8 @@ static int cmd_x(char *args);
 static int cmd_p(char *args);
 #ifdef CONFIG_WATCHPOINT
 static int cmd_w(char *args);
+static int cmd_b(char *args);
+static int cmd_tb(char *args);
 static int cmd_d(char *args);
 #endif
 IFDEF(CONFIG_FTRACE, static int cmd_bt(char *args);)
@@ -69,12 +73,15 @@ static struct {
   { "q", "Exit NEMU", cmd_q },
   /* TODO: Add more commands */
   { "si", "Single step forward for N(1 by default) instruction", cmd_si },
-  { "info", "Display information of registers(r) or watch points(w) or symbol tables(s)", cmd_info },
+  { "info", "Display information of registers(r) or watch points(w) or symbol tables(s) or performance counters(perf)", cmd_info },
   { "x", "Print N words of memory started from Expr", cmd_x },
   { "p", "Evaluate the given expression Expr", cmd_p },
 #ifdef CONFIG_WATCHPOINT
-  { "w", "Set a watch point for Expr", cmd_w },
-  { "d", "Delete the watch point numbered by N", cmd_d },
+  { "w", "Set a watch point for Expr, or for the word at address Expr with `w -l Expr'", cmd_w },
+  { "b", "Set a breakpoint at address Expr, taken only if Cond holds with `b Expr if Cond'", cmd_b },
+  { "tb", "Set a temporary breakpoint like `b', which is deleted when it is hit", cmd_tb },
+  { "d", "Delete the watch points numbered by N..., or all of them without N", cmd_d },
+  { "delete", "Same as `d'", cmd_d },
 #endif
   IFDEF(CONFIG_FTRACE, { "bt", "Display function call stack", cmd_bt },)
   IFDEF(CONFIG_IRINGBUF, { "ir", "Display instruction ring buffer", cmd_ir },)
@@ -90,7 +97,22 @@ void sdb_set_batch_mode() {
   is_batch_mode = true;
 }
 
+void sdb_set_gdb_mode(int port) {
+#ifdef CONFIG_GDBSTUB
+  gdb_port = port;
+#else
+  Log("gdb stub is not enabled, ignore port %d. Enable it in menuconfig.", port);
+#endif
+}
+
 void sdb_mainloop() {
+#ifdef CONFIG_GDBSTUB
+  if (gdb_port != 0) {
+    gdbstub_mainloop(gdb_port);
+    return;
+  }
+#endif
+
   if (is_batch_mode) {
     cmd_c(NULL);
     return;
@@ -191,14 +213,17 @@ static int cmd_si(char *args) {
 static int cmd_info(char *args) {
   char *arg = strtok(NULL, " ");
   if (arg == NULL) {
-    printf("%s%s%s", ANSI_FG_RED, "Usage: info r -> register\n       info w -> watch points\n       info s -> symbol table\n", ANSI_NONE);
+    printf("%s%s%s", ANSI_FG_RED, "Usage: info r -> register\n       info w -> watch points\n       info s -> symbol table\n" MUXDEF(CONFIG_PERF, "       info perf -> performance counters\n", ""), ANSI_NONE);
     return 0;
   }
   switch (arg[0]) {
     case 'r': isa_reg_display(); break;
     case 'w': display_wp(); break;
     case 's': isa_display_symtab(); break;
-    default: printf("%s%s%s\n", ANSI_FG_RED, "Usage: info r -> register\n       info w -> watch points\n       info s -> symbol table\n", ANSI_NONE);
+#ifdef CONFIG_PERF
+    case 'p': perf_display(); break;
+#endif
+    default: printf("%s%s%s\n", ANSI_FG_RED, "Usage: info r -> register\n       info w -> watch points\n       info s -> symbol table\n" MUXDEF(CONFIG_PERF, "       info perf -> performance counters\n", ""), ANSI_NONE);
   }
   return 0;
 }
@@ -227,7 +252,12 @@ static int cmd_x(char *args) {
       return 0;
     }
     for (i = 0; i < n; i++) {
-      printf("%#010x: %#010x\n", vaddr + (i << 2), vaddr_read(vaddr + (i << 2), 4));
+      word_t data = vaddr_debug_read(vaddr + (i << 2), 4, &success);
+      if (!success) {
+        printf("%sCannot access memory at " FMT_WORD "!%s\n", ANSI_FG_RED, vaddr + (i << 2), ANSI_NONE);
+        break;
+      }
+      printf(FMT_WORD ": " FMT_WORD "\n", vaddr + (i << 2), data);
     }
   } else {
     printf("%s%s%s\n", ANSI_FG_RED, "Usage: x N Expr (eg. x 10 $sp, N > 0)", ANSI_NONE);
@@ -248,7 +278,7 @@ static int cmd_p(char *args) {
   }
   printf("%sValid Expr: %s%s\n", ANSI_FG_GREEN, args, ANSI_NONE);
   printf("Value:  %-20s%-20s%-20s\n", "hexdecimal", "unsigned decimal", "signed decimal");
-  printf("        %#-20x%-20u%-20d\n", res, res, res);
+  printf("        %#-20" PRIx64 "%-20" PRIu64 "%-20" PRId64 "\n", (uint64_t)res, (uint64_t)res, (int64_t)(sword_t)res);
   return 0;
 }
 
@@ -259,24 +289,51 @@ static int cmd_w(char *args) {
     return 0;
   }
   bool success = true;
-  add_wp(args, &success);
+  if (strncmp(args, "-l ", 3) == 0) {
+    add_mem_wp(args + 3, &success);
+  } else {
+    add_wp(args, &success);
+  }
   if (!success) {
     printf("%sFail to set watch point for %s!%s\n", ANSI_FG_RED, args, ANSI_NONE);
   }
   return 0;
 }
 
+static int set_bp(char *args, bool temp) {
+  if (args == NULL) {
+    printf("%sUsage: %s Expr [if Cond]%s\n", ANSI_FG_RED, temp ? "tb" : "b", ANSI_NONE);
+    return 0;
+  }
+  bool success = true;
+  add_bp(args, temp, &success);
+  if (!success) {
+    printf("%sFail to set breakpoint at %s!%s\n", ANSI_FG_RED, args, ANSI_NONE);
+  }
+  return 0;
+}
+
+static int cmd_b(char *args) {
+  return set_bp(args, false);
+}
+
+static int cmd_tb(char *args) {
+  return set_bp(args, true);
+}
+
 static int cmd_d(char *args) {
   char *arg = strtok(NULL, " ");
   if (arg == NULL) {
-    printf("%s%s%s\n", ANSI_FG_RED, "Usage: d N", ANSI_NONE);
+    delete_all_wp();
     return 0;
   }
-  int n = strtol(arg, NULL, 0);
-  bool success = true;
-  delete_wp(n, &success);
-  if (!success) {
-    printf("%sFail to delete watch point numbered %d!%s\n", ANSI_FG_RED, n, ANSI_NONE);
+  for (; arg != NULL; arg = strtok(NULL, " ")) {
+    int n = strtol(arg, NULL, 0);
+    bool success = true;
+    delete_wp(n, &success);
+    if (!success) {
+      printf("%sFail to delete watch point numbered %d!%s\n", ANSI_FG_RED, n, ANSI_NONE);
+    }
   }
   return 0;
 }
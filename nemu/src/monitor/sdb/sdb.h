@@ -22,12 +22,42 @@ void init_regex();
 
 word_t expr(char *e, bool *success);
 
+typedef struct ExprProg ExprProg;
+
+ExprProg *expr_compile(char *e, bool *success);
+
+word_t expr_run(const ExprProg *prog, bool *success);
+
+void expr_free(ExprProg *prog);
+
+bool expr_is_const(const ExprProg *prog, word_t *val);
+
 #ifdef CONFIG_WATCHPOINT
+enum { WP_EXPR, WP_WRITE, WP_READ, WP_ACCESS, WP_BREAK };
+
 void init_wp_pool();
 
 void add_wp(char *e, bool *success);
 
+void add_mem_wp(char *e, bool *success);
+
+void add_bp(char *e, bool temp, bool *success);
+
 void delete_wp(int NO, bool *success);
+
+void delete_all_wp();
+
+void add_gdb_wp(int type, vaddr_t addr, int len, bool *success);
+
+void delete_gdb_wp(int type, vaddr_t addr, int len, bool *success);
+
+bool query_wp_hit(int *type, vaddr_t *addr);
+
+void clear_wp_hit();
+#endif
+
+#ifdef CONFIG_GDBSTUB
+void gdbstub_mainloop(int port);
 #endif
 
 void display_wp();
@@ -13,20 +13,52 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/vaddr.h>
 #include "sdb.h"
 
+#ifdef CONFIG_WATCHPOINT
+
 #define NR_WP 32
 
 typedef struct watchpoint {
   int NO;
   struct watchpoint *next;
+  int type;
+  bool gdb; // set by the gdb stub: report every hit without comparing values
+  bool temp; // a breakpoint deleted when it is hit
   char *expr;
+  ExprProg *prog; // the watched expression, or the condition of a breakpoint
   word_t value;
+  vaddr_t addr; // start of the watched range, or the pc of a breakpoint
+  int len;
 } WP;
 
 static WP wp_pool[NR_WP] = {};
 static WP *head = NULL, *free_ = NULL;
 
+/* These let the execution loop and the memory access path skip the
+ * pool entirely when nothing can be hit. [wp_lo, wp_hi] covers the
+ * ranges of all memory watchpoints and is empty when there is none.
+ */
+static int nr_expr_wp = 0;
+vaddr_t wp_lo = -1, wp_hi = 0;
+uint64_t bp_filter[BP_FILTER_BITS / 64] = {};
+
+/* the watch point which stops the execution most recently */
+static WP *hit_wp = NULL;
+static vaddr_t hit_addr = 0;
+
+static const char *wp_type_name[] = {
+  [WP_EXPR] = "expr", [WP_WRITE] = "write", [WP_READ] = "read",
+  [WP_ACCESS] = "access", [WP_BREAK] = "break",
+};
+
+static bool is_mem_wp(WP *wp) {
+  return wp->type == WP_WRITE || wp->type == WP_READ || wp->type == WP_ACCESS;
+}
+
 void init_wp_pool() {
   int i;
   for (i = 0; i < NR_WP; i ++) {
@@ -41,38 +73,222 @@ void init_wp_pool() {
 static WP *new_wp(bool *success);
 static void free_wp(WP *wp);
 
-void add_wp(char *e, bool *success) {
+static void update_wp_range() {
+  wp_lo = -1;
+  wp_hi = 0;
+  WP *p;
+  for (p = head; p != NULL; p = p->next) {
+    if (!is_mem_wp(p)) continue;
+    if (p->addr < wp_lo) wp_lo = p->addr;
+    if (p->addr + p->len - 1 > wp_hi) wp_hi = p->addr + p->len - 1;
+  }
+}
+
+static void update_bp_filter() {
+  memset(bp_filter, 0, sizeof(bp_filter));
+  WP *p;
+  for (p = head; p != NULL; p = p->next) {
+    if (p->type != WP_BREAK) continue;
+    bp_filter[BP_FILTER_IDX(p->addr) / 64] |= 1ull << (BP_FILTER_IDX(p->addr) % 64);
+  }
+}
+
+static void release_wp(WP *wp) {
+  if (wp->type == WP_EXPR) nr_expr_wp --;
+  if (wp == hit_wp) hit_wp = NULL;
+  free(wp->expr);
+  wp->expr = NULL;
+  if (wp->prog != NULL) {
+    expr_free(wp->prog);
+    wp->prog = NULL;
+  }
+  free_wp(wp);
+  update_wp_range();
+  if (wp->type == WP_BREAK) update_bp_filter();
+}
+
+static WP *alloc_wp(int type, bool *success) {
   WP *wp = new_wp(success);
   if (!*success) {
     printf("%sNo free watch points.%s\n", ANSI_FG_RED, ANSI_NONE);
+    return NULL;
+  }
+  wp->type = type;
+  wp->gdb = false;
+  wp->temp = false;
+  wp->expr = NULL;
+  wp->prog = NULL;
+  wp->value = 0;
+  wp->addr = 0;
+  wp->len = 0;
+  return wp;
+}
+
+static char *copy_expr(const char *e) {
+  char *s = (char *)malloc(strlen(e) + 1);
+  strcpy(s, e);
+  return s;
+}
+
+static void set_mem_wp(vaddr_t addr, int len, char *e, bool *success) {
+  word_t value = vaddr_debug_read(addr, len, success);
+  if (!*success) {
+    printf("%sCannot access memory at " FMT_WORD "!%s\n", ANSI_FG_RED, addr, ANSI_NONE);
+    return;
+  }
+  WP *wp = alloc_wp(WP_WRITE, success);
+  if (!*success) {
     return;
   }
-  wp->value = expr(e, success);
+  wp->addr = addr;
+  wp->len = len;
+  wp->value = value;
+  wp->expr = copy_expr(e);
+  update_wp_range();
+  printf("%sWatch point %d on [" FMT_WORD ", " FMT_WORD "] = " FMT_WORD " is set.%s\n",
+      ANSI_FG_GREEN, wp->NO, wp->addr, wp->addr + wp->len - 1, wp->value, ANSI_NONE);
+}
+
+void add_wp(char *e, bool *success) {
+  ExprProg *prog = expr_compile(e, success);
   if (!*success) {
     printf("%sInvalid Expression %s!%s\n", ANSI_FG_RED, e, ANSI_NONE);
+    return;
+  }
+  word_t value;
+  if (expr_is_const(prog, &value)) {
+    printf("%sExpression %s is the constant " FMT_WORD " and never changes.%s\n",
+        ANSI_FG_RED, e, value, ANSI_NONE);
+    expr_free(prog);
+    *success = false;
+    return;
+  }
+  // even `*ADDR' is evaluated again, as a watch on ADDR would miss the writes of devices
+  WP *wp = alloc_wp(WP_EXPR, success);
+  if (!*success) {
+    expr_free(prog);
+    return;
+  }
+  wp->value = expr_run(prog, success);
+  if (!*success) {
+    printf("%sInvalid Expression %s!%s\n", ANSI_FG_RED, e, ANSI_NONE);
+    expr_free(prog);
     free_wp(wp);
     return;
   }
-  wp->expr = (char *)malloc(strlen(e) + 1);
-  strcpy(wp->expr, e);
-  printf("%sWatch point %d with expression %s = %#08x is set.%s\n", ANSI_FG_GREEN, wp->NO, wp->expr, wp->value, ANSI_NONE);
+  wp->expr = copy_expr(e);
+  wp->prog = prog;
+  nr_expr_wp ++;
+  printf("%sWatch point %d with expression %s = " FMT_WORD " is set.%s\n", ANSI_FG_GREEN, wp->NO, wp->expr, wp->value, ANSI_NONE);
+}
+
+/* Watch the word located at the address given by `e'. The expression
+ * is evaluated only once here; afterwards the watch point is checked
+ * by the memory access path instead of being evaluated again, so it
+ * does not see the writes of devices.
+ */
+void add_mem_wp(char *e, bool *success) {
+  vaddr_t addr = expr(e, success);
+  if (!*success) {
+    printf("%sInvalid Expression %s!%s\n", ANSI_FG_RED, e, ANSI_NONE);
+    return;
+  }
+  set_mem_wp(addr, sizeof(word_t), e, success);
+}
+
+/* Set a breakpoint with `ADDR [if COND]'. ADDR is evaluated once, while
+ * COND is compiled here and only run when the pc reaches ADDR.
+ */
+void add_bp(char *e, bool temp, bool *success) {
+  char *full = copy_expr(e);
+  char *cond = strstr(e, " if ");
+  if (cond != NULL) {
+    *cond = '\0';
+    cond += 4;
+  }
+  vaddr_t addr = expr(e, success);
+  if (!*success) {
+    printf("%sInvalid Expression %s!%s\n", ANSI_FG_RED, e, ANSI_NONE);
+    free(full);
+    return;
+  }
+  ExprProg *prog = NULL;
+  if (cond != NULL) {
+    prog = expr_compile(cond, success);
+    if (!*success) {
+      printf("%sInvalid Expression %s!%s\n", ANSI_FG_RED, cond, ANSI_NONE);
+      free(full);
+      return;
+    }
+    word_t value;
+    if (expr_is_const(prog, &value) && value != 0) {
+      expr_free(prog);
+      prog = NULL;
+    }
+  }
+  WP *wp = alloc_wp(WP_BREAK, success);
+  if (!*success) {
+    if (prog != NULL) expr_free(prog);
+    free(full);
+    return;
+  }
+  wp->addr = addr;
+  wp->len = 1;
+  wp->value = addr;
+  wp->expr = full;
+  wp->prog = prog;
+  wp->temp = temp;
+  update_bp_filter();
+  printf("%s%s %d at " FMT_WORD " is set.%s\n", ANSI_FG_GREEN,
+      temp ? "Temporary breakpoint" : "Breakpoint", wp->NO, addr, ANSI_NONE);
+}
+
+void add_gdb_wp(int type, vaddr_t addr, int len, bool *success) {
+  WP *wp = alloc_wp(type, success);
+  if (!*success) {
+    return;
+  }
+  wp->gdb = true;
+  wp->addr = addr;
+  wp->len = (type == WP_BREAK ? 1 : len);
+  update_wp_range();
+  if (type == WP_BREAK) update_bp_filter();
+}
+
+void delete_gdb_wp(int type, vaddr_t addr, int len, bool *success) {
+  WP *p;
+  for (p = head; p != NULL; p = p->next) {
+    if (p->gdb && p->type == type && p->addr == addr && (type == WP_BREAK || p->len == len)) {
+      release_wp(p);
+      return;
+    }
+  }
+  *success = false;
 }
 
 void update_wp() {
+  if (nr_expr_wp == 0) {
+    return;
+  }
   WP *p = head;
   word_t new_value;
   bool success = true;
   while (p != NULL) {
-    new_value = expr(p->expr, &success);
+    if (p->type != WP_EXPR) {
+      p = p->next;
+      continue;
+    }
+    new_value = expr_run(p->prog, &success);
     if (!success) {
       printf("%sInvalid expression %s in watch point %d!%s\n", ANSI_FG_RED, p->expr, p->NO, ANSI_NONE);
     } else {
       if (new_value != p->value) {
-        printf("%sWatch point %d with expression %s changes from %#08x to %#08x.%s\n",
+        printf("%sWatch point %d with expression %s changes from " FMT_WORD " to " FMT_WORD ".%s\n",
           ANSI_FG_YELLOW, p->NO, p->expr, p->value, new_value, ANSI_NONE);
         p->value = new_value;
         if (nemu_state.state == NEMU_RUNNING) {
           nemu_state.state = NEMU_STOP;
+          hit_wp = p;
         }
       }
     }
@@ -80,12 +296,100 @@ void update_wp() {
   }
 }
 
+/* Called by the execution loop when the bit of `pc' in bp_filter is set,
+ * which may be a false positive of the hash.
+ */
+void check_bp(vaddr_t pc) {
+  WP *p;
+  for (p = head; p != NULL; p = p->next) {
+    if (p->type != WP_BREAK || p->addr != pc) {
+      continue;
+    }
+    if (p->prog != NULL) {
+      bool success = true;
+      word_t cond = expr_run(p->prog, &success);
+      if (!success) {
+        printf("%sInvalid condition in breakpoint %d!%s\n", ANSI_FG_RED, p->NO, ANSI_NONE);
+      } else if (cond == 0) {
+        continue;
+      }
+    }
+    if (nemu_state.state == NEMU_RUNNING) {
+      if (!p->gdb) {
+        printf("%s%s %d at " FMT_WORD ".%s\n", ANSI_FG_YELLOW,
+            p->temp ? "Temporary breakpoint" : "Breakpoint", p->NO, pc, ANSI_NONE);
+      }
+      nemu_state.state = NEMU_STOP;
+      hit_wp = p;
+      hit_addr = pc;
+      if (p->temp) {
+        release_wp(p);
+      }
+    }
+    return;
+  }
+}
+
+static bool wp_match_access(WP *wp, vaddr_t addr, int len, int type) {
+  if (addr > wp->addr + wp->len - 1 || addr + len - 1 < wp->addr) {
+    return false;
+  }
+  switch (wp->type) {
+    case WP_WRITE:  return type == MEM_TYPE_WRITE;
+    case WP_READ:   return type == MEM_TYPE_READ;
+    case WP_ACCESS: return true;
+    default:        return false;
+  }
+}
+
+/* Called by the memory access path when [addr, addr + len) overlaps
+ * [wp_lo, wp_hi]. Accesses performed while the guest is not running
+ * come from the debugger itself and never trigger a watch point.
+ */
+void mem_wp_hit(vaddr_t addr, int len, int type) {
+  if (nemu_state.state != NEMU_RUNNING) {
+    return;
+  }
+  WP *p;
+  for (p = head; p != NULL; p = p->next) {
+    if (!is_mem_wp(p) || !wp_match_access(p, addr, len, type)) {
+      continue;
+    }
+    if (!p->gdb) {
+      bool ok = true;
+      word_t new_value = vaddr_debug_read(p->addr, p->len, &ok);
+      if (!ok || new_value == p->value) {
+        continue;
+      }
+      printf("%sWatch point %d at " FMT_WORD " changes from " FMT_WORD " to " FMT_WORD ".%s\n",
+          ANSI_FG_YELLOW, p->NO, p->addr, p->value, new_value, ANSI_NONE);
+      p->value = new_value;
+    }
+    nemu_state.state = NEMU_STOP;
+    hit_wp = p;
+    hit_addr = addr;
+    break;
+  }
+}
+
+bool query_wp_hit(int *type, vaddr_t *addr) {
+  if (hit_wp == NULL) {
+    return false;
+  }
+  *type = hit_wp->type;
+  *addr = hit_addr;
+  return true;
+}
+
+void clear_wp_hit() {
+  hit_wp = NULL;
+}
+
 void delete_wp(int NO, bool *success) {
   WP *p = head;
   while (p != NULL) {
     if (p->NO == NO) {
-      free(p->expr);
-      free_wp(p);
+      release_wp(p);
       printf("Watch point numbered %d is deleted.\n", NO);
       return;
     }
@@ -95,6 +399,22 @@ void delete_wp(int NO, bool *success) {
   *success = false;
 }
 
+/* Delete every watch point and breakpoint set from sdb, leaving the
+ * ones owned by the gdb stub.
+ */
+void delete_all_wp() {
+  WP *p = head;
+  WP *temp;
+  while (p != NULL) {
+    temp = p;
+    p = p->next;
+    if (!temp->gdb) {
+      release_wp(temp);
+    }
+  }
+  printf("All watch points are deleted.\n");
+}
+
 void clear_wp_pool() {
   Log("Clearing watch point pool ...");
   WP *p = head;
@@ -102,11 +422,12 @@ void clear_wp_pool() {
   while (p != NULL) {
     temp = p;
     p = p->next;
-    free(temp->expr);
-    free_wp(temp);
+    release_wp(temp);
   }
 }
 
+#endif
+
 void display_wp() {
 #ifdef CONFIG_WATCHPOINT
   WP *p = head;
@@ -116,18 +437,24 @@ void display_wp() {
 #ifdef CONFIG_WATCHPOINT
     return;
   }
-  printf("Watch Points\n-----------------------------------------------------------------------------------\n");
-  printf("%-10s%-20s%-20s%-20s%-20s\n", "No", "Expr", "Value-Hexdecimal", "Value-Unsigned", "Value-Signed");
-  printf("-----------------------------------------------------------------------------------\n");
+  printf("Watch Points\n---------------------------------------------------------------------------------------------\n");
+  printf("%-10s%-10s%-20s%-20s%-20s%-20s\n", "No", "Type", "Expr", "Value-Hexdecimal", "Value-Unsigned", "Value-Signed");
+  printf("---------------------------------------------------------------------------------------------\n");
   while (p != NULL) {
-    printf("%-10d%-20s%#-20x%-20u%-20d\n", p->NO, p->expr, p->value, p->value, p->value);
+    if (p->gdb) {
+      printf("%-10d%-10s" FMT_WORD " (len = %d, set by gdb)\n", p->NO, wp_type_name[p->type], p->addr, p->len);
+    } else {
+      printf("%-10d%-10s%-19s %#-20" PRIx64 "%-20" PRIu64 "%-20" PRId64 "\n", p->NO, p->temp ? "tbreak" : wp_type_name[p->type],
+          p->expr, (uint64_t)p->value, (uint64_t)p->value, (int64_t)(sword_t)p->value);
+    }
     p = p->next;
   }
-  printf("-----------------------------------------------------------------------------------\n");
+  printf("---------------------------------------------------------------------------------------------\n");
 #endif
 }
 
 
+#ifdef CONFIG_WATCHPOINT
 static WP *new_wp(bool *success) {
   if (free_ == NULL) {
     *success = false;
@@ -167,4 +494,4 @@ static void free_wp(WP *wp) {
     prev = prev->next;
   }
 }
-
+#endif
@@ -19,6 +19,7 @@ void init_monitor(int, char *[]);
 void am_init_monitor();
 void engine_start();
 int is_exit_status_bad();
+IFDEF(CONFIG_PERF, void perf_dump();)
 
 int main(int argc, char *argv[]) {
   /* Initialize the monitor. */
@@ -30,6 +31,7 @@ int main(int argc, char *argv[]) {
 
   /* Start engine. */
   engine_start();
+  IFDEF(CONFIG_PERF, perf_dump());
 
   return is_exit_status_bad();
 }
@@ -69,6 +69,7 @@ extern "C" void init_disasm(const char *triple) {
     gSTI->ApplyFeatureFlag("+c");
     gSTI->ApplyFeatureFlag("+f");
     gSTI->ApplyFeatureFlag("+d");
+    gSTI->ApplyFeatureFlag("+v");
   }
   gMII = target->createMCInstrInfo();
   gMRI = target->createMCRegInfo(gTriple);